@@ -0,0 +1,298 @@
+/*******************************************************************************
+* Module Name : keyboard_block.c
+* Description : Lines of a command continued with backslashes. A pasted
+*               block may run to thousands of lines, so they are kept in an
+*               implicit treap: each node is one line and knows the number
+*               of lines below it, which gives its line number on the way
+*               down. Random priorities keep the tree O(log n) deep.
+********************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "keyboard_block.h"
+
+// Text buffers grow in steps of this many bytes
+#define BLOCK_TEXT_STEP		32
+
+struct BlockNode
+{
+	BlockNode *Left;
+	BlockNode *Right;
+	uint32_t Prio;
+	unsigned int Count;		// lines in this subtree
+	unsigned short Len;
+	unsigned short Size;		// bytes allocated for Text
+	char *Text;
+};
+
+/******************************************************************************
+* Function Name : BlockCount
+* Parameters    : [in] N - subtree, may be NULL
+* Description   : Gives the number of lines in a subtree
+* Return Value  : the count
+******************************************************************************/
+
+static unsigned int BlockCount(const BlockNode *N)
+{
+	return N ? N->Count : 0;
+}
+
+/******************************************************************************
+* Function Name : BlockUpdate
+* Parameters    : [in] N - node whose children changed
+* Description   : Recounts the lines of a subtree
+* Return Value  : NULL
+******************************************************************************/
+
+static void BlockUpdate(BlockNode *N)
+{
+	N->Count = 1 + BlockCount(N->Left) + BlockCount(N->Right);
+}
+
+/******************************************************************************
+* Function Name : BlockSplit
+* Parameters    : [in] N - subtree
+*                 [in] Lines - lines to split off
+*                 [out] Low - the first Lines lines
+*                 [out] High - the rest
+* Description   : Splits a subtree after its first Lines lines
+* Return Value  : NULL
+******************************************************************************/
+
+static void BlockSplit(BlockNode *N, unsigned int Lines, BlockNode **Low,
+					   BlockNode **High)
+{
+	if (N == NULL)
+	{
+		*Low = *High = NULL;
+		return;
+	}
+	if (BlockCount(N->Left) < Lines)
+	{
+		BlockSplit(N->Right, Lines - BlockCount(N->Left) - 1, &N->Right, High);
+		*Low = N;
+	}
+	else
+	{
+		BlockSplit(N->Left, Lines, Low, &N->Left);
+		*High = N;
+	}
+	BlockUpdate(N);
+}
+
+/******************************************************************************
+* Function Name : BlockMerge
+* Parameters    : [in] Low - subtree of the first lines
+*                 [in] High - subtree of the lines following them
+* Description   : Joins two subtrees, the one of higher priority on top
+* Return Value  : the joined subtree
+******************************************************************************/
+
+static BlockNode *BlockMerge(BlockNode *Low, BlockNode *High)
+{
+	if ((Low == NULL) || (High == NULL))
+		return Low ? Low : High;
+	if (Low->Prio > High->Prio)
+	{
+		Low->Right = BlockMerge(Low->Right, High);
+		BlockUpdate(Low);
+		return Low;
+	}
+	High->Left = BlockMerge(Low, High->Left);
+	BlockUpdate(High);
+	return High;
+}
+
+/******************************************************************************
+* Function Name : BlockFind
+* Parameters    : [in] N - root
+*                 [in] Line - line number
+* Description   : Walks down to a line
+* Return Value  : its node, NULL if there is no such line
+******************************************************************************/
+
+static BlockNode *BlockFind(BlockNode *N, unsigned int Line)
+{
+	while (N)
+	{
+		if (Line < BlockCount(N->Left))
+		{
+			N = N->Left;
+		}
+		else if (Line == BlockCount(N->Left))
+		{
+			return N;
+		}
+		else
+		{
+			Line -= BlockCount(N->Left) + 1;
+			N = N->Right;
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+* Function Name : BlockStore
+* Parameters    : [in] N - node
+*                 [in] Text - new text of the line
+*                 [in] Len - its length
+* Description   : Copies a line's text into its node, growing the buffer
+* Return Value  : 0 on success, -1 if out of memory
+******************************************************************************/
+
+static int BlockStore(BlockNode *N, const char *Text, unsigned short Len)
+{
+	unsigned int Size = (Len / BLOCK_TEXT_STEP + 1) * BLOCK_TEXT_STEP;
+	char *New;
+
+	if (Len >= N->Size)
+	{
+		New = realloc(N->Text, Size);
+		if (New == NULL)
+			return -1;
+		N->Text = New;
+		N->Size = (unsigned short)Size;
+	}
+	memcpy(N->Text, Text, Len);
+	N->Text[Len] = 0;
+	N->Len = Len;
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : BlockFree
+* Parameters    : [in] N - subtree, may be NULL
+* Description   : Frees a subtree
+* Return Value  : NULL
+******************************************************************************/
+
+static void BlockFree(BlockNode *N)
+{
+	if (N == NULL)
+		return;
+	BlockFree(N->Left);
+	BlockFree(N->Right);
+	free(N->Text);
+	free(N);
+}
+
+/******************************************************************************
+* Function Name : BlockClear
+* Parameters    : [in] B - block
+* Description   : Drops every line
+* Return Value  : NULL
+******************************************************************************/
+
+void BlockClear(LineBlock *B)
+{
+	BlockFree(B->Root);
+	B->Root = NULL;
+}
+
+/******************************************************************************
+* Function Name : BlockLines
+* Parameters    : [in] B - block
+* Description   : Gives the number of lines
+* Return Value  : the count
+******************************************************************************/
+
+unsigned int BlockLines(const LineBlock *B)
+{
+	return BlockCount(B->Root);
+}
+
+/******************************************************************************
+* Function Name : BlockGet
+* Parameters    : [in] B - block
+*                 [in] Line - line number
+*                 [out] Len - length of the line
+* Description   : Looks a line up
+* Return Value  : its NUL terminated text, NULL if there is no such line
+******************************************************************************/
+
+const char *BlockGet(const LineBlock *B, unsigned int Line, unsigned short *Len)
+{
+	BlockNode *N = BlockFind(B->Root, Line);
+
+	if (N == NULL)
+		return NULL;
+	*Len = N->Len;
+	return N->Text;
+}
+
+/******************************************************************************
+* Function Name : BlockSet
+* Parameters    : [in] B - block
+*                 [in] Line - line number
+*                 [in] Text - new text of the line
+*                 [in] Len - its length
+* Description   : Changes a line
+* Return Value  : 0 on success, -1 if there is no such line or out of
+*                 memory
+******************************************************************************/
+
+int BlockSet(LineBlock *B, unsigned int Line, const char *Text, unsigned short Len)
+{
+	BlockNode *N = BlockFind(B->Root, Line);
+
+	if (N == NULL)
+		return -1;
+	return BlockStore(N, Text, Len);
+}
+
+/******************************************************************************
+* Function Name : BlockInsert
+* Parameters    : [in] B - block
+*                 [in] Line - number the new line gets, up to BlockLines
+*                 [in] Text - its text
+*                 [in] Len - its length
+* Description   : Puts in a line, the lines from Line on move one down
+* Return Value  : 0 on success, -1 if Line is out of range or out of memory
+******************************************************************************/
+
+int BlockInsert(LineBlock *B, unsigned int Line, const char *Text, unsigned short Len)
+{
+	BlockNode *N, *Low, *High;
+
+	if (Line > BlockLines(B))
+		return -1;
+	N = calloc(1, sizeof(BlockNode));
+	if ((N == NULL) || (BlockStore(N, Text, Len) < 0))
+	{
+		free(N);
+		return -1;
+	}
+	// xorshift32
+	if (B->Seed == 0)
+		B->Seed = 2463534242u;
+	B->Seed ^= B->Seed << 13;
+	B->Seed ^= B->Seed >> 17;
+	B->Seed ^= B->Seed << 5;
+	N->Prio = B->Seed;
+	N->Count = 1;
+
+	BlockSplit(B->Root, Line, &Low, &High);
+	B->Root = BlockMerge(BlockMerge(Low, N), High);
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : BlockDelete
+* Parameters    : [in] B - block
+*                 [in] Line - line number
+* Description   : Takes a line out, the lines after it move one up
+* Return Value  : 0 on success, -1 if there is no such line
+******************************************************************************/
+
+int BlockDelete(LineBlock *B, unsigned int Line)
+{
+	BlockNode *Low, *N, *High;
+
+	if (Line >= BlockLines(B))
+		return -1;
+	BlockSplit(B->Root, Line, &Low, &High);
+	BlockSplit(High, 1, &N, &High);
+	B->Root = BlockMerge(Low, High);
+	BlockFree(N);
+	return 0;
+}
@@ -0,0 +1,38 @@
+/*******************************************************************************
+* Module Name : keyboard_block.h
+* Description : Contains function declarations for keyboard_block.c
+*******************************************************************************/
+#ifndef _KEYBOARD_BLOCK_
+#define _KEYBOARD_BLOCK_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BlockNode BlockNode;
+
+/*
+ Lines of a command continued with backslashes, numbered from 0. They are
+ kept in a treap ordered by line number, so finding, changing or putting
+ in a line takes O(log n) whatever the size of the block.
+*/
+typedef struct LineBlock
+{
+	BlockNode *Root;		// NULL while empty
+	uint32_t Seed;			// priorities of new lines
+} LineBlock;
+
+void BlockClear(LineBlock *B);
+unsigned int BlockLines(const LineBlock *B);
+const char *BlockGet(const LineBlock *B, unsigned int Line, unsigned short *Len);
+int BlockSet(LineBlock *B, unsigned int Line, const char *Text, unsigned short Len);
+int BlockInsert(LineBlock *B, unsigned int Line, const char *Text, unsigned short Len);
+int BlockDelete(LineBlock *B, unsigned int Line);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,235 +10,1175 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <limits.h>
+#include <stdint.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
 #include "keyboard_driver.h"
+#include "keyboard_fuzzy.h"
+#include "keyboard_history.h"
+#include "keyboard_term.h"
+#include "keyboard_keymap.h"
+#include "keyboard_highlight.h"
+#include "keyboard_block.h"
+#ifdef REX_SELF_CHECK
+#include "keyboard_shadow.h"
+#endif
+
+/*
+ Static tracepoints (USDT, provider "rex") for looking into a running
+ process, see keyboard_latency.bt. Built with REX_USE_SDT they are single
+ nops until a tracer attaches, otherwise nothing at all. They carry no
+ time stamps, the tracer takes those when a probe fires.
+*/
+#ifdef REX_USE_SDT
+#include <sys/sdt.h>
+#define REX_TRACE2(Name, a, b)			DTRACE_PROBE2(rex, Name, a, b)
+#define REX_TRACE3(Name, a, b, c)		DTRACE_PROBE3(rex, Name, a, b, c)
+#define REX_TRACE4(Name, a, b, c, d)	DTRACE_PROBE4(rex, Name, a, b, c, d)
+#else
+#define REX_TRACE2(Name, a, b)
+#define REX_TRACE3(Name, a, b, c)
+#define REX_TRACE4(Name, a, b, c, d)
+#endif
 
 static int RawConsole = 0;
 static int Opened = 0;
 static struct termios orgt;
-static int peek = -1;
 
 // holds the window column size
 int g_ColumnLen = 80;
+// holds the window row size
+int g_RowLen = 24;
 
-/******************************************************************************
-* Function Name : Unix_getch
-* Parameters    : NULL
-* Description   :
-* Return Value  : NULL
-******************************************************************************/
+/*
+ Scratch arena for the transient data of one prompt (completion candidates
+ and the like). Allocation is a pointer bump; ArenaReset rewinds every
+ block but keeps it, so once a session has seen its largest prompt further
+ prompts run without calling malloc at all.
+*/
+typedef struct ArenaBlock
+{
+	struct ArenaBlock *Next;
+	size_t Size;
+	size_t Used;
+	char Data[];
+} ArenaBlock;
 
-static int Unix_getch(void)
+typedef struct Arena
 {
-	int ch;
-	/* Check if we already peek the character using kbhit */
-	if (peek != -1)
-	{
-		ch = peek;
-		peek = -1;
-		return ch;
-	}
-	return getchar();
-}
+	ArenaBlock *Head;
+	ArenaBlock *Cur;
+} Arena;
+
+typedef struct ArenaMark
+{
+	ArenaBlock *Cur;
+	size_t Used;
+} ArenaMark;
+
+/*
+ One completion candidate, Str points into the session arena.
+*/
+typedef struct ConsoleCandidate
+{
+	const char *Str;
+	unsigned short Len;
+} ConsoleCandidate;
+
+struct ConsoleCompletions
+{
+	Arena *Scratch;
+	unsigned short Start;		// index of the word being completed
+	unsigned int Count;
+	unsigned int Size;
+	ConsoleCandidate *Cand;
+};
+
+/*
+ Candidate list being paged through with --More--. Candidates are laid
+ out column by column like ls; Rows is the total number of rows.
+*/
+typedef struct CmdLineMore
+{
+	ConsoleCompletions List;	// Count is 0 when no list is shown
+	ArenaMark Mark;			// released when the list is closed
+	unsigned int ColWidth;
+	unsigned int Cols;
+	unsigned int Rows;
+	unsigned int PageRows;		// screen rows a page takes at most
+	unsigned int NextRow;		// first row not shown yet
+	char *Page;			// render buffer for one page
+} CmdLineMore;
+
+/*
+ Fuzzy match over a candidate set kept in the arena while the user types,
+ so every key stroke only re-ranks the matches of the previous one.
+ For completion the set is the one the completer gave from Start, and is
+ reused while it gives as many from the same Start after the same text
+ (hashed into Context).
+*/
+typedef struct CmdLineFuzzy
+{
+	int Active;
+	FuzzySet Set;
+	FuzzyState State;
+	ArenaMark Mark;			// arena position before the set
+	unsigned short Start;		// where the replaced word starts
+	uint32_t Context;
+	unsigned int Cycle;		// rank currently shown
+} CmdLineFuzzy;
+
+/*
+ One change of the line: Len chars inserted at, or deleted from, Pos. The
+ chars are kept in the text ring from the running offset Text. Serial
+ tells the key stroke that made the change; undo takes back all records
+ of one key stroke together.
+*/
+typedef struct UndoRec
+{
+	unsigned int Text;
+	unsigned short Pos;
+	unsigned short Len;
+	unsigned short Serial;
+	unsigned char Insert;
+	unsigned char Typed;		// made by typing, may grow by typing
+} UndoRec;
+
+/*
+ Bounded undo log of the line being edited. Records and their text live
+ in two rings; when either is full the oldest key strokes are forgotten.
+ Records from Head to Cur can be undone, from Cur to Tail redone.
+*/
+typedef struct CmdLineUndo
+{
+	UndoRec Rec[UNDO_LOG_RECORDS];
+	char Text[UNDO_LOG_TEXT];
+	unsigned int Head;
+	unsigned int Cur;
+	unsigned int Tail;
+	unsigned int TextHead;		// running offsets into Text
+	unsigned int TextTail;
+	unsigned short Serial;		// key stroke being processed
+	int Typing;			// it is bound to self-insert
+} CmdLineUndo;
+
+/*
+ State of the command line being edited on a session.
+*/
+typedef struct CmdLineState
+{
+	char *CmdLine;			// caller's buffer, NULL when not reading
+					// holds the line of the block being edited
+	unsigned short Index;
+	unsigned short curIndex;
+	int isPassword;
+	unsigned char LastAction;	// KA_ action of the previous key
+	CmdLineMore More;
+	unsigned int HistPos;		// history entries back, 0 for the edited line
+	char Saved[MAX_CMD_SIZE];	// edited line while browsing history
+	CmdLineFuzzy Complete;		// fuzzy Tab completion
+	CmdLineFuzzy Search;		// fuzzy history search (Ctrl-R)
+	char Query[FUZZY_MAX_QUERY];	// history search text
+	unsigned int QueryLen;
+	unsigned short Shown;		// length of the search line on screen
+	CmdLineUndo Undo;
+	int Highlight;			// styled as typed, see ConsoleSetHighlight
+	HighlightLine Hl;
+	unsigned char Painted[MAX_CMD_SIZE];	// style each char is shown in
+	unsigned short DamageFrom;	// Hl and Painted may differ from here
+	unsigned short DamageTo;	// up to here
+	int Suggest;			// see ConsoleSetSuggest
+	char SuggestText[MAX_CMD_SIZE + 1];	// history entry suggested
+	unsigned short SuggestAt;	// its chars from here on are shown
+	unsigned short SuggestEnd;	// after the line, up to here
+	int SuggestStale;		// the shown chars may have been overwritten
+	LineBlock Block;		// lines continued with a backslash
+	unsigned int BlockLine;		// the one being edited
+	unsigned short BlockWide;	// most chars it has shown since
+	unsigned short BlockReach;	// rows of the block known on the screen
+					// right above it
+	int BlockCols;			// g_ColumnLen BlockReach is counted in
+} CmdLineState;
+
+// Painted value of a char whose cell was not written yet
+#define HL_UNPAINTED	0xFF
+
+/*
+ Prompt the line is read after, as put out and as wide as it shows. It is
+ kept between lines, so the same prompt is only measured once.
+*/
+typedef struct CmdLinePrompt
+{
+	char Text[PROMPT_MAX_SIZE];
+	unsigned short Len;
+	unsigned short Width;		// columns of its last row
+} CmdLinePrompt;
+
+/*
+ Per-session console state.
+ Bytes are pulled from the input descriptor in bulk into a ring buffer and
+ the key decoder consumes them from there. The ring survives between
+ GetCmdLine calls, so anything typed ahead of a prompt (or several lines
+ sent at once by a script) is kept in order and handed to the next prompt
+ without another read().
+ The line queue holds the ring positions of every buffered line terminator,
+ i.e. the lines that are already complete but not consumed yet.
+ The wait fields bound how long a blocking read may take; they are only
+ set for the duration of a GetCmdLineTimed call.
+ Echo is collected in OutBuf and written with one write() per batch of
+ keys, so a session never allocates while keys are processed. Driven by
+ CmdLinePoll, a session never waits for the terminal either: what it does
+ not take stays in OutBuf, and once OutBuf is full it moves to the spill
+ area, which grows as needed and is kept like the arena blocks.
+*/
+struct ConsoleSession
+{
+	int InFd;
+	int OutFd;
+	unsigned char InBuf[CONSOLE_INBUF_SIZE];
+	unsigned int InHead;		// running count of consumed bytes
+	unsigned int InTail;		// running count of buffered bytes
+	unsigned int LineEnd[CONSOLE_MAX_LINES];
+	unsigned int LineHead;
+	unsigned int LineTail;
+	int HasDeadline;
+	struct timespec Deadline;	// absolute, CLOCK_MONOTONIC
+	int IdleTimeoutMs;		// 0 for no idle timeout
+	struct timespec LastInput;	// when the last byte arrived
+	int CancelFd;			// eventfd, -1 if not cancellable
+	int Expired;			// sticky timeout/cancel status
+	int NonBlocking;		// set while driven by CmdLinePoll
+	int Again;			// a read would have blocked
+	int EscWait;			// a lone ESC waits for the rest of a sequence
+	struct timespec EscDeadline;	// until then, CLOCK_MONOTONIC
+	int ColumnLen;			// g_ColumnLen while not selected
+	int RowLen;			// g_RowLen while not selected
+	CmdLineState Line;
+	CmdLinePrompt Prompt;
+	ConsoleCompleter Completer;
+	int MatchMode;			// REX_MATCH_PREFIX or REX_MATCH_FUZZY
+	int SlowLink;			// mid-line edits use ICH/DCH
+	const TermCaps *Caps;		// NULL until first used, then from $TERM
+	const KeyMap *Keys;		// NULL for the built-in emacs keymap
+	KeyMap *OwnKeys;		// copy changed with ConsoleBindKey
+	int Highlight;			// REX_HIGHLIGHT_OFF or REX_HIGHLIGHT_ON
+	ConsoleCommandCheck CommandCheck;
+	unsigned char Pen;		// HL_ style the terminal draws in
+	char *History[HISTORY_SIZE];
+	unsigned int HistoryCount;	// running count of added lines
+	unsigned int HistorySorted[HISTORY_SIZE];	// running counts, by text
+	unsigned int HistorySortedCount;
+	unsigned int HistoryNewest[2 * HISTORY_SIZE];	// see HistoryIndexBuild
+	int HistoryNewestValid;
+	int Suggest;			// REX_SUGGEST_OFF or REX_SUGGEST_ON
+	ShmHistory *Shared;		// history shared with other processes
+	uint64_t SharedSeen;		// next shared ticket to copy in
+	uint64_t SharedStuck;		// ticket found busy on the last sync
+	Arena Scratch;			// reset when each GetCmdLine call ends
+	char *Spill;			// echo the terminal did not take, before OutBuf
+	unsigned int SpillLen;
+	unsigned int SpillSize;
+	unsigned int OutLen;
+	char OutBuf[CONSOLE_OUTBUF_SIZE];
+#ifdef REX_SELF_CHECK
+	ShadowScreen Shadow;		// what the terminal shows
+	unsigned int ShadowFed;		// OutBuf bytes played on it already
+	unsigned long SelfCheckFailures;
+#endif
+};
+
+static ConsoleSession DefaultSession = {
+	.InFd = STDIN_FILENO, .OutFd = STDOUT_FILENO, .CancelFd = -1,
+	.SharedStuck = UINT64_MAX
+};
+static ConsoleSession *Session = &DefaultSession;
+
+// Columns the prompt takes before the line, continuation lines have
+// no prompt
+#define PROMPT_WIDTH	(Session->Line.BlockLine ? 0 : Session->Prompt.Width)
+
+static unsigned short KeySelfInsert(CmdLineState *L, unsigned short ch);
+static unsigned short KeyBackwardDeleteChar(CmdLineState *L, unsigned short ch);
+static void TermPut(int Cap);
+static void ConsoleMakeRoom(void);
 
 /******************************************************************************
-* Function Name : Termios_Unix_kbhit
-* Parameters    : NULL
-* Description   :
-* Return Value  : NULL
+* Function Name : ArenaAlloc
+* Parameters    : [in] A - arena to allocate from
+*                 [in] Size - number of bytes needed
+* Description   : Bump allocates Size bytes, reusing blocks kept by an
+*                 earlier reset before asking malloc for a new one
+* Return Value  : the memory, NULL if out of memory
 ******************************************************************************/
 
-static int Termios_Unix_kbhit(void)
+static void *ArenaAlloc(Arena *A, size_t Size)
 {
-	struct termios oldt,newt;
-	int ch;
+	ArenaBlock *Blk = A->Cur, *New;
+	void *Ptr;
 
-	tcgetattr(STDIN_FILENO, &oldt);
-	newt = oldt;
-	newt.c_cc[VMIN] = 1;
-	newt.c_cc[VTIME] = 0;
-	newt.c_cc[VINTR] = _POSIX_VDISABLE;
+	Size = (Size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
 
-	tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-	ch = getchar();
-	tcsetattr(STDIN_FILENO,TCSANOW, &oldt);
-	if (ch != EOF)
+	while (Blk && (Blk->Size - Blk->Used < Size))
 	{
-		peek = ch;
-		return 1;
+		Blk = Blk->Next;
+		if (Blk)
+			Blk->Used = 0;
 	}
-	return 0;
+
+	if (Blk == NULL)
+	{
+		New = malloc(sizeof(ArenaBlock) +
+					 (Size > ARENA_BLOCK_SIZE ? Size : ARENA_BLOCK_SIZE));
+		if (New == NULL)
+			return NULL;
+		New->Next = NULL;
+		New->Size = Size > ARENA_BLOCK_SIZE ? Size : ARENA_BLOCK_SIZE;
+		New->Used = 0;
+		// append after the last kept block
+		if (A->Head == NULL)
+		{
+			A->Head = New;
+		}
+		else
+		{
+			Blk = A->Cur ? A->Cur : A->Head;
+			while (Blk->Next)
+				Blk = Blk->Next;
+			Blk->Next = New;
+		}
+		Blk = New;
+	}
+
+	A->Cur = Blk;
+	Ptr = &Blk->Data[Blk->Used];
+	Blk->Used += Size;
+	return Ptr;
 }
 
 /******************************************************************************
-* Function Name : Unix_kbhit
-* Parameters    : NULL
-* Description   :
+* Function Name : ArenaReset
+* Parameters    : [in] A - arena
+* Description   : Frees everything in the arena but keeps its blocks
 * Return Value  : NULL
 ******************************************************************************/
-static int Unix_kbhit(void)
+
+static void ArenaReset(Arena *A)
 {
-	if (peek != -1) {
-		return 1;
-	}
-	return Termios_Unix_kbhit();
+	A->Cur = A->Head;
+	if (A->Head)
+		A->Head->Used = 0;
 }
 
 /******************************************************************************
-* Function Name : ConsolePutChar
-* Parameters    : [in] ch - character to be put on the console
-* Description   : Puts the given character in the console
-* Return Value  : NULL
+* Function Name : ArenaGetMark / ArenaRelease
+* Parameters    : [in] A - arena
+*                 [in] Mark - position from ArenaGetMark
+* Description   : Frees everything allocated after the mark was taken
+* Return Value  : the mark / NULL
 ******************************************************************************/
 
-void ConsolePutChar(unsigned short ch)
+static ArenaMark ArenaGetMark(Arena *A)
 {
+	ArenaMark Mark = { A->Cur, A->Cur ? A->Cur->Used : 0 };
+	return Mark;
+}
 
-	if (!Opened)
+static void ArenaRelease(Arena *A, ArenaMark Mark)
+{
+	if (Mark.Cur)
 	{
-		fprintf(stdout,"%c",ch);
-		fflush(stdout);
-		return;
+		A->Cur = Mark.Cur;
+		Mark.Cur->Used = Mark.Used;
 	}
-	if (isascii(ch))
+	else
 	{
-		fprintf(stdout,"%c",ch);
-		fflush(stdout);
+		ArenaReset(A);
 	}
 }
 
 /******************************************************************************
-* Function Name : ConsoleBell
-* Parameters    : NULL
-* Description   : Puts a bell on the console
+* Function Name : ArenaFree
+* Parameters    : [in] A - arena
+* Description   : Gives all blocks of the arena back to malloc
 * Return Value  : NULL
 ******************************************************************************/
-void ConsoleBell(void)
+
+static void ArenaFree(Arena *A)
 {
-	ConsolePutChar(REX_KEY_BELL);
+	ArenaBlock *Blk = A->Head, *Next;
+
+	while (Blk)
+	{
+		Next = Blk->Next;
+		free(Blk);
+		Blk = Next;
+	}
+	A->Head = NULL;
+	A->Cur = NULL;
 }
 
 /******************************************************************************
-* Function Name : CloseConsole
-* Parameters    : NULL
-* Description   : Closes a opened console
-* Return Value  : NULL
+* Function Name : MsUntil
+* Parameters    : [in] Now - current time
+*                 [in] When - time to reach
+* Description   : Gives the time from Now until When, rounded up to whole
+*                 milliseconds so that poll() never wakes up early
+* Return Value  : milliseconds left, 0 if When has already passed
 ******************************************************************************/
-void CloseConsole(void)
+
+static int MsUntil(const struct timespec *Now, const struct timespec *When)
 {
-	Opened = 0;
-	tcsetattr( STDIN_FILENO, TCSANOW, &orgt );
+	long long ns;
+
+	ns = (long long)(When->tv_sec - Now->tv_sec) * 1000000000LL +
+		 (When->tv_nsec - Now->tv_nsec);
+	if (ns <= 0)
+		return 0;
+	if (ns > (long long)INT_MAX * 1000000LL)
+		return INT_MAX;
+	return (int)((ns + 999999) / 1000000);
 }
 
 /******************************************************************************
-* Function Name : OpenConsole
-* Parameters    : [in] rawmode - mode in which the console is to be opened
-* Description   : Opens a console for the client(user) in the specific mode
-* Return Value  : NULL
+* Function Name : Unix_wait
+* Parameters    : [in] TimeoutMs - time to wait, -1 waits until the session
+*                                  deadline/idle timeout (forever if unset)
+* Description   : Sleeps in poll() until the input descriptor is readable,
+*                 the session is cancelled or the wait times out. Nothing
+*                 runs while waiting, so idle sessions cost no CPU.
+* Return Value  : 1 if readable, 0 on a plain timeout, or one of
+*                 REX_KEY_TIMEOUT/REX_KEY_IDLE/REX_KEY_CANCEL
 ******************************************************************************/
 
-void OpenConsole(int rawmode)
+static int Unix_wait(int TimeoutMs)
 {
-	struct termios newt;
+	struct pollfd pfd[2];
+	struct timespec Now, IdleEnd;
+	int nfds = 1, Reason = 0, Left, rc;
+	uint64_t Count;
 
-	if (Opened == 1)
+	pfd[0].fd = Session->InFd;
+	pfd[0].events = POLLIN;
+	// short waits inside an escape sequence are never cancelled
+	if ((Session->CancelFd >= 0) && (TimeoutMs < 0))
 	{
-		CloseConsole();
+		pfd[1].fd = Session->CancelFd;
+		pfd[1].events = POLLIN;
+		nfds = 2;
 	}
-	Opened = 1;
-	RawConsole=rawmode;
 
-	tcgetattr( STDIN_FILENO, &orgt);
-	newt = orgt;
-	newt.c_lflag &= ~( ICANON | ECHO );
-	tcsetattr( STDIN_FILENO, TCSANOW, &newt );
+	while (1)
+	{
+		if ((TimeoutMs < 0) &&
+			(Session->HasDeadline || Session->IdleTimeoutMs))
+		{
+			clock_gettime(CLOCK_MONOTONIC, &Now);
+			TimeoutMs = -1;
+			if (Session->HasDeadline)
+			{
+				TimeoutMs = MsUntil(&Now, &Session->Deadline);
+				Reason = REX_KEY_TIMEOUT;
+			}
+			if (Session->IdleTimeoutMs)
+			{
+				IdleEnd = Session->LastInput;
+				IdleEnd.tv_sec += Session->IdleTimeoutMs / 1000;
+				IdleEnd.tv_nsec += (Session->IdleTimeoutMs % 1000) * 1000000L;
+				if (IdleEnd.tv_nsec >= 1000000000L)
+				{
+					IdleEnd.tv_sec++;
+					IdleEnd.tv_nsec -= 1000000000L;
+				}
+				Left = MsUntil(&Now, &IdleEnd);
+				if ((TimeoutMs < 0) || (Left < TimeoutMs))
+				{
+					TimeoutMs = Left;
+					Reason = REX_KEY_IDLE;
+				}
+			}
+		}
+
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		rc = poll(pfd, nfds, TimeoutMs);
+		if (rc > 0)
+			break;
+		if (rc == 0)
+			return Reason;
+		if (errno != EINTR)
+			return 1;	// let read() report the error
+		// interrupted (e.g. SIGWINCH), recompute the time left
+		if (Reason)
+			TimeoutMs = -1;
+	}
+
+	if ((nfds == 2) && (pfd[1].revents & POLLIN))
+	{
+		// consume the event so the descriptor can be reused
+		if (read(Session->CancelFd, &Count, sizeof(Count)) < 0)
+			Count = 0;
+		return REX_KEY_CANCEL;
+	}
+	return 1;
 }
 
+/******************************************************************************
+* Function Name : Unix_fill
+* Parameters    : [in] TimeoutMs - time to wait for input, -1 waits until
+*                                  the session deadline (forever if unset)
+* Description   : Reads whatever input is available into the session ring
+*                 buffer with a single read(), waiting up to TimeoutMs for it.
+*                 Line terminators found in the new bytes are queued.
+* Return Value  : number of bytes read, 0 on timeout, -1 on EOF/error or
+*                 one of REX_KEY_TIMEOUT/REX_KEY_IDLE/REX_KEY_CANCEL
+******************************************************************************/
+
+static int Unix_fill(int TimeoutMs)
+{
+	unsigned int Pos = Session->InTail & (CONSOLE_INBUF_SIZE - 1);
+	unsigned int Room = CONSOLE_INBUF_SIZE - (Session->InTail - Session->InHead);
+	int len, i;
+
+	// no room left, the caller has to consume first
+	if (Room == 0)
+		return 0;
+
+	// only read up to the physical end of the ring in one go
+	if (Room > CONSOLE_INBUF_SIZE - Pos)
+		Room = CONSOLE_INBUF_SIZE - Pos;
+
+	// show the echo before waiting for the next key
+	if (TimeoutMs != 0)
+		ConsoleFlush();
+
+	if ((TimeoutMs >= 0) || Session->HasDeadline ||
+		Session->IdleTimeoutMs || (Session->CancelFd >= 0))
+	{
+		len = Unix_wait(TimeoutMs);
+		if (len != 1)
+			return len;
+	}
+
+	do {
+		len = read(Session->InFd, &Session->InBuf[Pos], Room);
+	} while (len < 0 && errno == EINTR);
+	if (len <= 0)
+		return -1;
+
+	if (Session->IdleTimeoutMs)
+		clock_gettime(CLOCK_MONOTONIC, &Session->LastInput);
+	REX_TRACE2(input, len, Session->InTail - Session->InHead);
+
+	for (i = 0; i < len; i++)
+	{
+		if ((Session->InBuf[Pos + i] == REX_KEY_RETURN) ||
+			(Session->InBuf[Pos + i] == REX_KEY_NEWLINE))
+		{
+			// a full line queue just means ConsoleLinesPending under reports
+			if ((Session->LineTail - Session->LineHead) < CONSOLE_MAX_LINES)
+			{
+				Session->LineEnd[Session->LineTail++ & (CONSOLE_MAX_LINES - 1)] =
+					Session->InTail + i;
+			}
+		}
+	}
+	Session->InTail += len;
+	return len;
+}
 
 /******************************************************************************
-* Function Name : ConsoleClear
+* Function Name : Unix_getch
 * Parameters    : NULL
-* Description   : Clears the console
-* Return Value  : NULL
+* Description   : Returns the next buffered input byte, reading more input
+*                 only when the ring buffer is empty
+* Return Value  : the byte read, REX_KEY_EOF on end of input or one of
+*                 REX_KEY_TIMEOUT/REX_KEY_IDLE/REX_KEY_CANCEL
 ******************************************************************************/
-void ConsoleClear(void)
+
+static int Unix_getch(void)
 {
-	/* Clear Screen */
-	ConsolePutChar(REX_KEY_ESCAPE);
-	ConsolePutChar('[');
-	ConsolePutChar('2');
-	ConsolePutChar('J');
+	unsigned int Pos;
+	int rc;
+
+	while (Session->InHead == Session->InTail)
+	{
+		if (Session->Expired)
+			return Session->Expired;
+		if (Session->NonBlocking)
+		{
+			rc = Unix_fill(0);
+			if (rc == 0)
+			{
+				Session->Again = 1;
+				return REX_KEY_AGAIN;
+			}
+		}
+		else
+		{
+			rc = Unix_fill(-1);
+		}
+		if (rc < 0)
+			return REX_KEY_EOF;
+		// a status key rather than a byte count, which can reach 0x1000
+		if (rc > CONSOLE_INBUF_SIZE)
+		{
+			// keep reporting it until the GetCmdLineTimed call ends
+			Session->Expired = rc;
+			return rc;
+		}
+	}
 
-	/* Position Cursor to top left */
-	ConsolePutChar(REX_KEY_ESCAPE);
-	ConsolePutChar('[');
-	ConsolePutChar('H');
+	Pos = Session->InHead++;
+	// drop the line from the queue once its terminator is consumed
+	if ((Session->LineHead != Session->LineTail) &&
+		(Session->LineEnd[Session->LineHead & (CONSOLE_MAX_LINES - 1)] == Pos))
+	{
+		Session->LineHead++;
+	}
+	return Session->InBuf[Pos & (CONSOLE_INBUF_SIZE - 1)];
 }
 
 /******************************************************************************
-* Function Name : ConsoleIsKeyAvail
+* Function Name : Unix_kbhit
+* Parameters    : [in] TimeoutMs - time to wait for a key, 0 does not wait
+* Description   : Checks whether an input byte is buffered or arrives
+*                 within the given time
+* Return Value  : 1 if a byte is available, 0 otherwise
+******************************************************************************/
+static int Unix_kbhit(int TimeoutMs)
+{
+	if (Session->InHead != Session->InTail) {
+		return 1;
+	}
+	return (Unix_fill(TimeoutMs) > 0) && (Session->InHead != Session->InTail);
+}
+
+/******************************************************************************
+* Function Name : ConsoleLinesPending
 * Parameters    : NULL
-* Description   : Checks whether the key stroke is available
-* Return Value  : NULL
+* Description   : Gives the number of complete input lines that are already
+*                 buffered and will be served without waiting for input
+* Return Value  : number of buffered lines
 ******************************************************************************/
 
-unsigned char ConsoleIsKeyAvail(void)
+unsigned int ConsoleLinesPending(void)
 {
-	return Unix_kbhit();
+	return Session->LineTail - Session->LineHead;
 }
 
 /******************************************************************************
-* Function Name : Termios_ConsoleGetChar
-* Parameters    : NULL
-* Description   : Gets the character from the console
+* Function Name : ConsolePutChar
+* Parameters    : [in] ch - character to be put on the console
+* Description   : Puts the given character in the console
 * Return Value  : NULL
 ******************************************************************************/
-static unsigned short Termios_ConsoleGetChar(void)
-{
-	int ch;
-	int EscSeq;
 
-	/* If Raw console, return it */
-	if (RawConsole)
+void ConsolePutChar(unsigned short ch)
+{
+	if (Opened && !isascii(ch))
 	{
-		return (unsigned short)Unix_getch();
+		return;
+	}
+	if (Session->OutLen == CONSOLE_OUTBUF_SIZE)
+	{
+		ConsoleMakeRoom();
 	}
+	Session->OutBuf[Session->OutLen++] = (char)ch;
+}
 
-	/* Non Raw Mode, Process Escape Sequence Keys */
-	ch = Unix_getch();
+/******************************************************************************
+* Function Name : ConsoleWrite
+* Parameters    : [in] Buf - bytes to be written
+*                 [in] Len - number of bytes
+*                 [in] Wait - 1 to wait for the output to take them all
+* Description   : Writes to the output descriptor of the current session
+* Return Value  : number of bytes done with; less than Len only when the
+*                 output would block and Wait is 0. Bytes for an output
+*                 that is gone count as done.
+******************************************************************************/
 
-	/* If normal Key return */
-	if (ch != REX_KEY_ESCAPE)
+static unsigned int ConsoleWrite(const char *Buf, unsigned int Len, int Wait)
+{
+	struct pollfd pfd;
+	unsigned int Done = 0;
+	int len;
+
+	while (Done < Len)
 	{
-		/* Convert Carriage Return to NewLine */
-		if (ch == REX_KEY_RETURN)
+		len = write(Session->OutFd, &Buf[Done], Len - Done);
+		if (len > 0)
 		{
-			ch = REX_KEY_NEWLINE;
+			Done += len;
+		}
+		else if ((len < 0) && (errno == EAGAIN) && Wait)
+		{
+			pfd.fd = Session->OutFd;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, -1);
+		}
+		else if ((len < 0) && (errno == EAGAIN))
+		{
+			break;
+		}
+		else if ((len < 0) && (errno == EINTR))
+		{
+			continue;
+		}
+		else
+		{
+			return Len;	// output gone, drop the echo
 		}
-		return ch;
 	}
+	return Done;
+}
 
-	/* Escape sequence should come immediatly */
-	if (!Unix_kbhit())
-	{
-		return ch;
-	}
+/******************************************************************************
+* Function Name : ConsoleSpill
+* Parameters    : [in] Buf - echo the terminal cannot take yet
+*                 [in] Len - number of bytes
+* Description   : Queues echo behind what is spilled already, growing the
+*                 spill area as needed
+* Return Value  : 0 on success, -1 if out of memory
+******************************************************************************/
 
-	/* For Escape Sequence this should be '[' */
-	/* If not we return the orginal character and ignore the new char */
-	EscSeq = Unix_getch();
+static int ConsoleSpill(const char *Buf, unsigned int Len)
+{
+	unsigned int Size = Session->SpillSize ? Session->SpillSize : CONSOLE_OUTBUF_SIZE;
+	char *New;
 
-	/* Note: Some Terminals send some Keys as ESC O Sequence
-                instead of ESC [ . So added a extra check */
-	if ((EscSeq != REX_KEY_ESC_SEQ) && (EscSeq != 'O'))
+	while (Size - Session->SpillLen < Len)
+		Size *= 2;
+	if (Size != Session->SpillSize)
 	{
-		return ch;
+		New = realloc(Session->Spill, Size);
+		if (New == NULL)
+			return -1;
+		Session->Spill = New;
+		Session->SpillSize = Size;
 	}
+	memcpy(&Session->Spill[Session->SpillLen], Buf, Len);
+	Session->SpillLen += Len;
+	return 0;
+}
 
-	EscSeq = Unix_getch();
+/******************************************************************************
+* Function Name : ConsoleFlush
+* Parameters    : NULL
+* Description   : Writes out the echo collected for the current session. A
+*                 session created without an output descriptor (-1) drops
+*                 it, e.g. to run the editor headless. While driven by
+*                 CmdLinePoll it writes only what the terminal takes without
+*                 waiting and keeps the rest, see ConsoleOutputPending.
+* Return Value  : NULL
+******************************************************************************/
 
-	/* Some Terminals send an extra ~ for some special keys
- 	   Remove them here so that it will not be send to console */
+void ConsoleFlush(void)
+{
+	int Wait = !Session->NonBlocking;
+	unsigned int Done = 0;
+
+#ifdef REX_SELF_CHECK
+	ShadowFeed(&Session->Shadow, &Session->OutBuf[Session->ShadowFed],
+			   Session->OutLen - Session->ShadowFed);
+	Session->ShadowFed = Session->OutLen;
+#endif
+	REX_TRACE2(flush, Session->OutLen, Session->OutFd);
+	if (Session->OutFd < 0)
+	{
+		Session->SpillLen = 0;
+		Session->OutLen = 0;
+#ifdef REX_SELF_CHECK
+		Session->ShadowFed = 0;
+#endif
+		return;
+	}
+	if (Session->OutFd == STDOUT_FILENO)
+	{
+		// keep the order with whatever the caller printed through stdio
+		fflush(stdout);
+	}
+	if (Session->SpillLen)
+	{
+		Done = ConsoleWrite(Session->Spill, Session->SpillLen, Wait);
+		Session->SpillLen -= Done;
+		memmove(Session->Spill, &Session->Spill[Done], Session->SpillLen);
+		Done = 0;
+	}
+	// OutBuf goes out behind the spilled echo
+	if (Session->SpillLen == 0)
+	{
+		Done = ConsoleWrite(Session->OutBuf, Session->OutLen, Wait);
+	}
+	REX_TRACE2(flush_done, Session->OutLen, Done);
+	Session->OutLen -= Done;
+	memmove(Session->OutBuf, &Session->OutBuf[Done], Session->OutLen);
+#ifdef REX_SELF_CHECK
+	Session->ShadowFed = Session->OutLen;
+#endif
+}
+
+/******************************************************************************
+* Function Name : ConsoleMakeRoom
+* Parameters    : NULL
+* Description   : Makes room in the full output buffer. If the terminal
+*                 takes nothing and the session must not wait for it, the
+*                 buffer moves to the spill area; only when that cannot
+*                 grow does the session wait after all.
+* Return Value  : NULL
+******************************************************************************/
+
+static void ConsoleMakeRoom(void)
+{
+	ConsoleFlush();
+	if (Session->OutLen < CONSOLE_OUTBUF_SIZE)
+		return;
+	if (ConsoleSpill(Session->OutBuf, Session->OutLen) < 0)
+	{
+		ConsoleWrite(Session->Spill, Session->SpillLen, 1);
+		Session->SpillLen = 0;
+		ConsoleWrite(Session->OutBuf, Session->OutLen, 1);
+	}
+	Session->OutLen = 0;
+#ifdef REX_SELF_CHECK
+	Session->ShadowFed = 0;
+#endif
+}
+
+/******************************************************************************
+* Function Name : ConsoleOutputPending
+* Parameters    : NULL
+* Description   : Tells how much echo of the current session the terminal
+*                 has not taken yet. After CmdLinePoll returned, the caller
+*                 should wait for the output to be writable and call
+*                 ConsoleDrain while this is not 0.
+* Return Value  : number of bytes
+******************************************************************************/
+
+unsigned int ConsoleOutputPending(void)
+{
+	return Session->SpillLen + Session->OutLen;
+}
+
+/******************************************************************************
+* Function Name : ConsoleDrain
+* Parameters    : NULL
+* Description   : Writes out as much of the pending echo of the current
+*                 session as the terminal takes without waiting
+* Return Value  : REX_KEY_AGAIN while echo is left, 0 once it is all out
+******************************************************************************/
+
+unsigned short ConsoleDrain(void)
+{
+	int NonBlocking = Session->NonBlocking;
+
+	Session->NonBlocking = 1;
+	ConsoleFlush();
+	Session->NonBlocking = NonBlocking;
+	return ConsoleOutputPending() ? REX_KEY_AGAIN : 0;
+}
+
+/******************************************************************************
+* Function Name : EscTimeLeft
+* Parameters    : NULL
+* Description   : Gives the time a lone ESC is still kept back in case it
+*                 starts an escape sequence split across reads. The first
+*                 call starts that wait.
+* Return Value  : milliseconds left, 0 once the ESC is to be taken alone
+******************************************************************************/
+
+static int EscTimeLeft(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	if (!Session->EscWait)
+	{
+		Session->EscWait = 1;
+		Session->EscDeadline = Now;
+		Session->EscDeadline.tv_nsec += ESC_SEQ_TIMEOUT_MS * 1000000L;
+		if (Session->EscDeadline.tv_nsec >= 1000000000L)
+		{
+			Session->EscDeadline.tv_sec++;
+			Session->EscDeadline.tv_nsec -= 1000000000L;
+		}
+	}
+	return MsUntil(&Now, &Session->EscDeadline);
+}
+
+/******************************************************************************
+* Function Name : ConsolePollTimeout
+* Parameters    : NULL
+* Description   : Tells how long the caller of CmdLinePoll may wait for
+*                 input of the current session before calling it again
+* Return Value  : milliseconds until a lone ESC has to be taken, or -1 if
+*                 CmdLinePoll only needs to be called once input arrives
+******************************************************************************/
+
+int ConsolePollTimeout(void)
+{
+	if (!Session->EscWait)
+		return -1;
+	return EscTimeLeft();
+}
+
+/******************************************************************************
+* Function Name : ConsolePutBuf
+* Parameters    : [in] Buf - bytes to be put on the console
+*                 [in] Len - number of bytes
+* Description   : Puts a block of output on the console. A block too large
+*                 for the output buffer (a page of candidates) goes out with
+*                 what is buffered in a single writev() instead of being
+*                 copied through the buffer piece by piece.
+* Return Value  : NULL
+******************************************************************************/
+
+static void ConsolePutBuf(const char *Buf, unsigned int Len)
+{
+	struct iovec iov[2];
+	struct pollfd pfd;
+	unsigned int OutLen;
+	ssize_t Done = 0;
+
+	if ((Len >= CONSOLE_OUTBUF_SIZE) && (Session->SpillLen == 0) &&
+		(Session->OutFd >= 0))
+	{
+#ifdef REX_SELF_CHECK
+		ShadowFeed(&Session->Shadow, &Session->OutBuf[Session->ShadowFed],
+				   Session->OutLen - Session->ShadowFed);
+#endif
+		REX_TRACE2(flush, Session->OutLen + Len, Session->OutFd);
+		if (Session->OutFd == STDOUT_FILENO)
+			fflush(stdout);
+		iov[0].iov_base = Session->OutBuf;
+		iov[0].iov_len = Session->OutLen;
+		iov[1].iov_base = (void *)Buf;
+		iov[1].iov_len = Len;
+		while (1)
+		{
+			Done = writev(Session->OutFd, iov, 2);
+			if ((Done < 0) && (errno == EAGAIN) && !Session->NonBlocking)
+			{
+				pfd.fd = Session->OutFd;
+				pfd.events = POLLOUT;
+				poll(&pfd, 1, -1);
+			}
+			else if (!((Done < 0) && (errno == EINTR)))
+			{
+				break;
+			}
+		}
+		if ((Done < 0) && (errno != EAGAIN))
+			Done = Session->OutLen + Len;	// output gone, drop the echo
+		else if (Done < 0)
+			Done = 0;
+		REX_TRACE2(flush_done, Session->OutLen + Len, Done);
+
+		// what the terminal did not take goes the usual way
+		if ((size_t)Done < Session->OutLen)
+		{
+			Session->OutLen -= Done;
+			memmove(Session->OutBuf, &Session->OutBuf[Done], Session->OutLen);
+			Done = 0;
+		}
+		else
+		{
+			Done -= Session->OutLen;
+			Session->OutLen = 0;
+		}
+#ifdef REX_SELF_CHECK
+		Session->ShadowFed = Session->OutLen;
+		ShadowFeed(&Session->Shadow, Buf, Done);
+#endif
+		Buf += Done;
+		Len -= Done;
+	}
+
+	while (Len)
+	{
+		if (Session->OutLen == CONSOLE_OUTBUF_SIZE)
+		{
+			ConsoleMakeRoom();
+		}
+		OutLen = CONSOLE_OUTBUF_SIZE - Session->OutLen;
+		if (OutLen > Len)
+			OutLen = Len;
+		memcpy(&Session->OutBuf[Session->OutLen], Buf, OutLen);
+		Session->OutLen += OutLen;
+		Buf += OutLen;
+		Len -= OutLen;
+	}
+}
+
+/******************************************************************************
+* Function Name : ConsoleBell
+* Parameters    : NULL
+* Description   : Puts a bell on the console
+* Return Value  : NULL
+******************************************************************************/
+void ConsoleBell(void)
+{
+	ConsolePutChar(REX_KEY_BELL);
+}
+
+/******************************************************************************
+* Function Name : CloseConsole
+* Parameters    : NULL
+* Description   : Closes a opened console
+* Return Value  : NULL
+******************************************************************************/
+void CloseConsole(void)
+{
+	Opened = 0;
+	tcsetattr( STDIN_FILENO, TCSANOW, &orgt );
+}
+
+/******************************************************************************
+* Function Name : OpenConsole
+* Parameters    : [in] rawmode - mode in which the console is to be opened
+* Description   : Opens a console for the client(user) in the specific mode
+* Return Value  : NULL
+******************************************************************************/
+
+void OpenConsole(int rawmode)
+{
+	struct termios newt;
+
+	if (Opened == 1)
+	{
+		CloseConsole();
+	}
+	Opened = 1;
+	RawConsole=rawmode;
+
+	tcgetattr( STDIN_FILENO, &orgt);
+	newt = orgt;
+	newt.c_lflag &= ~( ICANON | ECHO );
+	tcsetattr( STDIN_FILENO, TCSANOW, &newt );
+}
+
+
+/******************************************************************************
+* Function Name : ConsoleClear
+* Parameters    : NULL
+* Description   : Clears the console
+* Return Value  : NULL
+******************************************************************************/
+void ConsoleClear(void)
+{
+	/* Clear Screen and position Cursor to top left */
+	TermPut(TC_CLEAR);
+	ConsoleFlush();
+}
+
+/******************************************************************************
+* Function Name : ConsoleIsKeyAvail
+* Parameters    : NULL
+* Description   : Checks whether the key stroke is available
+* Return Value  : NULL
+******************************************************************************/
+
+unsigned char ConsoleIsKeyAvail(void)
+{
+	return Unix_kbhit(0);
+}
+
+/******************************************************************************
+* Function Name : Termios_ConsoleGetChar
+* Parameters    : NULL
+* Description   : Gets the character from the console
+* Return Value  : NULL
+******************************************************************************/
+static unsigned short Termios_ConsoleGetChar(void)
+{
+	int ch;
+	int EscSeq;
+	int rc;
+
+	/* If Raw console, return it */
+	if (RawConsole)
+	{
+		return (unsigned short)Unix_getch();
+	}
+
+	/* Non Raw Mode, Process Escape Sequence Keys */
+	ch = Unix_getch();
+
+	/* If normal Key return */
+	if (ch != REX_KEY_ESCAPE)
+	{
+		/* Convert Carriage Return to NewLine */
+		if (ch == REX_KEY_RETURN)
+		{
+			ch = REX_KEY_NEWLINE;
+		}
+		return ch;
+	}
+
+	/* Escape sequence should come immediatly */
+	if (Session->NonBlocking)
+	{
+		// CmdLinePoll never waits, the ESC stays buffered until the rest
+		// of the sequence arrives or its time runs out, see ConsolePollTimeout.
+		// At the end of input nothing more can arrive.
+		rc = (Session->InHead == Session->InTail) ? Unix_fill(0) : 1;
+		if (Session->InHead != Session->InTail)
+		{
+			Session->EscWait = 0;
+		}
+		else if ((rc == 0) && (EscTimeLeft() != 0))
+		{
+			Session->Again = 1;
+			return REX_KEY_AGAIN;
+		}
+		else
+		{
+			Session->EscWait = 0;
+			return ch;
+		}
+	}
+	else
+	{
+		Session->EscWait = 0;
+		if (!Unix_kbhit(ESC_SEQ_TIMEOUT_MS))
+		{
+			return ch;
+		}
+	}
+
+	/* For Escape Sequence this should be '[' */
+	EscSeq = Unix_getch();
+	if (EscSeq & 0xFF00)
+	{
+		return EscSeq;
+	}
+
+	/* Note: Some Terminals send some Keys as ESC O Sequence
+                instead of ESC [ . So added a extra check */
+	/* Any other key after ESC was typed with Meta (Alt) held,
+	   a second ESC is taken as the first one repeated */
+	if ((EscSeq != REX_KEY_ESC_SEQ) && (EscSeq != 'O'))
+	{
+		if (EscSeq == REX_KEY_ESCAPE)
+		{
+			return ch;
+		}
+		return REX_KEY_META(EscSeq);
+	}
+
+	EscSeq = Unix_getch();
+	if (EscSeq & 0xFF00)
+	{
+		return EscSeq;
+	}
+
+	/* Some Terminals send an extra ~ for some special keys
+ 	   Remove them here so that it will not be send to console */
 
 	switch (EscSeq)
 	{
@@ -288,7 +1228,7 @@ static unsigned short Termios_ConsoleGetChar(void)
 			return REX_KEY_F4;
 
 		default:	/* Unknown Key */
-			fprintf(stdout,"Unknown Esc Seq Code %d\n", ch);
+			REX_TRACE2(unknown_seq, ch, EscSeq);
 			return 0;
 	}
 	return 0;
@@ -304,7 +1244,20 @@ static unsigned short Termios_ConsoleGetChar(void)
 ******************************************************************************/
 unsigned short ConsoleGetChar(void)
 {
-	return Termios_ConsoleGetChar();
+	unsigned int Head = Session->InHead, LineHead = Session->LineHead;
+	unsigned short ch;
+
+	ch = Termios_ConsoleGetChar();
+	if (Session->Again)
+	{
+		// the key is not complete yet, leave its bytes for the next call
+		Session->Again = 0;
+		Session->InHead = Head;
+		Session->LineHead = LineHead;
+		return REX_KEY_AGAIN;
+	}
+	REX_TRACE2(key, ch, Session->InHead - Head);
+	return ch;
 }
 
 
@@ -316,7 +1269,7 @@ unsigned short ConsoleGetChar(void)
 ******************************************************************************/
 unsigned short ConsoleCheckKey(void)
 {
-	if (!Unix_kbhit())
+	if (!Unix_kbhit(0))
 	{
 		return 0;
 	}
@@ -334,71 +1287,144 @@ unsigned short ConsoleCheckKey(void)
 */
 
 /******************************************************************************
-* Function Name : ForwardCursor
-* Parameters    : [in] column - number of columns
-* Description   : Moves the cursor position forward to the specified
-*                 no. of columns.
-*                 Note: if the cursor is already at right end of a line,
-*                       it won't move further
-* Return Value  : NULL
+* Function Name : SessionCaps
+* Parameters    : NULL
+* Description   : Gives the terminal capability table of the current
+*                 session, resolving $TERM the first time
+* Return Value  : the table
 ******************************************************************************/
-// Ansi Code : "ESC[nC" where n is number of position to move
 
-inline static void ForwardCursor(int column)
+static const TermCaps *SessionCaps(void)
 {
-	char tmp[26] ={0};
-	int i = 0;
-	sprintf(tmp,"%d",column);
-	ConsolePutChar(REX_KEY_ESCAPE);
-	ConsolePutChar('[');
-	while( tmp[i] != '\0')
+	int Known;
+
+	if (Session->Caps == NULL)
 	{
-		ConsolePutChar(tmp[i++]);
+		Session->Caps = TermCapsLoad(getenv("TERM"), &Known);
 	}
-	ConsolePutChar('C');
+	return Session->Caps;
 }
 
 /******************************************************************************
-* Function Name : BackwardCursor
-* Parameters    : [in] column - number of columns
-* Description   : Moves the cursor position backward to the specified
-*                 no. of columns.
-*                 Note: if the cursor is already at left end of a line,
-*                       it won't move further
+* Function Name : TermPut
+* Parameters    : [in] Cap - TC_ sequence
+* Description   : Puts a pre-encoded sequence on the console
 * Return Value  : NULL
 ******************************************************************************/
-// Ansi Code : "ESC[nD" where n is number of position to move
 
-inline static void BackwardCursor(int column)
+static void TermPut(int Cap)
 {
-	char tmp[26] ={0};
-	int i = 0;
-	sprintf(tmp,"%d",column);
-	ConsolePutChar(REX_KEY_ESCAPE);
-	ConsolePutChar('[');
-	while( tmp[i] != '\0')
-	{
-		ConsolePutChar(tmp[i++]);
-	}
-	ConsolePutChar('D');
+	const TermCaps *Caps = SessionCaps();
+
+	ConsolePutBuf(Caps->Str[Cap], Caps->Len[Cap]);
 }
 
 /******************************************************************************
-* Function Name : MoveCursorOneLineUp
-* Parameters    : NULL
-* Description   : Moves up the cursor position to one line up
-*                 Note: if the cursor is already at first line,
-*                       it won't move further
-* Return Value  : NULL
+* Function Name : TermMoveCost
+* Parameters    : [in] Single - TC_ sequence moving one step
+*                 [in] Parm - TP_ sequence moving Count steps
+*                 [in] Count - steps
+* Description   : Gives the bytes needed for Count steps, whichever way
+* Return Value  : the cost, UINT_MAX if the terminal cannot do it
 ******************************************************************************/
-// Ansi Code : "ESC[nA" where n is number of lines to move
 
-inline static void MoveCursorOneLineUp()
+static unsigned int TermMoveCost(int Single, int Parm, int Count)
 {
-	ConsolePutChar(REX_KEY_ESCAPE);
-	ConsolePutChar('[');
-	ConsolePutChar('1');
-	ConsolePutChar('A');
+	const TermCaps *Caps = SessionCaps();
+	unsigned int Cost = TermParmCost(Caps, Parm, Count);
+
+	if (Caps->Len[Single] && ((unsigned int)Count * Caps->Len[Single] < Cost))
+	{
+		Cost = Count * Caps->Len[Single];
+	}
+	return Cost;
+}
+
+/******************************************************************************
+* Function Name : TermMove
+* Parameters    : [in] Single - TC_ sequence moving one step
+*                 [in] Parm - TP_ sequence moving Count steps
+*                 [in] Count - steps
+* Description   : Moves the cursor Count steps, repeating the single step
+*                 sequence if that is no longer than the counted one
+* Return Value  : NULL
+******************************************************************************/
+
+static void TermMove(int Single, int Parm, int Count)
+{
+	const TermCaps *Caps = SessionCaps();
+	char Seq[2 * TERM_SEQ_MAX + 3];
+	unsigned int Cost;
+	int Step;
+
+	while (Count > 0)
+	{
+		Step = Count < TERM_MAX_PARM ? Count : TERM_MAX_PARM - 1;
+		Cost = TermParmCost(Caps, Parm, Step);
+		if (Caps->Len[Single] && ((unsigned int)Step * Caps->Len[Single] <= Cost))
+		{
+			for (Count -= Step; Step; Step--)
+			{
+				ConsolePutBuf(Caps->Str[Single], Caps->Len[Single]);
+			}
+		}
+		else if (Cost != UINT_MAX)
+		{
+			ConsolePutBuf(Seq, TermParmEncode(Caps, Parm, Step, Seq));
+			Count -= Step;
+		}
+		else
+		{
+			break;	// the terminal cannot move this way
+		}
+	}
+}
+
+/******************************************************************************
+* Function Name : ForwardCursor
+* Parameters    : [in] column - number of columns
+* Description   : Moves the cursor position forward to the specified
+*                 no. of columns.
+*                 Note: if the cursor is already at right end of a line,
+*                       it won't move further
+* Return Value  : NULL
+******************************************************************************/
+// Ansi Code : "ESC[nC" where n is number of position to move
+
+inline static void ForwardCursor(int column)
+{
+	TermMove(TC_RIGHT, TP_RIGHT, column);
+}
+
+/******************************************************************************
+* Function Name : BackwardCursor
+* Parameters    : [in] column - number of columns
+* Description   : Moves the cursor position backward to the specified
+*                 no. of columns.
+*                 Note: if the cursor is already at left end of a line,
+*                       it won't move further
+* Return Value  : NULL
+******************************************************************************/
+// Ansi Code : "ESC[nD" where n is number of position to move
+
+inline static void BackwardCursor(int column)
+{
+	TermMove(TC_LEFT, TP_LEFT, column);
+}
+
+/******************************************************************************
+* Function Name : MoveCursorOneLineUp
+* Parameters    : NULL
+* Description   : Moves up the cursor position to one line up
+*                 Note: if the cursor is already at first line,
+*                       it won't move further
+* Return Value  : NULL
+******************************************************************************/
+// Ansi Code : "ESC[nA" where n is number of lines to move
+
+inline static void MoveCursorOneLineUp()
+{
+	TermMove(TC_UP, TP_UP, 1);
 }
 
 /******************************************************************************
@@ -413,10 +1439,144 @@ inline static void MoveCursorOneLineUp()
 
 inline static void MoveCursorOneLineDown()
 {
-	ConsolePutChar(REX_KEY_ESCAPE);
-	ConsolePutChar('[');
-	ConsolePutChar('1');
-	ConsolePutChar('B');
+	TermMove(TC_DOWN, TP_DOWN, 1);
+}
+
+/******************************************************************************
+* Function Name : CursorToColumnCost
+* Parameters    : [in] From - column the cursor is in
+*                 [in] To - column to go to
+* Description   : Gives the bytes CursorToColumn needs
+* Return Value  : the cost, UINT_MAX if the terminal cannot do it
+******************************************************************************/
+
+static unsigned int CursorToColumnCost(int From, int To)
+{
+	const TermCaps *Caps = SessionCaps();
+	unsigned int Cost, Cr;
+
+	if (From == To)
+		return 0;
+	Cost = (From > To) ? TermMoveCost(TC_LEFT, TP_LEFT, From - To)
+					   : TermMoveCost(TC_RIGHT, TP_RIGHT, To - From);
+	Cr = To ? TermMoveCost(TC_RIGHT, TP_RIGHT, To) : 0;
+	if ((Cr != UINT_MAX) && (Caps->Len[TC_CR] + Cr < Cost))
+		Cost = Caps->Len[TC_CR] + Cr;
+	if (TermParmCost(Caps, TP_COLUMN, To) < Cost)
+		Cost = TermParmCost(Caps, TP_COLUMN, To);
+	return Cost;
+}
+
+/******************************************************************************
+* Function Name : CursorToColumn
+* Parameters    : [in] From - column the cursor is in
+*                 [in] To - column to go to
+* Description   : Moves the cursor within its row by the cheapest of a
+*                 relative move, a carriage return plus a move right and an
+*                 absolute column
+* Return Value  : NULL
+******************************************************************************/
+
+static void CursorToColumn(int From, int To)
+{
+	const TermCaps *Caps = SessionCaps();
+	unsigned int Cost = CursorToColumnCost(From, To);
+	char Seq[2 * TERM_SEQ_MAX + 3];
+
+	if (From == To)
+	{
+		return;
+	}
+	if (TermParmCost(Caps, TP_COLUMN, To) == Cost)
+	{
+		ConsolePutBuf(Seq, TermParmEncode(Caps, TP_COLUMN, To, Seq));
+	}
+	else if ((From > To) && (TermMoveCost(TC_LEFT, TP_LEFT, From - To) == Cost))
+	{
+		TermMove(TC_LEFT, TP_LEFT, From - To);
+	}
+	else if ((From < To) && (TermMoveCost(TC_RIGHT, TP_RIGHT, To - From) == Cost))
+	{
+		TermMove(TC_RIGHT, TP_RIGHT, To - From);
+	}
+	else
+	{
+		TermPut(TC_CR);
+		TermMove(TC_RIGHT, TP_RIGHT, To);
+	}
+}
+
+/******************************************************************************
+* Function Name : CursorMoveCost
+* Parameters    : [in] From - screen offset the cursor is at
+*                 [in] To - screen offset to go to
+* Description   : Gives the bytes CursorMoveTo needs
+* Return Value  : the cost, UINT_MAX if the terminal cannot do it
+******************************************************************************/
+
+static unsigned int CursorMoveCost(int From, int To)
+{
+	int Rows = To / g_ColumnLen - From / g_ColumnLen;
+	unsigned int Cost = 0, Col;
+
+	if (Rows < 0)
+		Cost = TermMoveCost(TC_UP, TP_UP, -Rows);
+	else if (Rows > 0)
+		Cost = TermMoveCost(TC_DOWN, TP_DOWN, Rows);
+	Col = CursorToColumnCost(From % g_ColumnLen, To % g_ColumnLen);
+	if ((Cost == UINT_MAX) || (Col == UINT_MAX))
+		return UINT_MAX;
+	return Cost + Col;
+}
+
+/******************************************************************************
+* Function Name : CursorMoveTo
+* Parameters    : [in] From - screen offset the cursor is at
+*                 [in] To - screen offset to go to
+* Description   : Moves the cursor between two offsets of the command line,
+*                 counted from the start of its first row, in one go
+* Return Value  : NULL
+******************************************************************************/
+
+static void CursorMoveTo(int From, int To)
+{
+	int Rows = To / g_ColumnLen - From / g_ColumnLen;
+
+	if (Rows < 0)
+	{
+		TermMove(TC_UP, TP_UP, -Rows);
+	}
+	else if (Rows > 0)
+	{
+		TermMove(TC_DOWN, TP_DOWN, Rows);
+	}
+	CursorToColumn(From % g_ColumnLen, To % g_ColumnLen);
+}
+
+/******************************************************************************
+* Function Name : CursorReturn
+* Parameters    : [in] End - screen offset just past the text printed
+*                 [in] To - screen offset to go back to
+* Description   : Moves the cursor back after printing part of the command
+*                 line. Text ending at the right end of a row leaves the
+*                 cursor in the last column rather than on the next row.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CursorReturn(int End, int To)
+{
+	if ((End > To) && ((End % g_ColumnLen) == 0))
+	{
+		End--;
+		if (End == To)
+		{
+			// still pending, the next char printed would wrap
+			BackwardCursor(1);
+			ForwardCursor(1);
+			return;
+		}
+	}
+	CursorMoveTo(End, To);
 }
 
 /******************************************************************************
@@ -430,9 +1590,248 @@ inline static void MoveCursorOneLineDown()
 
 inline static void DelCharFromCursorToEndOfLine()
 {
-	ConsolePutChar(REX_KEY_ESCAPE);
-	ConsolePutChar('[');
-	ConsolePutChar('K');
+	TermPut(TC_CLR_EOL);
+}
+
+/******************************************************************************
+* Function Name : DelCharFromCursorToEndOfScreen
+* Parameters    : NULL
+* Description   : Deletes the character from current cursor position
+*                 to end of the screen, i.e. also the rows below
+* Return Value  : NULL
+******************************************************************************/
+// Ansi Code : "ESC[J"
+
+inline static void DelCharFromCursorToEndOfScreen()
+{
+	TermPut(TC_CLR_EOS);
+}
+
+/******************************************************************************
+* Function Name : InsDelChar
+* Parameters    : [in] Cap - TC_ICH to insert a blank, TC_DCH to delete a char
+* Description   : Inserts a blank at the cursor (ICH) or deletes the char
+*                 under it (DCH). Only the cursor row shifts, the chars
+*                 pushed past its right end are lost.
+* Return Value  : NULL
+******************************************************************************/
+// Ansi Code : "ESC[@" / "ESC[P"
+
+inline static void InsDelChar(int Cap)
+{
+	if (SessionCaps()->Len[Cap])
+	{
+		TermPut(Cap);
+	}
+	else
+	{
+		// REX_SLOWLINK_ON for a terminal type the table does not know
+		ConsolePutBuf((Cap == TC_ICH) ? "\033[@" : "\033[P", 3);
+	}
+}
+
+// Pen of a history suggestion, besides the HL_ styles
+#define PEN_SUGGEST	HL_COUNT
+
+/*
+ SGR sequences of the pens. Only the foreground color changes, so a blank
+ looks the same whatever the pen and needs no sequence of its own.
+*/
+static const char *const PenSgr[HL_COUNT + 1] = {
+	[HL_PLAIN] = "\033[39m",
+	[HL_COMMAND] = "\033[32m",
+	[HL_ARGUMENT] = "\033[36m",
+	[HL_OPTION] = "\033[33m",
+	[HL_STRING] = "\033[35m",
+	[HL_OPERATOR] = "\033[34m",
+	[HL_ERROR] = "\033[31m",
+	[PEN_SUGGEST] = "\033[90m",
+};
+
+/******************************************************************************
+* Function Name : PenSet
+* Parameters    : [in] Style - HL_ style or PEN_SUGGEST to draw in
+* Description   : Switches the terminal to a style if it is not drawing in
+*                 it already. HL_PLAIN is set back before anything but the
+*                 line is put out.
+* Return Value  : NULL
+******************************************************************************/
+
+static void PenSet(unsigned char Style)
+{
+	if (Session->Pen != Style)
+	{
+		ConsolePutBuf(PenSgr[Style], strlen(PenSgr[Style]));
+		Session->Pen = Style;
+	}
+}
+
+/******************************************************************************
+* Function Name : EchoAt
+* Parameters    : [in] CmdLine - command line being edited
+*                 [in] Index - index of a char in it, or of its end
+* Description   : Puts a command line char on the console the way it is
+*                 displayed, i.e. masked while reading a password and in
+*                 its style while highlighting
+* Return Value  : NULL
+******************************************************************************/
+
+static void EchoAt(const char *CmdLine, unsigned short Index)
+{
+	CmdLineState *L = &Session->Line;
+	char ch = CmdLine[Index];
+
+	if (ch && L->isPassword)
+	{
+		ch = '*';
+	}
+	else if (L->Highlight && (Index < L->Hl.Len))
+	{
+		if (ch != ' ')
+			PenSet(L->Hl.Style[Index]);
+		L->Painted[Index] = L->Hl.Style[Index];
+	}
+	ConsolePutChar(ch);
+}
+
+/******************************************************************************
+* Function Name : CmdLineHighlight
+* Parameters    : [in] L - line being edited
+*                 [in] Pos - index where the line buffer was changed
+*                 [in] Removed - chars taken out at Pos
+*                 [in] Added - chars put in at Pos instead
+* Description   : Brings the styles up to date after a change of the line
+*                 buffer, before the change is put on the screen. What was
+*                 painted moves along with the chars, as reprinting and
+*                 ICH/DCH both move the cells; the chars whose style may
+*                 have changed are added to the damage of the key stroke.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineHighlight(CmdLineState *L, unsigned short Pos,
+							 unsigned short Removed, unsigned short Added)
+{
+	unsigned short From, To;
+
+	if (!L->Highlight)
+		return;
+
+	memmove(&L->Painted[Pos + Added], &L->Painted[Pos + Removed],
+			L->Hl.Len - Pos - Removed);
+	memset(&L->Painted[Pos], HL_UNPAINTED, Added);
+
+	// damage from earlier changes of the same key stroke moves as well
+	if (L->DamageTo > Pos + Removed)
+		L->DamageTo = L->DamageTo - Removed + Added;
+	else if (L->DamageTo > Pos)
+		L->DamageTo = Pos + Added;
+	if (L->DamageFrom > Pos + Removed)
+		L->DamageFrom = L->DamageFrom - Removed + Added;
+	else if (L->DamageFrom > Pos)
+		L->DamageFrom = Pos;
+
+	From = HighlightEdit(&L->Hl, L->CmdLine, Pos, Removed, Added,
+						 Session->CommandCheck, &To);
+	if (L->DamageFrom >= L->DamageTo)
+	{
+		L->DamageFrom = From;
+		L->DamageTo = To;
+	}
+	else
+	{
+		if (From < L->DamageFrom)
+			L->DamageFrom = From;
+		if (To > L->DamageTo)
+			L->DamageTo = To;
+	}
+}
+
+/******************************************************************************
+* Function Name : SlowLinkReturn
+* Parameters    : [in] Up - rows to go up
+*                 [in] From - column the cursor is in
+*                 [in] To - column to go to
+* Description   : Brings the cursor back to the edit position after a slow
+*                 link edit left it on a lower row
+* Return Value  : NULL
+******************************************************************************/
+
+static void SlowLinkReturn(int Up, int From, int To)
+{
+	TermMove(TC_UP, TP_UP, Up);
+	CursorToColumn(From, To);
+}
+
+/******************************************************************************
+* Function Name : SlowLinkDelChar
+* Parameters    : [in] CmdLine - command line, the char already taken out
+*                 [in] Pos - screen offset of the deleted char (the cursor)
+*                 [in] End - screen offset just past the shortened line
+* Description   : Deletes the char under the cursor with DCH instead of
+*                 reprinting the rest of the line. On a wrapped line each
+*                 following row gets a DCH as well and the char it loses is
+*                 put at the end of the row above, so an edit costs a few
+*                 bytes per row whatever the line length.
+* Return Value  : NULL
+******************************************************************************/
+
+static void SlowLinkDelChar(const char *CmdLine, int Pos, int End)
+{
+	int Col = Pos % g_ColumnLen, Down = 0;
+	int Edge;
+
+	InsDelChar(TC_DCH);
+	for (Edge = (Pos / g_ColumnLen + 1) * g_ColumnLen; Edge <= End;
+		 Edge += g_ColumnLen)
+	{
+		// the char now at Edge - 1 belongs in the last column of this row
+		CursorToColumn(Col, g_ColumnLen - 1);
+		EchoAt(CmdLine, Edge - 1 - PROMPT_WIDTH);
+		ConsolePutChar(REX_KEY_RETURN);
+		ConsolePutChar(REX_KEY_NEWLINE);
+		InsDelChar(TC_DCH);
+		Col = 0;
+		Down++;
+	}
+	if (Down)
+	{
+		SlowLinkReturn(Down, 0, Pos % g_ColumnLen);
+	}
+}
+
+/******************************************************************************
+* Function Name : SlowLinkInsChar
+* Parameters    : [in] CmdLine - command line, the char already put in
+*                 [in] Pos - screen offset of the new char (the cursor)
+*                 [in] Last - screen offset of the last char of the line
+* Description   : Inserts the char at the cursor with ICH instead of
+*                 reprinting the rest of the line. On a wrapped line the
+*                 char pushed off each row is inserted at the start of the
+*                 next one, which may be a new row.
+* Return Value  : NULL
+******************************************************************************/
+
+static void SlowLinkInsChar(const char *CmdLine, int Pos, int Last)
+{
+	int Row = Pos / g_ColumnLen, Down = 0;
+	int Edge;
+
+	InsDelChar(TC_ICH);
+	EchoAt(CmdLine, Pos - PROMPT_WIDTH);
+	for (Edge = (Row + 1) * g_ColumnLen; Edge <= Last; Edge += g_ColumnLen)
+	{
+		// a new line feed scrolls when the line grows past the screen
+		ConsolePutChar(REX_KEY_RETURN);
+		ConsolePutChar(REX_KEY_NEWLINE);
+		InsDelChar(TC_ICH);
+		EchoAt(CmdLine, Edge - PROMPT_WIDTH);
+		Down++;
+	}
+	if (Down)
+	{
+		SlowLinkReturn(Row + Down - (Pos + 1) / g_ColumnLen, 1,
+					   (Pos + 1) % g_ColumnLen);
+	}
 }
 
 /******************************************************************************
@@ -472,43 +1871,30 @@ static void EraseDelChar(char *CmdLine,
 	{
 		EraseChar();
 		CmdLine[Index-1] = 0;
+		CmdLineHighlight(&Session->Line, Index - 1, 1, 0);
+	}
+	else if (Session->SlowLink)
+	{
+		memmove(&CmdLine[delIndex], &CmdLine[delIndex+1], Index - delIndex);
+		CmdLineHighlight(&Session->Line, delIndex, 1, 0);
+		SlowLinkDelChar(CmdLine, curIndex + PROMPT_WIDTH,
+						Index - 1 + PROMPT_WIDTH);
 	}
 	else if (delIndex < Index)
 	{
+		memmove(&CmdLine[delIndex], &CmdLine[delIndex+1], Index - delIndex);
+		CmdLineHighlight(&Session->Line, delIndex, 1, 0);
 		while (delIndex < Index)
 		{
-			CmdLine[delIndex] = CmdLine[delIndex+1];
-			ConsolePutChar(CmdLine[delIndex]);
+			EchoAt(CmdLine, delIndex);
 			delIndex++;
 		}
 		// erases the last char by giving 'space'
 		ConsolePutChar(REX_KEY_SPACE);
-		delIndex=Index-curIndex;
-
-		// go back to cursor position by giving 'backspace'
-		if (delIndex != 0)
-		{
-			ConsolePutChar(REX_KEY_BACKSPACE);
-			delIndex--;
-		}
 
-		while (delIndex)
-		{
-			// when the cursor is at extreme left position of a line
-			// (excluding the first line), then normal backspace won't
-			// move the cursor to end of previous line.
-			// So,do a line up & move the cursor to end of line.
-			if (((curIndex + PROMPT_STR_LEN + delIndex) % g_ColumnLen) == 0)
-			{
-				MoveCursorOneLineUp();
-				ForwardCursor(g_ColumnLen-1);
-			}
-			else
-			{
-				ConsolePutChar(REX_KEY_BACKSPACE);
-			}
-			delIndex--;
-		}
+		// go back to cursor position
+		delIndex = curIndex + PROMPT_WIDTH;
+		CursorReturn(delIndex + Index - curIndex, delIndex);
 	}
 }
 
@@ -527,7 +1913,7 @@ static void EraseCmdLine(unsigned short Index)
 	// make those adjustments and delete
 	while (Index--)
 	{
-		if (((Index + PROMPT_STR_LEN + 1) % g_ColumnLen) == 0)
+		if (((Index + PROMPT_WIDTH + 1) % g_ColumnLen) == 0)
 		{
 			MoveCursorOneLineUp();
 			ForwardCursor(g_ColumnLen);
@@ -545,7 +1931,6 @@ static void EraseCmdLine(unsigned short Index)
 * Parameters    : [in] cmdline - holds the command line
 *                 [in] Index - holds the index to insert
 *                 [in] curIndex - holds the current index
-*                 [in] StartIndex - holds the starting index of the cmdline
 *                 [in] delIndex - holds the original index position
 * Description   : Puts the remaining command string in order to insert a
 *                 letter in between the commands and moves back the cursor
@@ -557,45 +1942,37 @@ static void EraseCmdLine(unsigned short Index)
 void PutCmdLine(char *CmdLine,
 				unsigned short Index,
 				unsigned short curIndex,
-				unsigned short StartIndex,
 				unsigned short delIndex)
 {
 	int tmpCurIndex = curIndex ;
 
-	curIndex += StartIndex;
+	if (Session->SlowLink && (delIndex != 0))
+	{
+		SlowLinkInsChar(CmdLine, curIndex + PROMPT_WIDTH, Index + PROMPT_WIDTH);
+		return;
+	}
 
 	//puts the remaining letters
 	while(curIndex<=Index)
 	{
-		ConsolePutChar(CmdLine[curIndex]);
+		EchoAt(CmdLine, curIndex);
 		curIndex++;
 	}
 
-	if (delIndex != 0)
+	// a line ending at the right end of a row leaves the cursor there
+	// instead of at the start of the next row, see the typing case
+	if ((delIndex == 0) && (tmpCurIndex < Index) &&
+		(((Index + PROMPT_WIDTH) % g_ColumnLen) == 0))
 	{
-		ConsolePutChar(REX_KEY_BACKSPACE);
-		delIndex--;
+		ConsolePutChar(REX_KEY_SPACE);
+		BackwardCursor(1);
 	}
 
-	// brings the cursor to its position
-	// when bringing up the cursor check for cursor adjustments and make
-	// changes accordingly
-	while (delIndex)
+	// brings the cursor back to its position, just after the new char
+	if (delIndex != 0)
 	{
-		// when the cursor is at left end of the a line
-		// (excluding the first line), then normal backspace
-		// won't move the cursor to end of previous line.
-		// So,do a line up & move the cursor to end of line.
-		if (((tmpCurIndex + PROMPT_STR_LEN + delIndex+1) % g_ColumnLen) == 0)
-		{
-			MoveCursorOneLineUp();
-			ForwardCursor(g_ColumnLen-1);
-		}
-		else
-		{
-			ConsolePutChar(REX_KEY_BACKSPACE);
-		}
-		delIndex--;
+		CursorReturn(Index + 1 + PROMPT_WIDTH,
+					 tmpCurIndex + 1 + PROMPT_WIDTH);
 	}
 }
 
@@ -611,6 +1988,7 @@ void ConsolePutStr(char *Str)
 	{
 		ConsolePutChar(*Str++);
 	}
+	ConsoleFlush();
 }
 
 
@@ -625,10 +2003,14 @@ void GetWindowSize(void)
 {
 	struct winsize ws;
 	g_ColumnLen = 80;//default TERM column Length
+	g_RowLen = 24;
 	memset(&ws, 0, sizeof(struct winsize));
 	//Set Column Length if ioctl success and ws.ws_col is positive and non-zero.
-	if(!ioctl(1, TIOCGWINSZ, &ws) && ws.ws_col)
+	if(!ioctl(Session->OutFd, TIOCGWINSZ, &ws) && ws.ws_col)
 		g_ColumnLen = ws.ws_col;
+	if (ws.ws_row)
+		g_RowLen = ws.ws_row;
+	REX_TRACE2(resize, g_ColumnLen, g_RowLen);
 }
 
 /******************************************************************************
@@ -641,355 +2023,3288 @@ void GetWindowSize(void)
 
 void HandleWindowResize(int signal)
 {
+	(void)signal;
 	GetWindowSize();
 }
 
 /******************************************************************************
-* Function Name : GetCmdLine
-* Parameters    : [in] CmdLine - holds the command line
-*                 [in] Index - holds the current index
-*                 [in] isPassword - flag representing the password
-* Description   : Gets the entire command line string given by the user.
-*                 Main module that gets the entire command and also adjusts
-*                 the cursor according to key actions
+* Function Name : ConsoleCreateCancelFd
+* Parameters    : NULL
+* Description   : Creates an eventfd that can be passed to GetCmdLineTimed
+*                 and signalled from any thread with ConsoleCancel
+* Return Value  : the descriptor, -1 on failure
+******************************************************************************/
+
+int ConsoleCreateCancelFd(void)
+{
+	return eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+/******************************************************************************
+* Function Name : ConsoleCancel
+* Parameters    : [in] CancelFd - descriptor from ConsoleCreateCancelFd
+* Description   : Wakes up a GetCmdLineTimed call waiting on CancelFd and
+*                 makes it return REX_KEY_CANCEL. Safe to call from any thread.
 * Return Value  : NULL
 ******************************************************************************/
 
-unsigned short GetCmdLine(char *CmdLine, unsigned short Index, int isPassword)
+void ConsoleCancel(int CancelFd)
 {
-	unsigned short ch = 0;
-	unsigned short StartIndex = 0,curIndex = Index;
+	uint64_t One = 1;
 
-	// read the console char input from the user until
-	// the user types "enter" button to exit
-	while(1)
+	if (write(CancelFd, &One, sizeof(One)) < 0)
+	{
+		// counter overflow only, the call is already pending
+	}
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetTerminal
+* Parameters    : [in] Name - terminal type, NULL for $TERM
+* Description   : Sets the terminal type of the current session, e.g. the
+*                 one a telnet or ssh client announced. Its sequences are
+*                 looked up once per process and shared by every session
+*                 of the same type.
+* Return Value  : 1 if the type is known, 0 if vt100 sequences are used
+******************************************************************************/
+
+int ConsoleSetTerminal(const char *Name)
+{
+	int Known;
+
+	Session->Caps = TermCapsLoad(Name ? Name : getenv("TERM"), &Known);
+	return Known;
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetSlowLink
+* Parameters    : [in] Mode - REX_SLOWLINK_OFF, REX_SLOWLINK_AUTO or
+*                             REX_SLOWLINK_ON
+* Description   : Makes mid-line inserts and deletes on the current session
+*                 use the terminal's insert/delete character sequences, for
+*                 serial consoles and other slow links. AUTO only does so
+*                 if the session's terminal type has them; ON uses the ANSI
+*                 ones when the type does not say.
+* Return Value  : 1 if the mode is in use, 0 if plain reprinting is
+******************************************************************************/
+
+int ConsoleSetSlowLink(int Mode)
+{
+	const TermCaps *Caps = SessionCaps();
+
+	Session->SlowLink = (Mode == REX_SLOWLINK_ON) ||
+						((Mode == REX_SLOWLINK_AUTO) &&
+						 Caps->Len[TC_ICH] && Caps->Len[TC_DCH]);
+	return Session->SlowLink;
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetHighlight
+* Parameters    : [in] Mode - REX_HIGHLIGHT_OFF or REX_HIGHLIGHT_ON
+*                 [in] Check - tells known commands from unknown ones, NULL
+*                              to take every command word as known
+* Description   : Colors the lines read on the current session as they are
+*                 typed: commands, arguments, options, quoted strings and
+*                 operators, with unknown commands and unmatched quotes as
+*                 errors. Takes effect from the next line; password lines
+*                 are never colored.
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleSetHighlight(int Mode, ConsoleCommandCheck Check)
+{
+	Session->Highlight = Mode;
+	Session->CommandCheck = Check;
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetSuggest
+* Parameters    : [in] Mode - REX_SUGGEST_OFF or REX_SUGGEST_ON
+* Description   : Shows the rest of the newest history entry starting with
+*                 the line typed so far after the cursor, dimmed, on the
+*                 lines read on the current session. Right or End at the end
+*                 of the line takes it in. Takes effect from the next line;
+*                 password lines never get suggestions.
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleSetSuggest(int Mode)
+{
+	Session->Suggest = Mode;
+}
+
+/******************************************************************************
+* Function Name : FinishCmdLine
+* Parameters    : [in] Index - holds the length of the command line
+*                 [in] curIndex - holds the current cursor index
+* Description   : Moves the cursor below the command line once input ends
+* Return Value  : NULL
+******************************************************************************/
+
+static void FinishCmdLine(unsigned short Index, unsigned short curIndex)
+{
+	int temp1 = 0 , temp2 = 0 , temp3 = 0 ;
+
+	ConsolePutChar(REX_KEY_NEWLINE);
+	// Put newlines depending upon the no. of lines the
+	// characters are entered in.
+	// Note: The current cursor position may be at
+	// start/end/middle of ANY line.
+	temp1 = (Index + PROMPT_WIDTH) / g_ColumnLen ;
+	temp2 = (curIndex + PROMPT_WIDTH) / g_ColumnLen;
+	temp3 = temp1 - temp2;
+	while (temp3-- > 0)
+	{
+		ConsolePutChar(REX_KEY_NEWLINE);
+	}
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetCompleter
+* Parameters    : [in] Fn - completion callback, NULL to disable completion
+* Description   : Sets the function the current session calls on Tab
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleSetCompleter(ConsoleCompleter Fn)
+{
+	Session->Completer = Fn;
+}
+
+/******************************************************************************
+* Function Name : ConsoleAddCompletion
+* Parameters    : [in] Out - completion list passed to the completer
+*                 [in] Str - candidate for the word being completed
+* Description   : Adds a copy of Str to the candidates. The copy lives in the
+*                 session arena and needs no freeing.
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleAddCompletion(ConsoleCompletions *Out, const char *Str)
+{
+	ConsoleCandidate *Grown;
+	size_t Len = strlen(Str);
+	char *Copy;
+
+	if (Len > LINE_LEN)
+		return;
+
+	if (Out->Count == Out->Size)
+	{
+		// the old array stays in the arena until it is reset
+		Grown = ArenaAlloc(Out->Scratch,
+						   (Out->Size ? Out->Size * 2 : 64) * sizeof(*Grown));
+		if (Grown == NULL)
+			return;
+		if (Out->Count)
+			memcpy(Grown, Out->Cand, Out->Count * sizeof(*Grown));
+		Out->Cand = Grown;
+		Out->Size = Out->Size ? Out->Size * 2 : 64;
+	}
+
+	Copy = ArenaAlloc(Out->Scratch, Len + 1);
+	if (Copy == NULL)
+		return;
+	memcpy(Copy, Str, Len + 1);
+	Out->Cand[Out->Count].Str = Copy;
+	Out->Cand[Out->Count].Len = (unsigned short)Len;
+	Out->Count++;
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetCompletionStart
+* Parameters    : [in] Out - completion list passed to the completer
+*                 [in] Start - index in the line where the candidates start
+* Description   : Overrides the start of the completed word, which defaults
+*                 to the character after the last space before the cursor
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleSetCompletionStart(ConsoleCompletions *Out, unsigned short Start)
+{
+	Out->Start = Start;
+}
+
+/******************************************************************************
+* Function Name : CmdLineCursorBack
+* Parameters    : [in] Pos - cursor position in the line
+*                 [in] Count - number of positions to move back
+* Description   : Moves the cursor back, up the wrapped rows as needed
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineCursorBack(unsigned short Pos, unsigned short Count)
+{
+	CursorMoveTo(Pos + PROMPT_WIDTH, Pos - Count + PROMPT_WIDTH);
+}
+
+/******************************************************************************
+* Function Name : CmdLineShow
+* Parameters    : [in] Text - text to show
+*                 [in] Len - length of the text
+*                 [in] isPassword - show '*' instead of the text
+* Description   : Prints Text from the start of the line, where the
+*                 cursor has to be, and clears whatever was shown after it
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineShow(const char *Text, unsigned short Len, int isPassword)
+{
+	unsigned short i;
+
+	PenSet(HL_PLAIN);
+	for (i = 0; i < Len; i++)
+	{
+		ConsolePutChar(isPassword ? '*' : Text[i]);
+	}
+	// make the cursor move on to the next row, as a typed char would
+	if (Len && (((Len + PROMPT_WIDTH) % g_ColumnLen) == 0))
+	{
+		ConsolePutChar(REX_KEY_SPACE);
+		BackwardCursor(1);
+	}
+	DelCharFromCursorToEndOfScreen();
+}
+
+/******************************************************************************
+* Function Name : CmdLineRepaint
+* Parameters    : [in] L - line being edited, the cursor still where
+*                          curIndex says
+*                 [in] From - first position of the line that changed
+*                 [in] To - position to leave the cursor at
+* Description   : Shows the line again from From on, after the
+*                 buffer was changed there
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineRepaint(CmdLineState *L, unsigned short From, unsigned short To)
+{
+	unsigned short Len = L->Index;
+	unsigned short i;
+
+	CursorMoveTo(L->curIndex + PROMPT_WIDTH, From + PROMPT_WIDTH);
+	for (i = From; i < Len; i++)
+	{
+		EchoAt(L->CmdLine, i);
+	}
+	// clearing from a pending wrap would take the last char with it
+	if ((Len > From) && (((Len + PROMPT_WIDTH) % g_ColumnLen) == 0))
+	{
+		ConsolePutChar(REX_KEY_SPACE);
+		BackwardCursor(1);
+	}
+	DelCharFromCursorToEndOfScreen();
+	L->SuggestAt = L->SuggestEnd = L->Index;
+	L->SuggestStale = 0;
+	CursorMoveTo(Len + PROMPT_WIDTH, To + PROMPT_WIDTH);
+	L->curIndex = To;
+}
+
+/******************************************************************************
+* Function Name : CmdLineHighlightFlush
+* Parameters    : [in] L - line being edited
+* Description   : Paints the chars a key stroke restyled without putting
+*                 them out again, e.g. the start of a word that became a
+*                 known command. Only the damaged part of the line is looked
+*                 at and only the chars whose style changed are put out.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineHighlightFlush(CmdLineState *L)
+{
+	unsigned short i = L->DamageFrom, End = L->DamageTo, Cursor = L->curIndex;
+	unsigned char Wrap = 0;
+
+	// a line that is not on the screen is painted whole when it comes back
+	if ((i >= End) || L->More.List.Count || L->Search.Active)
+		return;
+	L->DamageFrom = L->DamageTo = 0;
+
+	if (End > L->Index)
+		End = L->Index;
+	while (i < End)
+	{
+		if (L->Painted[i] == L->Hl.Style[i])
+		{
+			i++;
+			continue;
+		}
+		CursorMoveTo(Cursor + PROMPT_WIDTH, i + PROMPT_WIDTH);
+		while ((i < End) && (L->Painted[i] != L->Hl.Style[i]))
+		{
+			EchoAt(L->CmdLine, i++);
+		}
+		// writing the last column of a row leaves the cursor on it
+		Cursor = i;
+		Wrap = (((Cursor + PROMPT_WIDTH) % g_ColumnLen) == 0);
+		if (Wrap)
+			Cursor--;
+	}
+	// staying there would leave it waiting to wrap, a carriage return ends that
+	if (Wrap && (Cursor == L->curIndex))
+	{
+		TermPut(TC_CR);
+		CursorToColumn(0, g_ColumnLen - 1);
+	}
+	else
+	{
+		CursorMoveTo(Cursor + PROMPT_WIDTH, L->curIndex + PROMPT_WIDTH);
+	}
+}
+
+/******************************************************************************
+* Function Name : PromptMeasure
+* Parameters    : [in] Text - prompt as put out
+*                 [in] Len - its length
+* Description   : Counts the columns the last row of a prompt takes. Escape
+*                 sequences (colors, window titles), other control chars and
+*                 UTF-8 continuation bytes take none; a newline or carriage
+*                 return starts the count again.
+* Return Value  : the width
+******************************************************************************/
+
+static unsigned short PromptMeasure(const char *Text, unsigned short Len)
+{
+	unsigned short i = 0, Width = 0;
+	unsigned char ch;
+
+	while (i < Len)
+	{
+		ch = (unsigned char)Text[i++];
+		if ((ch == REX_KEY_NEWLINE) || (ch == REX_KEY_RETURN))
+		{
+			Width = 0;
+		}
+		else if ((ch == REX_KEY_ESCAPE) && (i < Len) && (Text[i] == '['))
+		{
+			// CSI: parameters up to a final byte
+			for (i++; (i < Len) && ((Text[i] < 0x40) || (Text[i] > 0x7E)); i++)
+				;
+			i++;
+		}
+		else if ((ch == REX_KEY_ESCAPE) && (i < Len) && (Text[i] == ']'))
+		{
+			// OSC: up to BEL or ESC backslash
+			for (i++; (i < Len) && (Text[i] != REX_KEY_BELL) && (Text[i] != REX_KEY_ESCAPE); i++)
+				;
+			i += ((i < Len) && (Text[i] == REX_KEY_ESCAPE)) ? 2 : 1;
+		}
+		else if (ch == REX_KEY_ESCAPE)
+		{
+			i++;
+		}
+		else if ((ch >= ' ') && (ch != REX_KEY_ASCII_DEL) && ((ch & 0xC0) != 0x80))
+		{
+			Width++;
+		}
+	}
+	return Width;
+}
+
+/******************************************************************************
+* Function Name : PromptSet
+* Parameters    : [in] Prompt - NUL terminated prompt, NULL for none
+* Description   : Makes Prompt the prompt of the current session, measuring
+*                 it unless it is the one it had already. A prompt longer
+*                 than PROMPT_MAX_SIZE - 1 bytes is cut short.
+* Return Value  : NULL
+******************************************************************************/
+
+static void PromptSet(const char *Prompt)
+{
+	CmdLinePrompt *P = &Session->Prompt;
+	size_t Len;
+
+	if (Prompt == NULL)
+		Prompt = "";
+	Len = strnlen(Prompt, PROMPT_MAX_SIZE - 1);
+	if ((Len == P->Len) && !memcmp(P->Text, Prompt, Len))
+		return;
+	memcpy(P->Text, Prompt, Len);
+	P->Len = (unsigned short)Len;
+	P->Width = PromptMeasure(P->Text, P->Len);
+}
+
+/******************************************************************************
+* Function Name : PromptShow
+* Parameters    : [in] L - line being edited
+* Description   : Puts out the prompt of the line, at column 0.
+*                 Continuation lines have none.
+* Return Value  : NULL
+******************************************************************************/
+
+static void PromptShow(CmdLineState *L)
+{
+	CmdLinePrompt *P = &Session->Prompt;
+
+	if (L->BlockLine || (P->Len == 0))
+		return;
+	PenSet(HL_PLAIN);
+	ConsolePutBuf(P->Text, P->Len);
+	// make the cursor move on to the next row, as a typed char would
+	if (P->Width && ((P->Width % g_ColumnLen) == 0))
+	{
+		ConsolePutChar(REX_KEY_SPACE);
+		BackwardCursor(1);
+	}
+}
+
+/******************************************************************************
+* Function Name : CmdLineRedraw
+* Parameters    : [in] L - line being edited
+* Description   : Prints the prompt and the current line again from the
+*                 cursor's column 0, e.g. after a candidate list, and puts
+*                 the cursor back
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineRedraw(CmdLineState *L)
+{
+	unsigned short Cursor = L->curIndex;
+
+	// whatever is above it now is not the block
+	L->BlockReach = 0;
+	PromptShow(L);
+	L->curIndex = 0;
+	CmdLineRepaint(L, 0, Cursor);
+}
+
+/******************************************************************************
+* Function Name : UndoClear
+* Parameters    : [in] U - undo log
+* Description   : Forgets every change, e.g. when a new line is started
+* Return Value  : NULL
+******************************************************************************/
+
+static void UndoClear(CmdLineUndo *U)
+{
+	U->Head = U->Cur = U->Tail = 0;
+	U->TextHead = U->TextTail = 0;
+}
+
+/******************************************************************************
+* Function Name : UndoCopy
+* Parameters    : [in] U - undo log
+*                 [in] Off - running offset in the text ring
+*                 [in] Buf - text to store, or room for the text to fetch
+*                 [in] Len - length of the text
+*                 [in] Store - 1 to copy Buf into the ring, 0 to copy out
+* Description   : Copies text in or out of the text ring, in two parts
+*                 where it wraps
+* Return Value  : NULL
+******************************************************************************/
+
+static void UndoCopy(CmdLineUndo *U, unsigned int Off, char *Buf,
+					 unsigned int Len, int Store)
+{
+	unsigned int At = Off % UNDO_LOG_TEXT;
+	unsigned int First = (Len < UNDO_LOG_TEXT - At) ? Len : UNDO_LOG_TEXT - At;
+
+	if (Store)
+	{
+		memcpy(&U->Text[At], Buf, First);
+		memcpy(U->Text, Buf + First, Len - First);
+	}
+	else
+	{
+		memcpy(Buf, &U->Text[At], First);
+		memcpy(Buf + First, U->Text, Len - First);
+	}
+}
+
+/******************************************************************************
+* Function Name : UndoDrop
+* Parameters    : [in] U - undo log
+* Description   : Makes room by forgetting the oldest change, with every
+*                 record of the key stroke that made it
+* Return Value  : NULL
+******************************************************************************/
+
+static void UndoDrop(CmdLineUndo *U)
+{
+	unsigned short Serial = U->Rec[U->Head % UNDO_LOG_RECORDS].Serial;
+
+	while ((U->Head < U->Tail) &&
+		   (U->Rec[U->Head % UNDO_LOG_RECORDS].Serial == Serial))
+	{
+		U->Head++;
+	}
+	U->TextHead = (U->Head < U->Tail) ? U->Rec[U->Head % UNDO_LOG_RECORDS].Text
+									  : U->TextTail;
+	if (U->Cur < U->Head)
+		U->Cur = U->Head;
+}
+
+/******************************************************************************
+* Function Name : UndoLog
+* Parameters    : [in] L - line being edited
+*                 [in] Insert - 1 if Text was inserted, 0 if it is deleted
+*                 [in] Pos - index in the line where it happens
+*                 [in] Text - the chars inserted or about to be deleted
+*                 [in] Len - number of chars
+* Description   : Records a change of the line. Chars typed one after the
+*                 other go into one record, up to the end of a word, as do
+*                 the inserts of a single key stroke.
+* Return Value  : NULL
+******************************************************************************/
+
+static void UndoLog(CmdLineState *L, int Insert, unsigned short Pos,
+					const char *Text, unsigned short Len)
+{
+	CmdLineUndo *U = &L->Undo;
+	UndoRec *R;
+
+	// password lines are not kept anywhere they could be recovered from
+	if (L->isPassword || (Len == 0))
+		return;
+
+	// a new change drops what could have been redone
+	if (U->Tail != U->Cur)
+	{
+		U->Tail = U->Cur;
+		R = &U->Rec[(U->Cur - 1) % UNDO_LOG_RECORDS];
+		U->TextTail = (U->Cur > U->Head) ? R->Text + R->Len : U->TextHead;
+	}
+
+	R = &U->Rec[(U->Tail - 1) % UNDO_LOG_RECORDS];
+	if ((U->Tail > U->Head) && Insert && R->Insert && (R->Pos + R->Len == Pos) &&
+		((R->Serial == U->Serial) ||
+		 (U->Typing && R->Typed &&
+		  !((Text[0] == ' ') && (L->CmdLine[Pos - 1] != ' ')))) &&
+		(U->TextTail + Len - U->TextHead <= UNDO_LOG_TEXT))
+	{
+		UndoCopy(U, U->TextTail, (char *)Text, Len, 1);
+		U->TextTail += Len;
+		R->Len += Len;
+		return;
+	}
+
+	while ((U->Tail - U->Head >= UNDO_LOG_RECORDS) ||
+		   (U->TextTail + Len - U->TextHead > UNDO_LOG_TEXT))
+	{
+		UndoDrop(U);
+	}
+	R = &U->Rec[U->Tail % UNDO_LOG_RECORDS];
+	R->Text = U->TextTail;
+	R->Pos = Pos;
+	R->Len = Len;
+	R->Serial = U->Serial;
+	R->Insert = (unsigned char)Insert;
+	R->Typed = (unsigned char)U->Typing;
+	UndoCopy(U, U->TextTail, (char *)Text, Len, 1);
+	U->TextTail += Len;
+	U->Tail++;
+	U->Cur = U->Tail;
+}
+
+/******************************************************************************
+* Function Name : UndoApply
+* Parameters    : [in] L - line being edited
+*                 [in] R - recorded change
+*                 [in] Insert - 1 to insert the record's text, 0 to delete it
+* Description   : Changes the line buffer as a record says, or the other
+*                 way round; the screen is left to the caller
+* Return Value  : NULL
+******************************************************************************/
+
+static void UndoApply(CmdLineState *L, const UndoRec *R, int Insert)
+{
+	char *At = &L->CmdLine[R->Pos];
+
+	if (Insert)
+	{
+		memmove(At + R->Len, At, L->Index - R->Pos + 1);
+		UndoCopy(&L->Undo, R->Text, At, R->Len, 0);
+		CmdLineHighlight(L, R->Pos, 0, R->Len);
+		L->Index += R->Len;
+	}
+	else
+	{
+		memmove(At, At + R->Len, L->Index - R->Pos - R->Len + 1);
+		CmdLineHighlight(L, R->Pos, R->Len, 0);
+		L->Index -= R->Len;
+	}
+}
+
+/******************************************************************************
+* Function Name : CmdLineReplace
+* Parameters    : [in] L - line being edited
+*                 [in] Text - new contents of the line
+*                 [in] Len - length of the text
+* Description   : Replaces the line being edited with Text and puts the
+*                 cursor at its end
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineReplace(CmdLineState *L, const char *Text, unsigned short Len)
+{
+	unsigned short Old = L->Index;
+
+	if (Len > LINE_LEN)
+		Len = LINE_LEN;
+
+	UndoLog(L, 0, 0, L->CmdLine, Old);
+	memmove(L->CmdLine, Text, Len);
+	L->Index = Len;
+	L->CmdLine[L->Index] = 0;
+	UndoLog(L, 1, 0, L->CmdLine, Len);
+	CmdLineHighlight(L, 0, Old, Len);
+	CmdLineRepaint(L, 0, Len);
+}
+
+/******************************************************************************
+* Function Name : HistoryIndexFind
+* Parameters    : [in] Seq - running count of a kept entry
+* Description   : Binary searches the history index, which keeps the
+*                 running counts of the entries sorted by their text and the
+*                 older one first among equal texts
+* Return Value  : position of the entry, or where it goes in
+******************************************************************************/
+
+static unsigned int HistoryIndexFind(unsigned int Seq)
+{
+	const char *Text = Session->History[Seq % HISTORY_SIZE];
+	unsigned int Lo = 0, Hi = Session->HistorySortedCount, Mid, Other;
+	int rc;
+
+	while (Lo < Hi)
+	{
+		Mid = (Lo + Hi) / 2;
+		Other = Session->HistorySorted[Mid];
+		rc = strcmp(Session->History[Other % HISTORY_SIZE], Text);
+		if ((rc < 0) || ((rc == 0) && (Other < Seq)))
+			Lo = Mid + 1;
+		else
+			Hi = Mid;
+	}
+	return Lo;
+}
+
+/******************************************************************************
+* Function Name : HistoryIndexBuild
+* Parameters    : NULL
+* Description   : Builds a max tree over the history index: leaf i holds the
+*                 running count + 1 of the entry at position i, every inner
+*                 node the largest of its two children. The newest entry of
+*                 any range of positions then takes O(log n) steps to find.
+* Return Value  : NULL
+******************************************************************************/
+
+static void HistoryIndexBuild(void)
+{
+	unsigned int *Tree = Session->HistoryNewest;
+	unsigned int n = Session->HistorySortedCount, i;
+
+	for (i = 0; i < n; i++)
+		Tree[n + i] = Session->HistorySorted[i] + 1;
+	for (i = n; i-- > 1;)
+		Tree[i] = (Tree[2 * i] > Tree[2 * i + 1]) ? Tree[2 * i] : Tree[2 * i + 1];
+	Session->HistoryNewestValid = 1;
+}
+
+/******************************************************************************
+* Function Name : HistorySuggest
+* Parameters    : [in] Line - NUL terminated start of a line
+*                 [in] Len - its length
+* Description   : Finds the newest history entry that starts with Line and
+*                 goes on past it. The entries starting with Line sit next
+*                 to each other in the index, so two binary searches and a
+*                 walk up the max tree bound the work per key stroke to
+*                 O(log HISTORY_SIZE) string compares, however long the
+*                 history is.
+* Return Value  : the entry, NULL if there is none
+******************************************************************************/
+
+static const char *HistorySuggest(const char *Line, unsigned short Len)
+{
+	unsigned int *Tree = Session->HistoryNewest;
+	unsigned int n = Session->HistorySortedCount;
+	unsigned int Lo = 0, Hi = n, Mid, First, Newest = 0;
+
+	// entries equal to Line sort right before the longer ones
+	while (Lo < Hi)
+	{
+		Mid = (Lo + Hi) / 2;
+		if (strcmp(Session->History[Session->HistorySorted[Mid] % HISTORY_SIZE], Line) <= 0)
+			Lo = Mid + 1;
+		else
+			Hi = Mid;
+	}
+	First = Lo;
+	Hi = n;
+	while (Lo < Hi)
+	{
+		Mid = (Lo + Hi) / 2;
+		if (!strncmp(Session->History[Session->HistorySorted[Mid] % HISTORY_SIZE], Line, Len))
+			Lo = Mid + 1;
+		else
+			Hi = Mid;
+	}
+	if (First == Lo)
+		return NULL;
+
+	if (!Session->HistoryNewestValid)
+		HistoryIndexBuild();
+	for (First += n, Lo += n; First < Lo; First >>= 1, Lo >>= 1)
+	{
+		if ((First & 1) && (Tree[First++] > Newest))
+			Newest = Tree[First - 1];
+		if ((Lo & 1) && (Tree[--Lo] > Newest))
+			Newest = Tree[Lo];
+	}
+	return Session->History[(Newest - 1) % HISTORY_SIZE];
+}
+
+/******************************************************************************
+* Function Name : HistoryStore
+* Parameters    : [in] Line - command line to remember
+* Description   : Adds a line to the current session's own history ring,
+*                 dropping the oldest entry once HISTORY_SIZE lines are kept
+* Return Value  : NULL
+******************************************************************************/
+
+static void HistoryStore(const char *Line)
+{
+	unsigned int *Sorted = Session->HistorySorted;
+	unsigned int Pos;
+	char **Slot;
+	char *Copy;
+
+	if ((Line[0] == 0) ||
+		((Session->HistoryCount != 0) &&
+		 !strcmp(Line, Session->History[(Session->HistoryCount - 1) % HISTORY_SIZE])))
+	{
+		return;
+	}
+
+	Copy = strdup(Line);
+	if (Copy == NULL)
+		return;
+	Slot = &Session->History[Session->HistoryCount % HISTORY_SIZE];
+	if (Session->HistoryCount >= HISTORY_SIZE)
+	{
+		Pos = HistoryIndexFind(Session->HistoryCount - HISTORY_SIZE);
+		Session->HistorySortedCount--;
+		memmove(&Sorted[Pos], &Sorted[Pos + 1],
+				(Session->HistorySortedCount - Pos) * sizeof(*Sorted));
+	}
+	free(*Slot);
+	*Slot = Copy;
+
+	Pos = HistoryIndexFind(Session->HistoryCount);
+	memmove(&Sorted[Pos + 1], &Sorted[Pos],
+			(Session->HistorySortedCount - Pos) * sizeof(*Sorted));
+	Sorted[Pos] = Session->HistoryCount;
+	Session->HistorySortedCount++;
+	Session->HistoryNewestValid = 0;
+	Session->HistoryCount++;
+}
+
+/******************************************************************************
+* Function Name : HistorySync
+* Parameters    : NULL
+* Description   : Copies the lines other processes added to the shared
+*                 history since the last sync into the session's ring, in
+*                 the order they were added. An entry still being written
+*                 ends the sync so it is picked up next time; if it is still
+*                 busy then, its writer died and it is skipped.
+* Return Value  : NULL
+******************************************************************************/
+
+static void HistorySync(void)
+{
+	char Line[SHM_HISTORY_LINE];
+	uint64_t Ticket, Next;
+	int Len;
+
+	if (Session->Shared == NULL)
+		return;
+
+	Next = ShmHistoryNext(Session->Shared);
+	Ticket = Session->SharedSeen;
+	if (Next - Ticket > SHM_HISTORY_SLOTS)
+		Ticket = Next - SHM_HISTORY_SLOTS;
+	for (; Ticket < Next; Ticket++)
+	{
+		Len = ShmHistoryRead(Session->Shared, Ticket, Line);
+		if ((Len == SHM_HISTORY_BUSY) && (Ticket != Session->SharedStuck))
+		{
+			Session->SharedStuck = Ticket;
+			break;
+		}
+		if (Len >= 0)
+			HistoryStore(Line);
+	}
+	Session->SharedSeen = Ticket;
+}
+
+/******************************************************************************
+* Function Name : ConsoleHistoryShare
+* Parameters    : [in] Name - shared memory object name, e.g. "/rex_history",
+*                             NULL to stop sharing
+* Description   : Shares the current session's history with every process
+*                 and session using the same name. Lines added anywhere show
+*                 up in the others at their next prompt. The latest
+*                 HISTORY_SIZE shared lines are copied in right away.
+* Return Value  : 0 on success, -1 if the segment cannot be mapped
+******************************************************************************/
+
+int ConsoleHistoryShare(const char *Name)
+{
+	ShmHistory *Shared = NULL;
+	uint64_t Next;
+
+	if (Name != NULL)
+	{
+		Shared = ShmHistoryOpen(Name);
+		if (Shared == NULL)
+			return -1;
+	}
+	ShmHistoryClose(Session->Shared);
+	Session->Shared = Shared;
+	Session->SharedStuck = UINT64_MAX;
+	if (Shared == NULL)
+		return 0;
+
+	Next = ShmHistoryNext(Shared);
+	Session->SharedSeen = (Next > HISTORY_SIZE) ? Next - HISTORY_SIZE : 0;
+	HistorySync();
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : ConsoleHistoryAdd
+* Parameters    : [in] Line - command line to remember
+* Description   : Adds a line to the current session's history, dropping the
+*                 oldest entry once HISTORY_SIZE lines are kept. GetCmdLine
+*                 adds every completed non password line itself. A shared
+*                 history gets the line too and hands it back through the
+*                 sync, so every session sees the same order.
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleHistoryAdd(const char *Line)
+{
+	if (Session->Shared == NULL)
+	{
+		HistoryStore(Line);
+		return;
+	}
+
+	HistorySync();
+	if ((Line[0] == 0) ||
+		((Session->HistoryCount != 0) &&
+		 !strcmp(Line, Session->History[(Session->HistoryCount - 1) % HISTORY_SIZE])))
+	{
+		return;
+	}
+	ShmHistoryAppend(Session->Shared, Line);
+	HistorySync();
+}
+
+/******************************************************************************
+* Function Name : HistoryGet
+* Parameters    : [in] Back - 1 for the latest entry, 2 for the one before...
+* Description   : Gives a history entry of the current session
+* Return Value  : the entry, NULL if there is none that far back
+******************************************************************************/
+
+static const char *HistoryGet(unsigned int Back)
+{
+	if ((Back == 0) || (Back > Session->HistoryCount) || (Back > HISTORY_SIZE))
+		return NULL;
+	return Session->History[(Session->HistoryCount - Back) % HISTORY_SIZE];
+}
+
+/******************************************************************************
+* Function Name : CmdLineSuggestShown
+* Parameters    : [in] L - line being edited
+* Description   : Tells whether a history suggestion is shown intact after
+*                 the end of the line, with the cursor right before it
+* Return Value  : 1 if so, 0 otherwise
+******************************************************************************/
+
+static int CmdLineSuggestShown(CmdLineState *L)
+{
+	return (L->SuggestEnd > L->SuggestAt) && !L->SuggestStale &&
+		   (L->SuggestAt == L->Index) && (L->curIndex == L->Index);
+}
+
+/******************************************************************************
+* Function Name : CmdLineSuggest
+* Parameters    : [in] L - line being edited
+* Description   : Shows the rest of the newest history entry starting with
+*                 the line after the cursor, dimmed, once the cursor is at
+*                 the end of the line. Only what differs from the suggestion
+*                 shown already is drawn; the line itself is not printed
+*                 again, and typing the next suggested char costs nothing.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineSuggest(CmdLineState *L)
+{
+	unsigned short From = L->Index, End = L->Index, Old = L->SuggestEnd;
+	unsigned short Pos, i;
+	const char *Entry = NULL;
+
+	// history holds whole commands, not the lines of a block
+	if (!L->Suggest || L->More.List.Count || L->Search.Active ||
+		BlockLines(&L->Block))
+		return;
+
+	if ((L->curIndex == L->Index) && L->Index)
+	{
+		Entry = HistorySuggest(L->CmdLine, L->Index);
+		if (Entry != NULL)
+		{
+			End = (unsigned short)strnlen(Entry, LINE_LEN);
+		}
+	}
+
+	// the line moved under the suggestion shown
+	if ((Old > L->SuggestAt) && (L->SuggestAt != L->Index))
+		L->SuggestStale = 1;
+	if (!L->SuggestStale)
+	{
+		if (Old <= L->SuggestAt)
+			Old = L->Index;
+		while ((From < End) && (From < Old) && (Entry[From] == L->SuggestText[From]))
+			From++;
+		if ((From == End) && (Old == End))
+			return;
+	}
+
+	CursorMoveTo(L->curIndex + PROMPT_WIDTH, From + PROMPT_WIDTH);
+	// cleared first: clearing once the cursor waits past the end of a
+	// full row would take the last char of the row with it
+	if (L->SuggestStale || (Old > End))
+		DelCharFromCursorToEndOfScreen();
+	Pos = From;
+	if (From < End)
+	{
+		memcpy(&L->SuggestText[From], &Entry[From], End - From);
+		PenSet(PEN_SUGGEST);
+		for (i = From; i < End; i++)
+			ConsolePutChar(Entry[i]);
+		Pos = End;
+		// a cursor left waiting past the last column is not where it looks
+		if (((Pos + PROMPT_WIDTH) % g_ColumnLen) == 0)
+		{
+			ConsolePutChar(REX_KEY_SPACE);
+			BackwardCursor(1);
+		}
+		if (!L->Highlight)
+			PenSet(HL_PLAIN);
+	}
+	CursorMoveTo(Pos + PROMPT_WIDTH, L->curIndex + PROMPT_WIDTH);
+
+	L->SuggestAt = L->Index;
+	L->SuggestEnd = End;
+	L->SuggestStale = 0;
+}
+
+/******************************************************************************
+* Function Name : CmdLineSuggestClear
+* Parameters    : [in] L - line being edited
+* Description   : Takes the history suggestion off the screen, before the
+*                 line is left
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineSuggestClear(CmdLineState *L)
+{
+	unsigned short End = L->Index;
+
+	if ((L->SuggestEnd > L->SuggestAt) && !L->More.List.Count && !L->Search.Active)
+	{
+		CursorMoveTo(L->curIndex + PROMPT_WIDTH, End + PROMPT_WIDTH);
+		DelCharFromCursorToEndOfScreen();
+		CursorMoveTo(End + PROMPT_WIDTH, L->curIndex + PROMPT_WIDTH);
+	}
+	L->SuggestAt = L->SuggestEnd = L->Index;
+	L->SuggestStale = 0;
+}
+
+/******************************************************************************
+* Function Name : CmdLineSuggestAccept
+* Parameters    : [in] L - line being edited
+* Description   : Takes the history suggestion shown into the line
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineSuggestAccept(CmdLineState *L)
+{
+	unsigned short At = L->Index, Len = L->SuggestEnd - L->SuggestAt;
+
+	memcpy(&L->CmdLine[At], &L->SuggestText[At], Len);
+	L->Index += Len;
+	L->CmdLine[L->Index] = 0;
+	UndoLog(L, 1, At, &L->CmdLine[At], Len);
+	CmdLineHighlight(L, At, 0, Len);
+	// printed over in the pen of the line
+	CmdLineRepaint(L, At, L->Index);
+}
+
+/******************************************************************************
+* Function Name : CmdLineHistory
+* Parameters    : [in] L - line being edited
+*                 [in] ch - REX_KEY_UP or REX_KEY_DOWN
+* Description   : Replaces the line with an older or newer history entry.
+*                 The line being edited is kept and comes back past the
+*                 newest entry.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineHistory(CmdLineState *L, unsigned short ch)
+{
+	const char *Entry;
+
+	if (ch == REX_KEY_UP)
+	{
+		// only while no entry is shown, syncing shifts the positions
+		if (L->HistPos == 0)
+			HistorySync();
+		Entry = HistoryGet(L->HistPos + 1);
+		if ((Entry == NULL) || L->isPassword)
+		{
+			ConsoleBell();
+			return;
+		}
+		if (L->HistPos == 0)
+		{
+			memcpy(L->Saved, L->CmdLine, L->Index);
+			L->Saved[L->Index] = 0;
+		}
+		L->HistPos++;
+	}
+	else
+	{
+		if (L->HistPos == 0)
+		{
+			ConsoleBell();
+			return;
+		}
+		L->HistPos--;
+		Entry = L->HistPos ? HistoryGet(L->HistPos) : L->Saved;
+	}
+	CmdLineReplace(L, Entry, (unsigned short)strlen(Entry));
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockRows
+* Parameters    : [in] Cells - cells a line left in the block takes, its
+*                          prompt and backslash included
+* Description   : Gives the rows such a line takes
+* Return Value  : the rows
+******************************************************************************/
+
+static unsigned int CmdLineBlockRows(unsigned int Cells)
+{
+	return (Cells + g_ColumnLen - 1) / g_ColumnLen;
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockReach
+* Parameters    : [in] L - line being edited
+* Description   : Gives the rows of the block right above the line being
+*                 edited that are still on the screen for sure. Once the
+*                 cursor reached the bottom the screen scrolled, and the line
+*                 itself may have pushed rows off the top while it was long.
+* Return Value  : the rows
+******************************************************************************/
+
+static unsigned int CmdLineBlockReach(CmdLineState *L)
+{
+	int Rows = g_RowLen - (int)((L->BlockWide + PROMPT_WIDTH) / g_ColumnLen + 1);
+
+	if ((L->BlockCols != g_ColumnLen) || (Rows <= 0))
+		return 0;
+	return (L->BlockReach < Rows) ? L->BlockReach : (unsigned int)Rows;
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockLeave
+* Parameters    : [in] L - line being edited
+*                 [in] Shown - its backslash is on the screen already, as the
+*                              last char of the line
+* Description   : Leaves the line on the screen followed by its backslash
+*                 and puts the cursor at the start of the row below
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineBlockLeave(CmdLineState *L, int Shown)
+{
+	unsigned int End = L->Index + PROMPT_WIDTH;
+	unsigned int Reach = CmdLineBlockReach(L);
+
+	CursorMoveTo(L->curIndex + PROMPT_WIDTH, End);
+	L->curIndex = L->Index;
+	if (!Shown)
+	{
+		PenSet(HL_PLAIN);
+		ConsolePutChar('\\');
+		End++;
+	}
+	// a shown line filling its last row has the cursor on the next one
+	if (!Shown || (End % g_ColumnLen))
+	{
+		ConsolePutChar(REX_KEY_NEWLINE);
+	}
+	Reach += CmdLineBlockRows(End);
+	L->BlockReach = (Reach < (unsigned int)g_RowLen) ? Reach : (unsigned int)g_RowLen - 1;
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockLoad
+* Parameters    : [in] L - line being edited
+*                 [in] Line - line of the block to edit instead
+*                 [in] Text - its text
+*                 [in] Len - its length
+* Description   : Makes another line of the block the one being edited,
+*                 with the cursor at its start, without showing it. Undo
+*                 starts over for it.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineBlockLoad(CmdLineState *L, unsigned int Line,
+							 const char *Text, unsigned short Len)
+{
+	unsigned short Old = L->Index;
+
+	memcpy(L->CmdLine, Text, Len);
+	L->CmdLine[Len] = 0;
+	L->Index = Len;
+	L->curIndex = 0;
+	CmdLineHighlight(L, 0, Old, Len);
+	UndoClear(&L->Undo);
+	L->HistPos = 0;
+	L->SuggestAt = L->SuggestEnd = Len;
+	L->BlockLine = Line;
+	L->BlockWide = Len;
+	L->BlockCols = g_ColumnLen;
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockBreak
+* Parameters    : [in] L - line being edited, ending with a backslash
+* Description   : Continues the command on a new line after the one being
+*                 edited. The backslash stays on the screen but is taken out
+*                 of the line.
+* Return Value  : 0 on success, -1 if out of memory
+******************************************************************************/
+
+static int CmdLineBlockBreak(CmdLineState *L)
+{
+	LineBlock *B = &L->Block;
+	unsigned short Len = L->Index - 1;
+
+	// the first break makes the line so far the first of the block
+	if ((BlockLines(B) == 0) && (BlockInsert(B, 0, L->CmdLine, Len) < 0))
+		return -1;
+	if ((BlockSet(B, L->BlockLine, L->CmdLine, Len) < 0) ||
+		(BlockInsert(B, L->BlockLine + 1, "", 0) < 0))
+		return -1;
+	CmdLineBlockLeave(L, 1);
+	CmdLineBlockLoad(L, L->BlockLine + 1, "", 0);
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockMove
+* Parameters    : [in] L - line being edited
+*                 [in] Down - 1 to go to the line below, 0 to the one above
+* Description   : Edits the line above or below instead, keeping the
+*                 column. The block is only shown down to the line being
+*                 edited: going down leaves the line as it is and shows the
+*                 next one below it, going up takes the line off the screen
+*                 and edits the one above where it is shown, or at the top
+*                 of a cleared screen if it may have scrolled off.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineBlockMove(CmdLineState *L, int Down)
+{
+	unsigned int Line = L->BlockLine + (Down ? 1 : -1), Width, Rows;
+	unsigned short Cursor = L->curIndex, Len;
+	const char *Text;
+
+	if ((Line >= BlockLines(&L->Block)) ||
+		(BlockSet(&L->Block, L->BlockLine, L->CmdLine, L->Index) < 0))
+	{
+		ConsoleBell();
+		return;
+	}
+	CmdLineSuggestClear(L);
+	Text = BlockGet(&L->Block, Line, &Len);
+	if (Cursor > Len)
+		Cursor = Len;
+
+	if (Down)
+	{
+		CmdLineBlockLeave(L, 0);
+	}
+	else
+	{
+		Width = Line ? 0 : Session->Prompt.Width;
+		Rows = CmdLineBlockRows(Width + Len + 1);
+		CursorMoveTo(L->curIndex + PROMPT_WIDTH, PROMPT_WIDTH);
+		DelCharFromCursorToEndOfScreen();
+		if (Rows > CmdLineBlockReach(L))
+		{
+			TermPut(TC_CLEAR);
+			CmdLineBlockLoad(L, Line, Text, Len);
+			L->curIndex = Cursor;
+			CmdLineRedraw(L);
+			return;
+		}
+		L->BlockReach = CmdLineBlockReach(L) - Rows;
+		TermMove(TC_UP, TP_UP, Rows);
+		CursorMoveTo(0, Width);
+	}
+	CmdLineBlockLoad(L, Line, Text, Len);
+	CmdLineRepaint(L, 0, Cursor);
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockShowRest
+* Parameters    : [in] L - line being edited
+* Description   : Once the input ends, keeps the line being edited in the
+*                 block and shows the lines below it, leaving the last one
+*                 as if it had been edited
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineBlockShowRest(CmdLineState *L)
+{
+	unsigned int Lines = BlockLines(&L->Block);
+	unsigned short Len, i;
+	const char *Text;
+
+	if (Lines < 2)
+		return;
+	BlockSet(&L->Block, L->BlockLine, L->CmdLine, L->Index);
+	while (L->BlockLine + 1 < Lines)
+	{
+		CmdLineBlockLeave(L, 0);
+		Text = BlockGet(&L->Block, ++L->BlockLine, &Len);
+		for (i = 0; i < Len; i++)
+		{
+			ConsolePutChar(L->isPassword ? '*' : Text[i]);
+		}
+		if (Len && ((Len % g_ColumnLen) == 0))
+		{
+			ConsolePutChar(REX_KEY_SPACE);
+			BackwardCursor(1);
+		}
+		L->Index = L->curIndex = Len;
+	}
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockPull
+* Parameters    : [in] L - line being edited, the one below it not shown
+* Description   : Takes out the line break after the line being edited,
+*                 moving the line below up to its end. The cursor is left
+*                 where the two meet and undo starts over.
+* Return Value  : 0 on success, -1 if the lines together would not fit
+******************************************************************************/
+
+static int CmdLineBlockPull(CmdLineState *L)
+{
+	unsigned short At = L->Index, Len;
+	const char *Text = BlockGet(&L->Block, L->BlockLine + 1, &Len);
+
+	if ((Text == NULL) || (At + Len > LINE_LEN))
+		return -1;
+	memcpy(&L->CmdLine[At], Text, Len);
+	L->Index = At + Len;
+	L->CmdLine[L->Index] = 0;
+	CmdLineHighlight(L, At, 0, Len);
+	UndoClear(&L->Undo);
+	BlockDelete(&L->Block, L->BlockLine + 1);
+	// a single line left is no block any more
+	if (BlockLines(&L->Block) < 2)
+		BlockClear(&L->Block);
+	CmdLineRepaint(L, At, At);
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : CmdLineBlockJoin
+* Parameters    : [in] L - line being edited
+* Description   : Hands a block back in CmdLine as one line, its lines
+*                 joined without their backslashes as far as it holds them.
+*                 The block itself is kept whole, see ConsoleBlockLength.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineBlockJoin(CmdLineState *L)
+{
+	unsigned int Lines = BlockLines(&L->Block), i;
+	unsigned short Len, Index = 0;
+	const char *Text;
+
+	if (Lines < 2)
+		return;
+	for (i = 0; (i < Lines) && (Index < LINE_LEN); i++)
+	{
+		Text = BlockGet(&L->Block, i, &Len);
+		if (Len > LINE_LEN - Index)
+			Len = LINE_LEN - Index;
+		memcpy(&L->CmdLine[Index], Text, Len);
+		Index += Len;
+	}
+	L->CmdLine[Index] = 0;
+	L->Index = Index;
+}
+
+/******************************************************************************
+* Function Name : CmdLineFuzzyInit
+* Parameters    : [in] F - fuzzy state to set up
+*                 [in] Count - number of candidates
+* Description   : Allocates the candidate arrays of F from the arena. Str and
+*                 Len are filled in by the caller, then FuzzySetPrepare.
+* Return Value  : 0 on success, -1 if out of memory
+******************************************************************************/
+
+static int CmdLineFuzzyInit(CmdLineFuzzy *F, unsigned int Count)
+{
+	Arena *A = &Session->Scratch;
+
+	memset(&F->State, 0, sizeof(F->State));
+	F->Set.Count = Count;
+	F->Set.Str = ArenaAlloc(A, Count * sizeof(*F->Set.Str) + 1);
+	F->Set.Len = ArenaAlloc(A, Count * sizeof(*F->Set.Len) + 1);
+	F->Set.Mask = ArenaAlloc(A, Count * sizeof(*F->Set.Mask) + 1);
+	F->State.Alive = ArenaAlloc(A, Count * sizeof(*F->State.Alive) + 1);
+	if (!F->Set.Str || !F->Set.Len || !F->Set.Mask || !F->State.Alive)
+		return -1;
+	F->Cycle = 0;
+	F->Active = 1;
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : CmdLineFuzzyDrop
+* Parameters    : [in] F - fuzzy state
+* Description   : Frees the candidate set of F
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineFuzzyDrop(CmdLineFuzzy *F)
+{
+	if (F->Active)
+	{
+		F->Active = 0;
+		ArenaRelease(&Session->Scratch, F->Mark);
+	}
+}
+
+/******************************************************************************
+* Function Name : CmdLineSearchShow
+* Parameters    : [in] L - line being edited
+* Description   : Shows the history search line with the current match
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineSearchShow(CmdLineState *L)
+{
+	CmdLineFuzzy *F = &L->Search;
+	char Text[FUZZY_MAX_QUERY + MAX_CMD_SIZE + 16];
+	const char *Match = "";
+	unsigned int Len;
+
+	if (L->QueryLen && (F->Cycle < F->State.TopCount))
+		Match = F->Set.Str[F->State.Top[F->Cycle]];
+
+	Len = sprintf(Text, "(fuzzy)`%.*s': %s", (int)L->QueryLen, L->Query, Match);
+	if (Len > LINE_LEN)
+		Len = LINE_LEN;
+	CmdLineCursorBack(L->Shown, L->Shown);
+	CmdLineShow(Text, Len, 0);
+	L->Shown = Len;
+}
+
+/******************************************************************************
+* Function Name : CmdLineSearchStart
+* Parameters    : [in] L - line being edited
+* Description   : Starts a fuzzy search through the history, newest entries
+*                 ranking first among equal matches
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineSearchStart(CmdLineState *L)
+{
+	CmdLineFuzzy *F = &L->Search;
+	unsigned int Count, i;
+
+	if (L->HistPos == 0)
+		HistorySync();
+	Count = Session->HistoryCount < HISTORY_SIZE ? Session->HistoryCount : HISTORY_SIZE;
+	if (L->isPassword || (Count == 0))
+	{
+		ConsoleBell();
+		return;
+	}
+
+	F->Mark = ArenaGetMark(&Session->Scratch);
+	if (CmdLineFuzzyInit(F, Count) < 0)
+	{
+		ArenaRelease(&Session->Scratch, F->Mark);
+		F->Active = 0;
+		ConsoleBell();
+		return;
+	}
+	for (i = 0; i < Count; i++)
+	{
+		F->Set.Str[i] = HistoryGet(i + 1);
+		F->Set.Len[i] = (unsigned short)strlen(F->Set.Str[i]);
+	}
+	FuzzySetPrepare(&F->Set);
+
+	L->QueryLen = 0;
+	CmdLineCursorBack(L->curIndex, L->curIndex);
+	L->Shown = 0;
+	CmdLineSearchShow(L);
+}
+
+/******************************************************************************
+* Function Name : CmdLineSearchKey
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed while searching
+* Description   : Typing refines the search, Ctrl-R steps to the next best
+*                 match, Escape/Ctrl-G gives up. Any other key takes the
+*                 match into the line and is then handled as usual.
+* Return Value  : 1 if the key was used by the search, 0 otherwise
+******************************************************************************/
+
+static int CmdLineSearchKey(CmdLineState *L, unsigned short ch)
+{
+	CmdLineFuzzy *F = &L->Search;
+	const char *Match;
+
+	if ((ch == REX_KEY_CTRL_R) && F->State.TopCount)
+	{
+		F->Cycle = (F->Cycle + 1) % F->State.TopCount;
+	}
+	else if ((ch == REX_KEY_BACKSPACE) || (ch == SSH_BACKSPACE))
+	{
+		if (L->QueryLen)
+			L->QueryLen--;
+		F->Cycle = 0;
+		FuzzyRank(&F->Set, &F->State, L->Query, L->QueryLen);
+	}
+	else if (!(ch & 0xFF00) && isprint(ch))
+	{
+		if (L->QueryLen < FUZZY_MAX_QUERY)
+			L->Query[L->QueryLen++] = (char)ch;
+		F->Cycle = 0;
+		FuzzyRank(&F->Set, &F->State, L->Query, L->QueryLen);
+	}
+	else
+	{
+		Match = NULL;
+		if (L->QueryLen && (F->Cycle < F->State.TopCount))
+			Match = F->Set.Str[F->State.Top[F->Cycle]];
+
+		CmdLineCursorBack(L->Shown, L->Shown);
+		L->curIndex = 0;
+		if ((Match == NULL) || (ch == REX_KEY_ESCAPE) || (ch == REX_KEY_CTRL_G))
+		{
+			// leave the line as it was
+			CmdLineRepaint(L, 0, L->Index);
+		}
+		else
+		{
+			CmdLineReplace(L, Match, (unsigned short)strlen(Match));
+		}
+		CmdLineFuzzyDrop(F);
+		return (ch == REX_KEY_ESCAPE) || (ch == REX_KEY_CTRL_G);
+	}
+
+	CmdLineSearchShow(L);
+	return 1;
+}
+
+/******************************************************************************
+* Function Name : ContextHash
+* Parameters    : [in] Str - text
+*                 [in] Len - length of the text
+* Description   : FNV-1a hash telling whether the text before the completed
+*                 candidates changed between two Tab presses
+* Return Value  : the hash
+******************************************************************************/
+
+static uint32_t ContextHash(const char *Str, unsigned short Len)
+{
+	uint32_t Hash = 2166136261u;
+
+	while (Len--)
+	{
+		Hash ^= (unsigned char)*Str++;
+		Hash *= 16777619u;
+	}
+	return Hash;
+}
+
+/******************************************************************************
+* Function Name : CandidateGoesOn
+* Parameters    : [in] Str - completion candidate
+* Description   : Tells whether a word completed to Str goes on, like a
+*                 directory ending in '/', rather than getting a blank after
+* Return Value  : 1 if so, 0 otherwise
+******************************************************************************/
+
+static int CandidateGoesOn(const char *Str)
+{
+	size_t Len = strlen(Str);
+
+	return (Len > 0) && (Str[Len - 1] == '/');
+}
+
+/******************************************************************************
+* Function Name : CmdLineReplaceWord
+* Parameters    : [in] L - line being edited
+*                 [in] Start - index where the word starts
+*                 [in] Str - replacement
+* Description   : Replaces the text from Start up to the cursor with Str
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineReplaceWord(CmdLineState *L, unsigned short Start, const char *Str)
+{
+	while (L->curIndex > Start)
+	{
+		KeyBackwardDeleteChar(L, REX_KEY_BACKSPACE);
+	}
+	while (*Str)
+	{
+		KeySelfInsert(L, (unsigned char)*Str++);
+	}
+}
+
+/******************************************************************************
+* Function Name : CmdLineFuzzyAsk
+* Parameters    : [in] L - line being edited
+*                 [in] Start - start of the word before the cursor
+*                 [out] C - candidates, kept in the arena
+* Description   : Asks the completer for every candidate at the cursor
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineFuzzyAsk(CmdLineState *L, unsigned short Start,
+							ConsoleCompletions *C)
+{
+	memset(C, 0, sizeof(*C));
+	C->Scratch = &Session->Scratch;
+	C->Start = Start;
+	Session->Completer(L->CmdLine, L->curIndex, C);
+}
+
+/******************************************************************************
+* Function Name : CmdLineFuzzyComplete
+* Parameters    : [in] L - line being edited
+*                 [in] Again - the previous key completed too
+* Description   : Tab in fuzzy mode. Replaces the word before the cursor
+*                 with the best ranked candidate; further Tabs step through
+*                 the next best ones. The prepared candidate set is kept
+*                 while the completer gives the same number of candidates
+*                 from the same start, after the same text.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineFuzzyComplete(CmdLineState *L, int Again)
+{
+	CmdLineFuzzy *F = &L->Complete;
+	ConsoleCompletions C;
+	unsigned short Cursor = L->curIndex, Start;
+	ArenaMark Mark;
+	unsigned int i;
+
+	// Tab again, show the next best candidate
+	if (F->Active && Again && (F->State.TopCount > 1))
+	{
+		F->Cycle = (F->Cycle + 1) % F->State.TopCount;
+		CmdLineReplaceWord(L, F->Start, F->Set.Str[F->State.Top[F->Cycle]]);
+		return;
+	}
+
+	Start = Cursor;
+	while ((Start > 0) && (L->CmdLine[Start - 1] != ' '))
+	{
+		Start--;
+	}
+
+	// the start the completer sets tells which set it gives, e.g. a path
+	// completer moves it past the last '/' of the word
+	Mark = ArenaGetMark(&Session->Scratch);
+	CmdLineFuzzyAsk(L, Start, &C);
+	if (F->Active && (C.Start == F->Start) && (C.Count == F->Set.Count) &&
+		(F->Context == ContextHash(L->CmdLine, C.Start)))
+	{
+		ArenaRelease(&Session->Scratch, Mark);
+	}
+	else
+	{
+		// the old set sits below the new one in the arena, ask again
+		if (F->Active)
+		{
+			CmdLineFuzzyDrop(F);
+			Mark = ArenaGetMark(&Session->Scratch);
+			CmdLineFuzzyAsk(L, Start, &C);
+		}
+		F->Mark = Mark;
+		if ((C.Start > Cursor) || (CmdLineFuzzyInit(F, C.Count) < 0))
+		{
+			ArenaRelease(&Session->Scratch, F->Mark);
+			F->Active = 0;
+			ConsoleBell();
+			return;
+		}
+		for (i = 0; i < C.Count; i++)
+		{
+			F->Set.Str[i] = C.Cand[i].Str;
+			F->Set.Len[i] = C.Cand[i].Len;
+		}
+		FuzzySetPrepare(&F->Set);
+		F->Start = C.Start;
+		F->Context = ContextHash(L->CmdLine, C.Start);
+	}
+
+	FuzzyRank(&F->Set, &F->State, &L->CmdLine[F->Start], Cursor - F->Start);
+	if (F->State.TopCount == 0)
+	{
+		ConsoleBell();
+		return;
+	}
+	F->Cycle = 0;
+	CmdLineReplaceWord(L, F->Start, F->Set.Str[F->State.Top[0]]);
+	if ((F->State.TopCount == 1) && !CandidateGoesOn(F->Set.Str[F->State.Top[0]]))
+	{
+		KeySelfInsert(L, REX_KEY_SPACE);
+	}
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetMatchMode
+* Parameters    : [in] Mode - REX_MATCH_PREFIX or REX_MATCH_FUZZY
+* Description   : Selects how Tab matches candidates on the current session.
+*                 In fuzzy mode the completer should add every candidate
+*                 valid at the word position without filtering on what was
+*                 typed, as the typed text is the fuzzy query.
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleSetMatchMode(int Mode)
+{
+	Session->MatchMode = Mode;
+}
+
+/******************************************************************************
+* Function Name : ConsoleGetMatchMode
+* Parameters    : NULL
+* Description   : Tells a completer how Tab matches on the current session
+* Return Value  : REX_MATCH_PREFIX or REX_MATCH_FUZZY
+******************************************************************************/
+
+int ConsoleGetMatchMode(void)
+{
+	return Session->MatchMode;
+}
+
+/******************************************************************************
+* Function Name : CmdLineMoreSpan
+* Parameters    : [in] M - candidate list
+*                 [in] Row - row of the list
+* Description   : Gives the screen rows a row of the list takes. Only a
+*                 single column can be wider than the window, and its
+*                 candidates then wrap.
+* Return Value  : the screen rows, at least 1
+******************************************************************************/
+
+static unsigned int CmdLineMoreSpan(CmdLineMore *M, unsigned int Row)
+{
+	unsigned int Len;
+
+	if (M->Cols > 1)
+		return 1;
+	Len = M->List.Cand[Row].Len;
+	return Len ? (Len + g_ColumnLen - 1) / g_ColumnLen : 1;
+}
+
+/******************************************************************************
+* Function Name : CmdLineMorePage
+* Parameters    : [in] L - line being edited
+*                 [in] Rows - number of screen rows to fill, at least one
+*                         row of the list is shown
+* Description   : Renders the next rows of the candidate list into the page
+*                 buffer and puts them out with one write, followed by a
+*                 --More-- prompt if rows are left
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineMorePage(CmdLineState *L, unsigned int Rows)
+{
+	CmdLineMore *M = &L->More;
+	ConsoleCandidate *Cand;
+	unsigned int Row, Col, Idx, Len = 0, Pad, Used = 0, Span;
+
+	if (Rows > M->PageRows)
+		Rows = M->PageRows;
+
+	for (Row = M->NextRow; Row < M->Rows; Row++)
+	{
+		Span = CmdLineMoreSpan(M, Row);
+		if ((Row > M->NextRow) && (Used + Span > Rows))
+			break;
+		Used += Span;
+		for (Col = 0; Col < M->Cols; Col++)
+		{
+			Idx = Col * M->Rows + Row;
+			if (Idx >= M->List.Count)
+				break;
+			Cand = &M->List.Cand[Idx];
+			memcpy(&M->Page[Len], Cand->Str, Cand->Len);
+			Len += Cand->Len;
+			// pad up to the next column unless this is the last one
+			if ((Col + 1 < M->Cols) && (Idx + M->Rows < M->List.Count))
+			{
+				for (Pad = Cand->Len; Pad < M->ColWidth; Pad++)
+					M->Page[Len++] = ' ';
+			}
+		}
+		M->Page[Len++] = REX_KEY_NEWLINE;
+	}
+	M->NextRow = Row;
+
+	if (M->NextRow < M->Rows)
+	{
+		memcpy(&M->Page[Len], "--More--", 8);
+		Len += 8;
+	}
+	ConsolePutBuf(M->Page, Len);
+}
+
+/******************************************************************************
+* Function Name : CmdLineMoreEnd
+* Parameters    : [in] L - line being edited
+* Description   : Closes the candidate list and redraws the line below it
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineMoreEnd(CmdLineState *L)
+{
+	L->More.List.Count = 0;
+	ArenaRelease(&Session->Scratch, L->More.Mark);
+	CmdLineRedraw(L);
+}
+
+/******************************************************************************
+* Function Name : CmdLineMoreKey
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed at the --More-- prompt
+* Description   : Space shows the next page, Enter/Down the next row, any
+*                 other key closes the list
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineMoreKey(CmdLineState *L, unsigned short ch)
+{
+	// erase the --More-- prompt
+	ConsolePutChar(REX_KEY_RETURN);
+	DelCharFromCursorToEndOfLine();
+
+	if (ch == REX_KEY_SPACE)
+	{
+		CmdLineMorePage(L, L->More.PageRows);
+	}
+	else if ((ch == REX_KEY_NEWLINE) || (ch == REX_KEY_DOWN))
+	{
+		CmdLineMorePage(L, 1);
+	}
+	else
+	{
+		L->More.NextRow = L->More.Rows;
+	}
+
+	if (L->More.NextRow >= L->More.Rows)
+	{
+		CmdLineMoreEnd(L);
+	}
+}
+
+/******************************************************************************
+* Function Name : CmdLineListCandidates
+* Parameters    : [in] L - line being edited
+*                 [in] C - candidates, allocated after Mark
+*                 [in] Mark - arena position to release once listed
+* Description   : Lists the candidates below the line in columns sized to
+*                 the window. The layout is computed in one pass over the
+*                 candidate widths; lists longer than the window are paged.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineListCandidates(CmdLineState *L, ConsoleCompletions *C,
+								  ArenaMark Mark)
+{
+	CmdLineMore *M = &L->More;
+	unsigned int i, Widest = 0, Rows;
+
+	for (i = 0; i < C->Count; i++)
+	{
+		if (C->Cand[i].Len > Widest)
+			Widest = C->Cand[i].Len;
+	}
+
+	M->List = *C;
+	M->Mark = Mark;
+	M->ColWidth = Widest + 2;
+	// like ls, the last column needs no gap after it
+	M->Cols = (g_ColumnLen + 2) / M->ColWidth;
+	if (M->Cols == 0)
+		M->Cols = 1;
+	M->Rows = (C->Count + M->Cols - 1) / M->Cols;
+	M->NextRow = 0;
+
+	// a page shows at most one row of the list per screen row
+	M->PageRows = g_RowLen > 1 ? g_RowLen - 1 : 1;
+	Rows = (M->PageRows < M->Rows) ? M->PageRows : M->Rows;
+	M->Page = ArenaAlloc(&Session->Scratch,
+						 Rows * (M->Cols * M->ColWidth + 1) + 8);
+	if (M->Page == NULL)
+	{
+		M->List.Count = 0;
+		ArenaRelease(&Session->Scratch, Mark);
+		ConsoleBell();
+		return;
+	}
+
+	// leave the line the way enter would before listing below it
+	CmdLineSuggestClear(L);
+	PenSet(HL_PLAIN);
+	FinishCmdLine(L->Index, L->curIndex);
+	CmdLineMorePage(L, M->PageRows);
+	if (M->NextRow >= M->Rows)
+	{
+		CmdLineMoreEnd(L);
+	}
+}
+
+/******************************************************************************
+* Function Name : CmdLineComplete
+* Parameters    : [in] L - line being edited
+* Description   : Handles Tab. Asks the completer for candidates of the word
+*                 before the cursor and types as much of them as they have
+*                 in common, plus a space once the word is unique. A second
+*                 Tab that cannot add anything lists the candidates.
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineComplete(CmdLineState *L)
+{
+	int Again = (L->LastAction == KA_COMPLETE);
+	ConsoleCompletions C;
+	ArenaMark Mark;
+	unsigned short Cursor = L->curIndex;
+	unsigned short Typed, Common, j;
+	unsigned int Count, i;
+
+	if (L->isPassword || (Session->Completer == NULL))
+	{
+		ConsoleBell();
+		return;
+	}
+	if (Session->MatchMode == REX_MATCH_FUZZY)
+	{
+		CmdLineFuzzyComplete(L, Again);
+		return;
+	}
+
+	memset(&C, 0, sizeof(C));
+	C.Scratch = &Session->Scratch;
+	C.Start = Cursor;
+	while ((C.Start > 0) && (L->CmdLine[C.Start - 1] != ' '))
+	{
+		C.Start--;
+	}
+
+	Mark = ArenaGetMark(&Session->Scratch);
+	Session->Completer(L->CmdLine, Cursor, &C);
+	if (C.Start > Cursor)
+	{
+		C.Count = 0;
+	}
+	Typed = Cursor - C.Start;
+
+	// only candidates extending what was typed can be inserted, so the
+	// completer may simply add everything valid at this position
+	Count = 0;
+	for (i = 0; i < C.Count; i++)
+	{
+		if ((C.Cand[i].Len >= Typed) &&
+			!memcmp(C.Cand[i].Str, &L->CmdLine[C.Start], Typed))
+		{
+			C.Cand[Count++] = C.Cand[i];
+		}
+	}
+	C.Count = Count;
+
+	Common = C.Count ? C.Cand[0].Len : 0;
+	for (i = 1; i < C.Count; i++)
+	{
+		for (j = Typed; (j < Common) && (C.Cand[i].Str[j] == C.Cand[0].Str[j]); j++)
+			;
+		Common = j;
+	}
+
+	if (Common > Typed)
+	{
+		for (j = Typed; j < Common; j++)
+		{
+			KeySelfInsert(L, (unsigned char)C.Cand[0].Str[j]);
+		}
+		if ((C.Count == 1) && (L->CmdLine[L->curIndex] != ' ') &&
+			!CandidateGoesOn(C.Cand[0].Str))
+		{
+			KeySelfInsert(L, REX_KEY_SPACE);
+		}
+	}
+	else if ((C.Count > 1) && Again)
+	{
+		// second Tab without progress, show what there is to choose from
+		CmdLineListCandidates(L, &C, Mark);
+		return;
+	}
+	else
+	{
+		ConsoleBell();
+	}
+	ArenaRelease(&Session->Scratch, Mark);
+}
+
+/******************************************************************************
+* Function Name : SessionKeys
+* Parameters    : NULL
+* Description   : Gives the keymap of the current session, the built-in
+*                 emacs one unless another was set
+* Return Value  : the keymap
+******************************************************************************/
+
+static const KeyMap *SessionKeys(void)
+{
+	if (Session->Keys == NULL)
+	{
+		Session->Keys = KeyMapBuiltin("emacs");
+	}
+	return Session->Keys;
+}
+
+/******************************************************************************
+* Function Name : SessionOwnKeys
+* Parameters    : NULL
+* Description   : Gives a keymap of the current session's own that can be
+*                 changed, copying the one in use into it first
+* Return Value  : the keymap, NULL if out of memory
+******************************************************************************/
+
+static KeyMap *SessionOwnKeys(void)
+{
+	const KeyMap *Keys = SessionKeys();
+
+	if (Keys != Session->OwnKeys)
+	{
+		if (Session->OwnKeys == NULL)
+		{
+			Session->OwnKeys = malloc(sizeof(KeyMap));
+			if (Session->OwnKeys == NULL)
+				return NULL;
+		}
+		memcpy(Session->OwnKeys, Keys, sizeof(KeyMap));
+		Session->Keys = Session->OwnKeys;
+	}
+	return Session->OwnKeys;
+}
+
+/******************************************************************************
+* Function Name : ConsoleSetKeymap
+* Parameters    : [in] Name - "emacs" (the default) or "minimal"
+* Description   : Makes the current session use a built-in keymap. The
+*                 minimal one only has the keys of old releases: arrows,
+*                 Home/End, Delete, Backspace, Tab, Escape and Ctrl-R.
+* Return Value  : 0 on success, -1 if there is no such keymap
+******************************************************************************/
+
+int ConsoleSetKeymap(const char *Name)
+{
+	const KeyMap *Keys = KeyMapBuiltin(Name);
+
+	if (Keys == NULL)
+		return -1;
+	Session->Keys = Keys;
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : ConsoleBindKey
+* Parameters    : [in] Key - key name, e.g. "C-t", "M-d", "F5" or "0xFF21"
+*                 [in] Action - action name, e.g. "kill-line"
+* Description   : Binds a key of the current session's keymap
+* Return Value  : 0 on success, -1 if the key or action is not known
+******************************************************************************/
+
+int ConsoleBindKey(const char *Key, const char *Action)
+{
+	KeyMap *Keys = SessionOwnKeys();
+
+	if (Keys == NULL)
+		return -1;
+	return KeyMapBind(Keys, Key, Action);
+}
+
+/******************************************************************************
+* Function Name : ConsoleLoadKeymap
+* Parameters    : [in] Path - keymap file, see KeyMapRead
+* Description   : Applies a keymap file to the current session, typically
+*                 once at startup
+* Return Value  : number of lines not understood, -1 if the file cannot be
+*                 read
+******************************************************************************/
+
+int ConsoleLoadKeymap(const char *Path)
+{
+	KeyMap *Keys = SessionOwnKeys();
+
+	if (Keys == NULL)
+		return -1;
+	return KeyMapRead(Keys, Path);
+}
+
+/******************************************************************************
+* Function Name : CmdLineDeleteRange
+* Parameters    : [in] L - line being edited
+*                 [in] From - first position to delete
+*                 [in] To - position just past the last one
+* Description   : Deletes part of the line, shows the rest of the
+*                 line again and leaves the cursor at From
+* Return Value  : NULL
+******************************************************************************/
+
+static void CmdLineDeleteRange(CmdLineState *L, unsigned short From, unsigned short To)
+{
+	if (From == To)
+		return;
+	UndoLog(L, 0, From, &L->CmdLine[From], To - From);
+	memmove(&L->CmdLine[From], &L->CmdLine[To], L->Index - To + 1);
+	CmdLineHighlight(L, From, To - From, 0);
+	L->Index -= To - From;
+	CmdLineRepaint(L, From, From);
+}
+
+/******************************************************************************
+* Function Name : CmdLineWordStart
+* Parameters    : [in] L - line being edited
+*                 [in] Space - words are separated by spaces only, rather
+*                              than by anything not alphanumeric
+* Description   : Finds the start of the word before the cursor
+* Return Value  : its position in the line
+******************************************************************************/
+
+static unsigned short CmdLineWordStart(CmdLineState *L, int Space)
+{
+	unsigned short Pos = L->curIndex;
+
+#define IS_WORD(c)	(Space ? ((c) != ' ') : isalnum((unsigned char)(c)))
+	while ((Pos > 0) && !IS_WORD(L->CmdLine[Pos - 1]))
+		Pos--;
+	while ((Pos > 0) && IS_WORD(L->CmdLine[Pos - 1]))
+		Pos--;
+#undef IS_WORD
+	return Pos;
+}
+
+/*
+ Key actions, one per KA_ value. Each applies a key bound to it and
+ returns REX_KEY_AGAIN while the line is incomplete, 0 once it is done.
+*/
+
+/******************************************************************************
+* Function Name : KeyBell
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Rings the bell for a key that is not bound
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyBell(CmdLineState *L, unsigned short ch)
+{
+	(void)L;
+	(void)ch;
+	ConsoleBell();
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeySelfInsert
+* Parameters    : [in] L - line being edited
+*                 [in] ch - printable key to insert at the cursor
+* Description   : Inserts the key itself into the line
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeySelfInsert(CmdLineState *L, unsigned short ch)
+{
+	/* Ignore all other non printable and control characters*/
+	if ((ch & 0xFF00) || !isprint(ch))
+	{
+		ConsoleBell();
+		return REX_KEY_AGAIN;
+	}
+
+	// For all other normal characters, If Line len is less than
+	// the maximum len put the character into the string
+	if (L->Index != LINE_LEN)
+	{
+		int i;
+		if(L->Index != L->curIndex)
+		{
+			for(i=L->Index;i>=L->curIndex;i--)
+			{
+				L->CmdLine[i+1]=L->CmdLine[i];
+			}
+		}
+		L->CmdLine[L->curIndex++] = (char)(ch &0xFF);
+		UndoLog(L, 1, L->curIndex - 1, &L->CmdLine[L->curIndex - 1], 1);
+		CmdLineHighlight(L, L->curIndex - 1, 0, 1);
+
+		L->Index++;
+		L->CmdLine[L->Index] = 0;
+		if(L->Index > L->curIndex)
+		{
+			PutCmdLine (L->CmdLine, L->Index-1, L->curIndex-1,
+				L->Index-L->curIndex);
+		}
+		else
+		{
+			EchoAt(L->CmdLine, L->curIndex - 1);
+			// Printing a character at the right end of line will
+			// not blink/move the cursor to next line. To do this,
+			// just give a space & move the cursor back.
+			if (((L->curIndex + PROMPT_WIDTH) % g_ColumnLen) == 0)
+			{
+				ConsolePutChar(REX_KEY_SPACE);
+				BackwardCursor(1);
+			}
+			// typing the suggested char leaves the rest of it in place
+			else if ((L->SuggestAt + 1 == L->Index) && (L->SuggestAt < L->SuggestEnd) &&
+					 (L->SuggestText[L->SuggestAt] == (char)ch))
+			{
+				L->SuggestAt++;
+			}
+		}
+	}
+	else
+	{
+		ConsoleBell();
+	}
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyAcceptLine
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Ends the line, or starts a continuation line if it ends
+*                 with a backslash
+* Return Value  : 0 once the line is complete, otherwise REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyAcceptLine(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	CmdLineSuggestClear(L);
+
+	// If a \ preceds the newline, then it is line continuation */
+	if (L->Index > 0)
+	{
+		if (L->CmdLine[L->Index-1] == '\\')
+		{
+			if(L->Index == 1)
+			{
+				UndoClear(&L->Undo);
+				CursorMoveTo(L->curIndex + PROMPT_WIDTH, PROMPT_WIDTH);
+				DelCharFromCursorToEndOfScreen();
+				CmdLineHighlight(L, 0, 1, 0);
+				L->Index=0; 
+				L->curIndex=0;
+				L->CmdLine[0] = 0;
+				return REX_KEY_AGAIN;
+			}
+			if (CmdLineBlockBreak(L) < 0)
+				ConsoleBell();
+			return REX_KEY_AGAIN;
+		}
+	}
+
+	CmdLineBlockShowRest(L);
+	if ( L->Index >= (MAX_CMD_SIZE-1) )
+                                return 0;
+
+	L->CmdLine[L->Index++] = 0;		// Terminate String
+	FinishCmdLine(L->Index, L->curIndex);
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : KeyComplete
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Completes the word before the cursor
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyComplete(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	CmdLineComplete(L);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyBackwardChar
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Moves the cursor one char left
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyBackwardChar(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	if ((L->Index > 0) && (L->curIndex != 0))
+	{
+		// if the cursor is at extreme left end of a line
+		// (excluding the first line), then normal backspace
+		// won't move the cursor to end of previous line.
+		// So, do a line up & move the cursor to end of line.
+		if (((L->curIndex + PROMPT_WIDTH ) % (g_ColumnLen))  == 0)
+		{
+			MoveCursorOneLineUp();
+			ForwardCursor(g_ColumnLen -1);
+		}
+		else
+		{
+			ConsolePutChar(REX_KEY_BACKSPACE);
+		}
+		L->curIndex--;
+	}
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyForwardChar
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Moves the cursor one char right, or takes in the history
+*                 suggestion at the end of the line
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyForwardChar(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	if (CmdLineSuggestShown(L))
+	{
+		CmdLineSuggestAccept(L);
+		return REX_KEY_AGAIN;
+	}
+	if (L->Index > L->curIndex)
+	{
+		// if the cursor is at extreme right end of a line,
+		// do a line down & move the cursor to begining of a line.
+		if (((L->curIndex + PROMPT_WIDTH + 1) % g_ColumnLen) == 0)
+		{
+			MoveCursorOneLineDown();
+			CursorToColumn(g_ColumnLen - 1, 0);
+		}
+		else
+		{
+			ForwardCursor(1);
+		}
+		L->curIndex++;
+	}
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyBackwardWord
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Moves the cursor to the start of the word before it
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyBackwardWord(CmdLineState *L, unsigned short ch)
+{
+	unsigned short Pos = CmdLineWordStart(L, 0);
+
+	(void)ch;
+	CursorMoveTo(L->curIndex + PROMPT_WIDTH, Pos + PROMPT_WIDTH);
+	L->curIndex = Pos;
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyEndOfLine
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Moves the cursor to the end of the line, or takes in the
+*                 history suggestion once there
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyEndOfLine(CmdLineState *L, unsigned short ch)
+{
+	unsigned short End = L->Index;
+
+	(void)ch;
+	if (CmdLineSuggestShown(L))
+	{
+		CmdLineSuggestAccept(L);
+		return REX_KEY_AGAIN;
+	}
+	// reprinting the rest of the line also moves the cursor there;
+	// a cursor motion is used when cheaper, except onto a new row
+	// which only printing can make the cursor wrap to
+	if ((((End + PROMPT_WIDTH) % g_ColumnLen) != 0) &&
+		(CursorMoveCost(L->curIndex + PROMPT_WIDTH, End + PROMPT_WIDTH) <
+		 (unsigned int)(End - L->curIndex)))
+	{
+		CursorMoveTo(L->curIndex + PROMPT_WIDTH, End + PROMPT_WIDTH);
+	}
+	else
+	{
+		PutCmdLine(L->CmdLine, L->Index, L->curIndex, 0);
+	}
+	L->curIndex = End;
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyForwardWord
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Moves the cursor past the end of the next word
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyForwardWord(CmdLineState *L, unsigned short ch)
+{
+	unsigned short End = L->Index, Pos = L->curIndex;
+
+	while ((Pos < End) && !isalnum((unsigned char)L->CmdLine[Pos]))
+		Pos++;
+	while ((Pos < End) && isalnum((unsigned char)L->CmdLine[Pos]))
+		Pos++;
+	if (Pos == End)
+	{
+		return KeyEndOfLine(L, ch);
+	}
+	CursorMoveTo(L->curIndex + PROMPT_WIDTH, Pos + PROMPT_WIDTH);
+	L->curIndex = Pos;
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyBeginningOfLine
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Moves the cursor to the start of the line
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyBeginningOfLine(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	CursorMoveTo(L->curIndex + PROMPT_WIDTH, PROMPT_WIDTH);
+	L->curIndex = 0;
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyBackwardDeleteChar
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Erases the char before the cursor, or the line break
+*                 before the line at its start
+* Return Value  : REX_KEY_AGAIN, 0 if the line is too long
+******************************************************************************/
+
+static unsigned short KeyBackwardDeleteChar(CmdLineState *L, unsigned short ch)
+{
+	unsigned short Len;
+
+	(void)ch;
+	// at the start of a continued line it joins it to the line above
+	if ((L->curIndex == 0) && (L->BlockLine > 0) &&
+		BlockGet(&L->Block, L->BlockLine - 1, &Len) &&
+		(Len + L->Index <= LINE_LEN))
+	{
+		Len = L->BlockLine;
+		CmdLineBlockMove(L, 0);
+		if ((L->BlockLine == Len) || (CmdLineBlockPull(L) < 0))
+			ConsoleBell();
+		return REX_KEY_AGAIN;
+	}
+	if ((L->Index > 0) && (L->curIndex != 0))
+	{
+		UndoLog(L, 0, L->curIndex - 1, &L->CmdLine[L->curIndex - 1], 1);
+		// when the cursor is at middle of a command
+		if (L->curIndex != L->Index)
+		{
+			// if the cursor is at extreme left end of a line
+			// (excluding the first line), then do a line up & move
+			// the cursor to end of line.
+			if (((L->curIndex + PROMPT_WIDTH) % g_ColumnLen) == 0)
+			{
+				MoveCursorOneLineUp();
+				ForwardCursor(g_ColumnLen -1);
+			}
+			else
+			{
+				ConsolePutChar(REX_KEY_BACKSPACE);
+			}
+			EraseDelChar(L->CmdLine,(L->curIndex-1),L->Index);
+		}
+		else
+		{
+			// when the cursor is at end of a command
+			// if the cursor is at extreme right end of a line
+			// (excluding the first line), then "EraseChar" function
+			// can't be used to delete the char in prev line.
+			// So, do a line up & move the cursor to end of line &
+			// delete the character.
+			if (((L->Index + PROMPT_WIDTH) % g_ColumnLen) == 0)
+			{
+				MoveCursorOneLineUp();
+				ForwardCursor(g_ColumnLen -1);
+				DelCharFromCursorToEndOfLine();
+			}
+			else
+			{
+				EraseChar();
+			}
+
+			if ( L->Index > MAX_CMD_SIZE )
+		                return 0;
+
+			L->CmdLine[L->Index-1]=0;
+			CmdLineHighlight(L, L->Index - 1, 1, 0);
+		}
+		L->curIndex--;
+		L->Index--;
+	}
+	else
+	{
+		ConsoleBell();
+	}
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyDeleteChar
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Deletes the char under the cursor, or the line break
+*                 after the line at its end
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyDeleteChar(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	if ((L->Index > 0) && (L->curIndex != L->Index))
+	{
+		UndoLog(L, 0, L->curIndex, &L->CmdLine[L->curIndex], 1);
+		EraseDelChar(L->CmdLine, L->curIndex, L->Index);
+		if (L->Index == L->curIndex)
+		{
+			L->curIndex--;
+		}	
+		L->Index--;
+	}
+	// at the end of a continued line it joins the line below to it
+	else if (L->BlockLine + 1 < BlockLines(&L->Block))
+	{
+		if (CmdLineBlockPull(L) < 0)
+			ConsoleBell();
+	}
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyKillLine
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Deletes from the cursor to the end of the line
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyKillLine(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	CmdLineDeleteRange(L, L->curIndex, L->Index);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyUnixLineDiscard
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Deletes from the start of the line to the cursor
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyUnixLineDiscard(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	CmdLineDeleteRange(L, 0, L->curIndex);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyUnixWordRubout
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Deletes the space separated word before the cursor
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyUnixWordRubout(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	CmdLineDeleteRange(L, CmdLineWordStart(L, 1), L->curIndex);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyDiscardLine
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Clears the whole line
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyDiscardLine(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	UndoLog(L, 0, 0, L->CmdLine, L->Index);
+	if (L->curIndex != L->Index)
+	{
+		while(L->curIndex<=L->Index)
+		{
+			EchoAt(L->CmdLine, L->curIndex);
+			L->curIndex++;
+		}
+		// EraseCmdLine starts on the next row when the line fills this one
+		if (((L->Index + PROMPT_WIDTH) % g_ColumnLen) == 0)
+		{
+			ConsolePutChar(REX_KEY_SPACE);
+			BackwardCursor(1);
+		}
+	}
+	EraseCmdLine(L->Index);
+	CmdLineHighlight(L, 0, L->Index, 0);
+	L->Index = 0;
+	L->curIndex = 0;
+	L->CmdLine[0] = 0;
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyPreviousHistory
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Shows the previous history entry
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyPreviousHistory(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	// within a continued command it goes to the line above
+	if (BlockLines(&L->Block) > 1)
+		CmdLineBlockMove(L, 0);
+	else
+		CmdLineHistory(L, REX_KEY_UP);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyNextHistory
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Shows the next history entry
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyNextHistory(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	if (BlockLines(&L->Block) > 1)
+		CmdLineBlockMove(L, 1);
+	else
+		CmdLineHistory(L, REX_KEY_DOWN);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeySearchHistory
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Starts the fuzzy history search
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeySearchHistory(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	CmdLineSearchStart(L);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyUndo
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Takes back the changes of the last key stroke that
+*                 changed the line
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyUndo(CmdLineState *L, unsigned short ch)
+{
+	CmdLineUndo *U = &L->Undo;
+	UndoRec *R;
+	unsigned short Serial, From = L->Index, Cursor = 0;
+
+	(void)ch;
+	if (U->Cur == U->Head)
+	{
+		ConsoleBell();
+		return REX_KEY_AGAIN;
+	}
+	Serial = U->Rec[(U->Cur - 1) % UNDO_LOG_RECORDS].Serial;
+	while ((U->Cur > U->Head) &&
+		   ((R = &U->Rec[(U->Cur - 1) % UNDO_LOG_RECORDS])->Serial == Serial))
+	{
+		UndoApply(L, R, !R->Insert);
+		Cursor = R->Insert ? R->Pos : R->Pos + R->Len;
+		if (R->Pos < From)
+			From = R->Pos;
+		U->Cur--;
+	}
+	CmdLineRepaint(L, From, Cursor);
+	return REX_KEY_AGAIN;
+}
+
+/******************************************************************************
+* Function Name : KeyRedo
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Makes the changes taken back by the last undo again
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
+
+static unsigned short KeyRedo(CmdLineState *L, unsigned short ch)
+{
+	CmdLineUndo *U = &L->Undo;
+	UndoRec *R;
+	unsigned short Serial, From = L->Index, Cursor = 0;
+
+	(void)ch;
+	if (U->Cur == U->Tail)
 	{
-		// get the char from the console
-		ch = ConsoleGetChar();
+		ConsoleBell();
+		return REX_KEY_AGAIN;
+	}
+	Serial = U->Rec[U->Cur % UNDO_LOG_RECORDS].Serial;
+	while ((U->Cur < U->Tail) &&
+		   ((R = &U->Rec[U->Cur % UNDO_LOG_RECORDS])->Serial == Serial))
+	{
+		UndoApply(L, R, R->Insert);
+		Cursor = R->Insert ? R->Pos + R->Len : R->Pos;
+		if (R->Pos < From)
+			From = R->Pos;
+		U->Cur++;
+	}
+	CmdLineRepaint(L, From, Cursor);
+	return REX_KEY_AGAIN;
+}
 
-		//Added for home key
-		// home key is pressed so go to begining of the line
-		if (ch == REX_KEY_HOME)
-		{
-			while (curIndex)
-			{
-				// when the cursor is at starting position of the next line,
-				// then normal backspace won't move the cursor to end of
-				// previous line. So, do a line up & move the cursor to
-				// end of line.
-				if (((curIndex + PROMPT_STR_LEN) % g_ColumnLen) == 0)
-				{
-					MoveCursorOneLineUp();
-					ForwardCursor(g_ColumnLen - 1);
-				}
-				else
-				{
-					ConsolePutChar(REX_KEY_BACKSPACE);
-				}
-				curIndex--;
-			}
-			continue;
-		}
+/******************************************************************************
+* Function Name : KeyClearScreen
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key pressed
+* Description   : Clears the screen and shows the prompt and the line at
+*                 its top
+* Return Value  : REX_KEY_AGAIN
+******************************************************************************/
 
-		//Added for End key
-		// end key is pressed so go to end of the line
-		if(ch == REX_KEY_END)
-		{
-			PutCmdLine(CmdLine, Index, curIndex, StartIndex, 0);
-			curIndex = Index - StartIndex;
-			continue;
-		}
-		
-		/* Check if any history keys are pressed */
-		/*
-		if ((ch == REX_KEY_UP) ||
-			(ch == REX_KEY_DOWN) ||
-			(ch == REX_KEY_PGUP) ||
-			(ch == REX_KEY_PGDN)) {
+static unsigned short KeyClearScreen(CmdLineState *L, unsigned short ch)
+{
+	(void)ch;
+	TermPut(TC_CLEAR);
+	CmdLineRedraw(L);
+	return REX_KEY_AGAIN;
+}
 
-			if(curIndex != Index) {
-				while(curIndex<=Index)
-				{
-					ConsolePutChar(CmdLine[curIndex]);
-					curIndex++;
-				}
-			}
-			EraseCmdLine(Index);
-			
-			if ( Index >= (MAX_CMD_SIZE-1) )
-				return 0;
+static unsigned short (*const KeyActions[KA_COUNT])(CmdLineState *L,
+													unsigned short ch) = {
+	[KA_BELL] = KeyBell,
+	[KA_SELF_INSERT] = KeySelfInsert,
+	[KA_ACCEPT_LINE] = KeyAcceptLine,
+	[KA_COMPLETE] = KeyComplete,
+	[KA_BACKWARD_CHAR] = KeyBackwardChar,
+	[KA_FORWARD_CHAR] = KeyForwardChar,
+	[KA_BACKWARD_WORD] = KeyBackwardWord,
+	[KA_FORWARD_WORD] = KeyForwardWord,
+	[KA_BEGINNING_OF_LINE] = KeyBeginningOfLine,
+	[KA_END_OF_LINE] = KeyEndOfLine,
+	[KA_BACKWARD_DELETE_CHAR] = KeyBackwardDeleteChar,
+	[KA_DELETE_CHAR] = KeyDeleteChar,
+	[KA_KILL_LINE] = KeyKillLine,
+	[KA_UNIX_LINE_DISCARD] = KeyUnixLineDiscard,
+	[KA_UNIX_WORD_RUBOUT] = KeyUnixWordRubout,
+	[KA_DISCARD_LINE] = KeyDiscardLine,
+	[KA_PREVIOUS_HISTORY] = KeyPreviousHistory,
+	[KA_NEXT_HISTORY] = KeyNextHistory,
+	[KA_SEARCH_HISTORY] = KeySearchHistory,
+	[KA_CLEAR_SCREEN] = KeyClearScreen,
+	[KA_UNDO] = KeyUndo,
+	[KA_REDO] = KeyRedo,
+};
 
-			CmdLine[Index++]= 0;
-			return ch;
-		}
-		*/
+// Actions that print nothing past the end of the line, so a history
+// suggestion shown there stays as it was. Self-insert keeps track itself.
+static const unsigned char KeyKeepsSuggest[KA_COUNT] = {
+	[KA_BELL] = 1,
+	[KA_SELF_INSERT] = 1,
+	[KA_BACKWARD_CHAR] = 1,
+	[KA_FORWARD_CHAR] = 1,
+	[KA_BACKWARD_WORD] = 1,
+	[KA_FORWARD_WORD] = 1,
+	[KA_BEGINNING_OF_LINE] = 1,
+	[KA_END_OF_LINE] = 1,
+};
 
-		/* If escape, clear the line */
-		if (ch == REX_KEY_ESCAPE)
-		{
-			if (StartIndex != 0)
-			{
-				continue;
-			}
+#ifdef REX_SELF_CHECK
+/******************************************************************************
+* Function Name : CmdLineSelfCheck
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key just handled
+* Description   : Plays the output of the key on the shadow screen and
+*                 checks that it shows the line being edited, any
+*                 history suggestion after it and blanks up to the end of
+*                 that row, with the cursor on curIndex and not waiting to
+*                 wrap. The start of the line is found from the cursor, so
+*                 the cursor being off shows up as the line being off. A
+*                 mismatch is reported on stderr and counted, see
+*                 ConsoleSelfCheckFailures; the check is then off until the
+*                 next line.
+* Return Value  : NULL
+******************************************************************************/
 
-			if (curIndex != Index)
-			{
-				while(curIndex<=Index)
-				{
-					ConsolePutChar(CmdLine[curIndex]);
-					curIndex++;
-				}
-			}
-			EraseCmdLine(Index);
-			Index = 0;
-			curIndex = 0;
-			continue;
-		}
-		
-		//To perform left cursor movement 
-		// Moves the cursor left if left arrow key is pressed
-		if (ch == REX_KEY_LEFT)
-		{
-			if ((Index > StartIndex) && (curIndex != 0))
-			{
-				// if the cursor is at extreme left end of a line
-				// (excluding the first line), then normal backspace
-				// won't move the cursor to end of previous line.
-				// So, do a line up & move the cursor to end of line.
-				if (((curIndex + PROMPT_STR_LEN ) % (g_ColumnLen))  == 0)
-				{
-					MoveCursorOneLineUp();
-					ForwardCursor(g_ColumnLen -1);
-				}
-				else
-				{
-					ConsolePutChar(REX_KEY_BACKSPACE);
-				}
-				curIndex--;
-			}
-			continue;
-		}
+static void CmdLineSelfCheck(CmdLineState *L, unsigned short ch)
+{
+	ShadowScreen *S = &Session->Shadow;
+	int Origin, End, Stop, i, Pos;
+	char Want, Got;
 
-		// Moves the cursor right if right arrow key is pressed
-		if (ch == REX_KEY_RIGHT)
-		{
-			if (Index > (curIndex + StartIndex))
-			{
-				// if the cursor is at extreme right end of a line,
-				// do a line down & move the cursor to begining of a line.
-				if (((curIndex + PROMPT_STR_LEN + 1) % g_ColumnLen) == 0)
-				{
-					MoveCursorOneLineDown();
-					BackwardCursor(g_ColumnLen - 1);
-				}
-				else
-				{
-					ForwardCursor(1);
-				}
-				curIndex++;
-			}
-			continue;
-		}
+	ShadowFeed(S, &Session->OutBuf[Session->ShadowFed],
+			   Session->OutLen - Session->ShadowFed);
+	Session->ShadowFed = Session->OutLen;
+	if (S->Lost || (S->Cols != g_ColumnLen) || L->More.List.Count || L->Search.Active)
+		return;
 
-		//If Backspace erase a character from screen and from buffer
-		//To add backspace facility on ssh.
-		if ((ch == REX_KEY_BACKSPACE) ||
-			(ch == SSH_BACKSPACE))
-		{
-			if ((Index > StartIndex) && (curIndex != 0))
-			{
-				// when the cursor is at middle of a command
-				if ((curIndex + StartIndex) != Index)
-				{
-					// if the cursor is at extreme left end of a line
-					// (excluding the first line), then do a line up & move
-					// the cursor to end of line.
-					if (((curIndex + PROMPT_STR_LEN) % g_ColumnLen) == 0)
-					{
-						MoveCursorOneLineUp();
-						ForwardCursor(g_ColumnLen -1);
-					}
-					else
-					{
-						ConsolePutChar(REX_KEY_BACKSPACE);
-					}
-					EraseDelChar(CmdLine,(curIndex-1+StartIndex),Index);
-				}
-				else
-				{
-					// when the cursor is at end of a command
-					// if the cursor is at extreme right end of a line
-					// (excluding the first line), then "EraseChar" function
-					// can't be used to delete the char in prev line.
-					// So, do a line up & move the cursor to end of line &
-					// delete the character.
-					if (((Index + PROMPT_STR_LEN) % g_ColumnLen) == 0)
-					{
-						MoveCursorOneLineUp();
-						ForwardCursor(g_ColumnLen -1);
-						DelCharFromCursorToEndOfLine();
-					}
-					else
-					{
-						EraseChar();
-					}
-
-					if ( Index > MAX_CMD_SIZE )
-				                return 0;
-
-					CmdLine[Index-1]=0;
-				}
-				curIndex--;
-				Index--;
-			}
-			else
-			{
-				ConsoleBell();
-			}
-			continue;
-		}
+	Origin = S->Y * S->Cols + S->X - (L->curIndex + PROMPT_WIDTH);
+	End = L->Index;
+	if ((L->SuggestEnd > L->SuggestAt) && (L->SuggestAt == L->Index))
+		End = L->SuggestEnd;
+	Pos = Origin + PROMPT_WIDTH + End;
+	Stop = (Pos / S->Cols + 1) * S->Cols;
 
-		// Deletes the cursor position character
-		if(ch == REX_KEY_DEL)
+	for (i = 0; !S->Pending && (Origin >= 0) && (i + Origin + PROMPT_WIDTH < Stop); i++)
+	{
+		Pos = Origin + PROMPT_WIDTH + i;
+		if (Pos >= SHADOW_ROWS * S->Cols)
+			break;
+		Want = (i < L->Index) ? (L->isPassword ? '*' : L->CmdLine[i]) :
+			   (i < End) ? L->SuggestText[i] : ' ';
+		Got = S->Cell[Pos / S->Cols][Pos % S->Cols];
+		if (Got != Want)
 		{
-			if ((Index > StartIndex) && (curIndex != Index))
-			{
-				EraseDelChar(CmdLine, curIndex+StartIndex, Index);
-				if (Index == (StartIndex+curIndex))
-				{
-					curIndex--;
-				}	
-				Index--;
-			}
-			continue;
+			fprintf(stderr, "\nself check: key %#x, index %u holds '%c', screen '%c'\n",
+					ch, i, Want, Got);
+			Session->SelfCheckFailures++;
+			S->Lost = 1;
+			return;
 		}
+	}
+	if (S->Pending || (Origin < 0))
+	{
+		fprintf(stderr, "\nself check: key %#x, cursor off at %d,%d%s\n",
+				ch, S->Y, S->X, S->Pending ? " waiting to wrap" : "");
+		Session->SelfCheckFailures++;
+		S->Lost = 1;
+	}
+}
+
+/******************************************************************************
+* Function Name : ConsoleSelfCheckFailures
+* Parameters    : NULL
+* Description   : Tells how many times the echo of the current session did
+*                 not match the line being edited
+* Return Value  : number of mismatches since the session was created
+******************************************************************************/
+
+unsigned long ConsoleSelfCheckFailures(void)
+{
+	return Session->SelfCheckFailures;
+}
+#endif
 
-		/* If Tab , Insert Spaces for Tab */
-		if (ch == REX_KEY_TAB)
+/******************************************************************************
+* Function Name : CmdLineProcessKey
+* Parameters    : [in] L - line being edited
+*                 [in] ch - key returned by ConsoleGetChar
+* Description   : Applies one key stroke to the command line through the
+*                 session's keymap
+* Return Value  : REX_KEY_AGAIN while the line is incomplete, 0 once the
+*                 user pressed enter
+******************************************************************************/
+
+static unsigned short CmdLineProcessKey(CmdLineState *L, unsigned short ch)
+{
+	unsigned char Action;
+	unsigned short rc = REX_KEY_AGAIN;
+
+	REX_TRACE3(edit, ch, L->Index, Session->OutLen);
+	// a candidate list is waiting at --More--
+	if (L->More.List.Count)
+	{
+		CmdLineMoreKey(L, ch);
+	}
+	else if (!L->Search.Active || !CmdLineSearchKey(L, ch))
+	{
+		Action = KEYMAP_ACTION(SessionKeys(), ch);
+		L->Undo.Serial++;
+		L->Undo.Typing = (Action == KA_SELF_INSERT);
+		if (!KeyKeepsSuggest[Action] && (L->SuggestEnd > L->SuggestAt))
+			L->SuggestStale = 1;
+		rc = KeyActions[Action](L, ch);
+		L->LastAction = Action;
+		if (rc == REX_KEY_AGAIN)
 		{
-			//TODO for TabSupported Features
-			curIndex = Index;
-			continue;
+			CmdLineHighlightFlush(L);
+			CmdLineSuggest(L);
+#ifdef REX_SELF_CHECK
+			CmdLineSelfCheck(L, ch);
+#endif
 		}
+	}
+	// rows the line took, see CmdLineBlockReach
+	if (L->SuggestEnd > L->BlockWide)
+		L->BlockWide = L->SuggestEnd;
+	if (L->Index > L->BlockWide)
+		L->BlockWide = L->Index;
+	if (L->Search.Active && (L->Shown > L->BlockWide))
+		L->BlockWide = L->Shown;
+	REX_TRACE4(edit_done, ch, rc, L->Index, Session->OutLen);
+	return rc;
+}
 
-		// if newline, end of input
-		if (ch == REX_KEY_NEWLINE)
-		{
-			// If a \ preceds the newline, then it is line continuation */
-			if (Index > StartIndex)
-			{
-				if (CmdLine[Index-1] == '\\')
-				{
-					if(Index == 1)
-					{
-						EraseChar();
-						Index=0; 
-						curIndex=0;
-						continue;
-					}
-					StartIndex = --Index;
-					curIndex--;
-					curIndex += StartIndex;
-					if(curIndex != Index)
-					{
-						while(curIndex<=Index)
-						{
-							ConsolePutChar(CmdLine[curIndex]);
-							curIndex++;
-						}
-					}
-					curIndex = 0;
-					ConsolePutChar(REX_KEY_NEWLINE);
-					continue;
-				}
-			}
+/******************************************************************************
+* Function Name : CmdLineEnd
+* Parameters    : [in] Status - how the line ended
+* Description   : Finishes the current line, handing back the partial line
+*                 if the input was given up on, and resets the wait limits
+* Return Value  : Status, REX_KEY_TOOLONG instead of 0 if the line was cut
+*                 short at LINE_LEN
+******************************************************************************/
 
-			if ( Index >= (MAX_CMD_SIZE-1) )
-                                    return 0;
+static unsigned short CmdLineEnd(unsigned short Status)
+{
+	CmdLineState *L = &Session->Line;
 
-			CmdLine[Index++] = 0;		// Terminate String
-			ConsolePutChar(REX_KEY_NEWLINE);
-			// Put newlines depending upon the no. of lines the
-			// characters are entered in.
-			// Note: The current cursor position may be at
-			// start/end/middle of ANY line.
-			{
-				int temp1 = 0 , temp2 = 0 , temp3 = 0 ;
-				temp1 = (Index + PROMPT_STR_LEN) / g_ColumnLen ;
-				temp2 = (curIndex + PROMPT_STR_LEN) / g_ColumnLen;
-				temp3 = temp1 - temp2;
-				while (temp3--)
-				{
-					ConsolePutChar(REX_KEY_NEWLINE);
-				}
-			}
-			break;
-		}
+	PenSet(HL_PLAIN);
+	if (Status != 0)
+	{
+		CmdLineSuggestClear(L);
+		CmdLineBlockShowRest(L);
+		L->CmdLine[L->Index] = 0;
+		FinishCmdLine(L->Index, L->curIndex);
+	}
+	CmdLineBlockJoin(L);
+	// a line cut short must not pass for the one typed
+	if ((Status == 0) && (ConsoleBlockLength() > LINE_LEN))
+	{
+		Status = REX_KEY_TOOLONG;
+	}
+	if (L->isPassword)
+	{
+		BlockClear(&L->Block);
+	}
+	else if (Status == 0)
+	{
+		ConsoleHistoryAdd(L->CmdLine);
+	}
+	ConsoleFlush();
+
+	L->CmdLine = NULL;
+	ArenaReset(&Session->Scratch);
+	Session->HasDeadline = 0;
+	Session->IdleTimeoutMs = 0;
+	Session->CancelFd = -1;
+	Session->Expired = 0;
+	Session->NonBlocking = 0;
+	return Status;
+}
+
+/******************************************************************************
+* Function Name : GetCmdLine
+* Parameters    : [in] Prompt - prompt to show, see CmdLineBegin
+*                 [in] CmdLine - holds the command line
+*                 [in] Index - holds the current index
+*                 [in] isPassword - flag representing the password
+* Description   : Gets the entire command line string given by the user,
+*                 waiting for it as long as it takes
+* Return Value  : 0 once the line is complete, REX_KEY_TOOLONG if it was
+*                 continued past LINE_LEN chars, REX_KEY_EOF if input ended
+******************************************************************************/
+
+unsigned short GetCmdLine(const char *Prompt, char *CmdLine,
+						  unsigned short Index, int isPassword)
+{
+	return GetCmdLineTimed(Prompt, CmdLine, Index, isPassword, NULL, 0, -1);
+}
+
+/******************************************************************************
+* Function Name : GetCmdLineTimed
+* Parameters    : [in] Prompt - prompt to show, see CmdLineBegin
+*                 [in] CmdLine - holds the command line
+*                 [in] Index - holds the current index
+*                 [in] isPassword - flag representing the password
+*                 [in] Deadline - absolute CLOCK_MONOTONIC time to give up
+*                                 at, NULL for none
+*                 [in] IdleTimeoutMs - give up after this long without a
+*                                      key stroke, 0 for none
+*                 [in] CancelFd - eventfd from ConsoleCreateCancelFd, or -1
+* Description   : Gets the entire command line string given by the user.
+*                 When the wait ends early, CmdLine holds what was typed so
+*                 far and the cursor is left on a fresh line.
+* Return Value  : 0 once the line is complete, otherwise REX_KEY_TOOLONG,
+*                 REX_KEY_TIMEOUT, REX_KEY_IDLE, REX_KEY_CANCEL or
+*                 REX_KEY_EOF
+******************************************************************************/
+
+unsigned short GetCmdLineTimed(const char *Prompt, char *CmdLine,
+							   unsigned short Index, int isPassword,
+							   const struct timespec *Deadline,
+							   int IdleTimeoutMs, int CancelFd)
+{
+	unsigned short ch, rc;
 
+	CmdLineBegin(Prompt, CmdLine, Index, isPassword);
+	Session->HasDeadline = (Deadline != NULL);
+	if (Deadline)
+		Session->Deadline = *Deadline;
+	Session->IdleTimeoutMs = IdleTimeoutMs;
+	Session->CancelFd = CancelFd;
+	if (IdleTimeoutMs)
+		clock_gettime(CLOCK_MONOTONIC, &Session->LastInput);
+
+	// read the console char input from the user until
+	// the user types "enter" button to exit
+	do
+	{
+		ch = ConsoleGetChar();
 
-		/* Ignore all other non printable and control characters*/
-		if (ch & 0xFF00)
+		// the wait was given up on, hand back what we have so far
+		if ((ch == REX_KEY_TIMEOUT) || (ch == REX_KEY_IDLE) ||
+			(ch == REX_KEY_CANCEL) || (ch == REX_KEY_EOF))
 		{
-			ConsoleBell();
-			continue;
+			return CmdLineEnd(ch);
 		}
+		rc = CmdLineProcessKey(&Session->Line, ch);
+	} while (rc == REX_KEY_AGAIN);
+
+	return CmdLineEnd(rc);
+}
+
+/******************************************************************************
+* Function Name : CmdLineBegin
+* Parameters    : [in] Prompt - prompt to show at the cursor, which has to
+*                           be in column 0, followed by the first Index
+*                           chars of CmdLine. It may hold color sequences.
+*                           NULL if the caller has shown both itself.
+*                 [in] CmdLine - holds the command line
+*                 [in] Index - holds the current index
+*                 [in] isPassword - flag representing the password
+* Description   : Starts reading a command line into CmdLine on the current
+*                 session without waiting for input. Feed it with
+*                 CmdLinePoll whenever the session input is readable.
+* Return Value  : NULL
+******************************************************************************/
+
+void CmdLineBegin(const char *Prompt, char *CmdLine, unsigned short Index,
+				  int isPassword)
+{
+	CmdLineState *L = &Session->Line;
+	unsigned short i;
 
-		if (!isprint(ch))
+	L->CmdLine = CmdLine;
+	L->Index = Index;
+	L->curIndex = Index;
+	BlockClear(&L->Block);
+	L->BlockLine = 0;
+	L->BlockWide = Index;
+	L->BlockReach = 0;
+	L->BlockCols = g_ColumnLen;
+	L->isPassword = isPassword;
+	L->LastAction = KA_BELL;
+	L->More.List.Count = 0;
+	L->HistPos = 0;
+	L->Complete.Active = 0;
+	L->Search.Active = 0;
+	UndoClear(&L->Undo);
+	L->Highlight = (Session->Highlight == REX_HIGHLIGHT_ON) && !isPassword;
+	L->DamageFrom = L->DamageTo = 0;
+	HighlightReset(&L->Hl);
+	// text handed in is on the screen already, unstyled
+	CmdLineHighlight(L, 0, 0, Index);
+	L->Suggest = (Session->Suggest == REX_SUGGEST_ON) && !isPassword;
+	L->SuggestAt = L->SuggestEnd = Index;
+	L->SuggestStale = 0;
+	PromptSet(Prompt);
+#ifdef REX_SELF_CHECK
+	ShadowReset(&Session->Shadow, g_ColumnLen);
+	Session->ShadowFed = Session->OutLen;
+	// the text handed in without a prompt is on the screen already
+	if (Prompt == NULL)
+		ShadowFeed(&Session->Shadow, CmdLine, Index);
+#endif
+	if (Prompt != NULL)
+	{
+		PromptShow(L);
+		for (i = 0; i < Index; i++)
 		{
-			ConsoleBell();
-			continue;
+			ConsolePutChar(isPassword ? '*' : CmdLine[i]);
 		}
+		if (Index && (((Index + PROMPT_WIDTH) % g_ColumnLen) == 0))
+		{
+			ConsolePutChar(REX_KEY_SPACE);
+			BackwardCursor(1);
+		}
+	}
+	Session->Expired = 0;
+	HistorySync();
+}
+
+/******************************************************************************
+* Function Name : CmdLinePoll
+* Parameters    : NULL
+* Description   : Processes every key that can be read from the current
+*                 session without blocking and flushes the echo. It stops
+*                 early while the terminal does not take the echo; the keys
+*                 left are processed by the next call.
+* Return Value  : REX_KEY_AGAIN if the line needs more input or the output
+*                 to drain (see ConsoleOutputPending and ConsolePollTimeout),
+*                 0 once it is complete, REX_KEY_TOOLONG if it was continued
+*                 past LINE_LEN chars or REX_KEY_EOF if the input was closed
+******************************************************************************/
 
-		// For all other normal characters, If Line len is less than
-		// the maximum len put the character into the string
-		if (Index != LINE_LEN)
+unsigned short CmdLinePoll(void)
+{
+	unsigned short ch, rc;
+
+	if (Session->Line.CmdLine == NULL)
+		return 0;
+
+	Session->NonBlocking = 1;
+	do
+	{
+		// more echo would only pile up behind what the terminal refuses
+		if (Session->SpillLen)
 		{
-			int i;
-			curIndex += StartIndex;
-			if(Index != curIndex)
-			{
-				for(i=Index;i>=curIndex;i--)
-				{
-					CmdLine[i+1]=CmdLine[i];
-				}
-			}
-			CmdLine[curIndex++] = (char)(ch &0xFF);
-			
-			Index++;
-			CmdLine[Index] = 0;
-			curIndex -= StartIndex;
-			if(Index > curIndex+StartIndex)
-			{
-				PutCmdLine (CmdLine, Index-1, curIndex-1,
-					StartIndex, Index-(curIndex+StartIndex));
-			}
-			else
-			{
-				if(isPassword)
-				{
-					ConsolePutChar('*');
-				}
-				else
-				{
-					ConsolePutChar(ch);
-					// Printing a character at the right end of line will
-					// not blink/move the cursor to next line. To do this,
-					// just give a space & move the cursor back.
-					if (((curIndex + PROMPT_STR_LEN) % g_ColumnLen) == 0)
-					{
-						fprintf(stdout," ");
-						fflush(stdout);
-						BackwardCursor(1);
-					}
-				}
-			}
+			ConsoleFlush();
+			if (Session->SpillLen)
+				return REX_KEY_AGAIN;
 		}
-		else
+		ch = ConsoleGetChar();
+		if (ch == REX_KEY_AGAIN)
 		{
-			ConsoleBell();
+			ConsoleFlush();
+			return REX_KEY_AGAIN;
 		}
-	}	/* while (1) */
-	return 0;
+		if (ch == REX_KEY_EOF)
+		{
+			return CmdLineEnd(ch);
+		}
+		rc = CmdLineProcessKey(&Session->Line, ch);
+	} while (rc == REX_KEY_AGAIN);
+
+	return CmdLineEnd(rc);
+}
+
+/******************************************************************************
+* Function Name : ConsoleBlockLines
+* Parameters    : NULL
+* Description   : Tells over how many lines the last command read on the
+*                 current session was continued with backslashes. The
+*                 command is handed back joined into one line, cut short at
+*                 LINE_LEN chars when the read returned REX_KEY_TOOLONG;
+*                 ConsoleBlockLine gives each line whole.
+* Return Value  : the number of lines, 0 for a single line or a password
+******************************************************************************/
+
+unsigned int ConsoleBlockLines(void)
+{
+	return BlockLines(&Session->Line.Block);
+}
+
+/******************************************************************************
+* Function Name : ConsoleBlockLength
+* Parameters    : NULL
+* Description   : Gives the length of the last command read on the current
+*                 session with the lines of its block joined, which may be
+*                 more than the LINE_LEN chars handed back
+* Return Value  : the length, 0 if it was not continued
+******************************************************************************/
+
+unsigned int ConsoleBlockLength(void)
+{
+	const LineBlock *B = &Session->Line.Block;
+	unsigned int Lines = BlockLines(B), Length = 0, i;
+	unsigned short Len;
+
+	for (i = 0; i < Lines; i++)
+	{
+		BlockGet(B, i, &Len);
+		Length += Len;
+	}
+	return Length;
+}
+
+/******************************************************************************
+* Function Name : ConsoleBlockLine
+* Parameters    : [in] Line - line number, from 0
+*                 [out] Buf - receives the line without its backslash,
+*                             NUL terminated
+*                 [in] Size - size of Buf
+* Description   : Copies a line of the last command read on the current
+*                 session, see ConsoleBlockLines
+* Return Value  : the length copied, -1 if there is no such line
+******************************************************************************/
+
+int ConsoleBlockLine(unsigned int Line, char *Buf, unsigned short Size)
+{
+	unsigned short Len;
+	const char *Text = BlockGet(&Session->Line.Block, Line, &Len);
+
+	if ((Text == NULL) || (Size == 0))
+		return -1;
+	if (Len >= Size)
+		Len = Size - 1;
+	memcpy(Buf, Text, Len);
+	Buf[Len] = 0;
+	return Len;
+}
+
+/******************************************************************************
+* Function Name : ConsoleSessionCreate
+* Parameters    : [in] InFd - descriptor the keys are read from
+*                 [in] OutFd - descriptor the echo is written to, -1 to
+*                          drop it
+* Description   : Creates an additional console session, e.g. for a pty or
+*                 socket, with its own input buffer and line state. The
+*                 caller puts the terminal in the right mode; InFd should be
+*                 non-blocking when driven through CmdLinePoll.
+* Return Value  : the session, NULL if out of memory
+******************************************************************************/
+
+ConsoleSession *ConsoleSessionCreate(int InFd, int OutFd)
+{
+	ConsoleSession *New = calloc(1, sizeof(ConsoleSession));
+
+	if (New == NULL)
+		return NULL;
+	New->InFd = InFd;
+	New->OutFd = OutFd;
+	New->CancelFd = -1;
+	New->SharedStuck = UINT64_MAX;
+	New->ColumnLen = 80;
+	New->RowLen = 24;
+	return New;
+}
+
+/******************************************************************************
+* Function Name : ConsoleSessionDestroy
+* Parameters    : [in] Old - session from ConsoleSessionCreate
+* Description   : Frees a session. The descriptors are left open.
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsoleSessionDestroy(ConsoleSession *Old)
+{
+	unsigned int i;
+
+	if ((Old == NULL) || (Old == &DefaultSession))
+		return;
+	if (Old == Session)
+		ConsoleSelectSession(NULL);
+	ArenaFree(&Old->Scratch);
+	BlockClear(&Old->Line.Block);
+	for (i = 0; i < HISTORY_SIZE; i++)
+		free(Old->History[i]);
+	ShmHistoryClose(Old->Shared);
+	free(Old->OwnKeys);
+	free(Old->Spill);
+	free(Old);
+}
+
+/******************************************************************************
+* Function Name : ConsoleSelectSession
+* Parameters    : [in] New - session to make current, NULL for the default
+*                            stdin/stdout session
+* Description   : Makes all console functions work on the given session.
+*                 The column length follows the session.
+* Return Value  : the previously selected session
+******************************************************************************/
+
+ConsoleSession *ConsoleSelectSession(ConsoleSession *New)
+{
+	ConsoleSession *Old = Session;
+
+	if (New == NULL)
+		New = &DefaultSession;
+	Old->ColumnLen = g_ColumnLen;
+	Old->RowLen = g_RowLen;
+	Session = New;
+	g_ColumnLen = New->ColumnLen;
+	g_RowLen = New->RowLen;
+	return Old;
+}
+
+/******************************************************************************
+* Function Name : ConsoleInputFd
+* Parameters    : NULL
+* Description   : Gives the descriptor to wait on before calling CmdLinePoll
+* Return Value  : input descriptor of the current session
+******************************************************************************/
+
+int ConsoleInputFd(void)
+{
+	return Session->InFd;
 }
 
 int main()
@@ -999,11 +5314,24 @@ int main()
     // open a new console for the user
     OpenConsole(0);
 
-    printf("\nUsername : ");  
-    GetCmdLine(username, 0, 0);
+    printf("\n");
+    // a name continued with backslashes may not fit once joined
+    if (GetCmdLine("Username : ", username, 0, 0) == REX_KEY_TOOLONG)
+    {
+        unsigned int i, Lines = ConsoleBlockLines();
+        char Line[MAX_CMD_SIZE];
+
+        printf("\nUSERNAME is %u chars, cut short at %d, its lines are :\n",
+               ConsoleBlockLength(), LINE_LEN);
+        for (i = 0; i < Lines; i++)
+        {
+            ConsoleBlockLine(i, Line, sizeof(Line));
+            printf("%u: %s\n", i + 1, Line);
+        }
+    }
 
-    printf("\nPassword : ");     
-        GetCmdLine(password, 0, 1);  
+    printf("\n");
+    GetCmdLine("Password : ", password, 0, 1);
 
     printf("\nOUTPUT :- \nUSERNAME = %s\nPASSWORD = %s\n", username, password);
     // close the current console and restores back the default console
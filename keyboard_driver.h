@@ -3,6 +3,29 @@
 * Description : Contains function declarations for keyboard_driver.h
 *******************************************************************************/
 #ifndef _KEYBOARD_DRIVER_
+#define _KEYBOARD_DRIVER_
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ConsoleSession ConsoleSession;
+typedef struct ConsoleCompletions ConsoleCompletions;
+
+/* Called on Tab with the NUL terminated line and the cursor index; adds
+   candidates for the word before the cursor with ConsoleAddCompletion */
+typedef void (*ConsoleCompleter)(const char *CmdLine, unsigned short Cursor,
+								 ConsoleCompletions *Out);
+
+/* Tells whether the Len chars at Word (not NUL terminated) name a command,
+   for highlighting unknown commands */
+typedef int (*ConsoleCommandCheck)(const char *Word, unsigned short Len);
+
+// Column and row length of the current session's window
+extern int g_ColumnLen;
+extern int g_RowLen;
 
 /* Normal non-display ascii Keys returned by ConsoleGetChar*/
 #define REX_KEY_BELL		'\a'
@@ -14,8 +37,14 @@
 #define	REX_KEY_ESCAPE		27 
 #define REX_KEY_ASCII_DEL	127
 #define REX_KEY_ESC_SEQ		'['		/* Used in Terminal Escape Sequence */
+#define REX_KEY_CTRL_G		0x07	/* abort history search */
+#define REX_KEY_CTRL_R		0x12	/* fuzzy history search */
+#define REX_KEY_CTRL(c)		((c) & 0x1F)
 
 
+/* Meta (Alt) keys returned by ConsoleGetChar, sent as ESC + key */
+#define REX_KEY_META(c)		(0xFE00 | (c))
+
 /* Special non-ascii Keys returned by ConsoleGetChar*/
 #define REX_KEY_UP		0xFF00
 #define REX_KEY_DOWN		0xFF01
@@ -46,20 +75,106 @@
 #define REX_KEY_F11		0xFF8A
 #define REX_KEY_F12		0xFF8B
 
+/* Pseudo keys ending a GetCmdLineTimed call early */
+#define REX_KEY_TIMEOUT		0xFFE0	/* absolute deadline reached */
+#define REX_KEY_IDLE		0xFFE1	/* no key stroke within the idle timeout */
+#define REX_KEY_CANCEL		0xFFE2	/* ConsoleCancel was called */
+#define REX_KEY_AGAIN		0xFFE3	/* more input needed, see CmdLinePoll */
+#define REX_KEY_TOOLONG		0xFFE4	/* continued line cut at LINE_LEN */
+#define REX_KEY_EOF		0xFFFF	/* input closed */
+
 #define SSH_BACKSPACE		127
 
-#define PROMPT_STR_LEN		0
+// Longest prompt kept, see CmdLineBegin
+#define PROMPT_MAX_SIZE		256
 // Maximum Line Width of console
 #define LINE_LEN		250
 #define MAX_CMD_SIZE		255
 
+// Input ring buffer kept between GetCmdLine calls (sizes are powers of 2)
+#define CONSOLE_INBUF_SIZE	4096
+#define CONSOLE_MAX_LINES	256
+#define CONSOLE_OUTBUF_SIZE	4096
+// Lines kept in each session's history
+#define HISTORY_SIZE		1000
+// Undo log of the line being edited: changes and chars kept (powers of 2)
+#define UNDO_LOG_RECORDS	256
+#define UNDO_LOG_TEXT		2048
+
+// Tab completion matching, see ConsoleSetMatchMode
+#define REX_MATCH_PREFIX	0
+#define REX_MATCH_FUZZY		1
+
+// Mid-line edit output, see ConsoleSetSlowLink
+#define REX_SLOWLINK_OFF	0
+#define REX_SLOWLINK_AUTO	1
+#define REX_SLOWLINK_ON		2
+
+// Syntax highlighting, see ConsoleSetHighlight
+#define REX_HIGHLIGHT_OFF	0
+#define REX_HIGHLIGHT_ON	1
+
+// History suggestions after the cursor, see ConsoleSetSuggest
+#define REX_SUGGEST_OFF		0
+#define REX_SUGGEST_ON		1
+
+// Scratch arena granularity
+#define ARENA_BLOCK_SIZE	16384
+#define ARENA_ALIGN		16
+// Time allowed between the bytes of one escape sequence
+#define ESC_SEQ_TIMEOUT_MS	50
+
 
 void OpenConsole(int rawmode);
 void ConsoleClear(void);
 void CloseConsole(void);
-unsigned short GetCmdLine(char *CmdLine, unsigned short Index, int isPassword);
+unsigned short GetCmdLine(const char *Prompt, char *CmdLine,
+						  unsigned short Index, int isPassword);
+unsigned short GetCmdLineTimed(const char *Prompt, char *CmdLine,
+							   unsigned short Index, int isPassword,
+							   const struct timespec *Deadline,
+							   int IdleTimeoutMs, int CancelFd);
+int ConsoleCreateCancelFd(void);
+void ConsoleCancel(int CancelFd);
 void GetWindowSize(void);
 void HandleWindowResize(int signal);
 void ConsolePutStr(char *Str);
+unsigned int ConsoleLinesPending(void);
+void ConsoleFlush(void);
+
+ConsoleSession *ConsoleSessionCreate(int InFd, int OutFd);
+void ConsoleSessionDestroy(ConsoleSession *Old);
+ConsoleSession *ConsoleSelectSession(ConsoleSession *New);
+int ConsoleInputFd(void);
+void CmdLineBegin(const char *Prompt, char *CmdLine, unsigned short Index,
+				  int isPassword);
+unsigned short CmdLinePoll(void);
+unsigned int ConsoleOutputPending(void);
+unsigned short ConsoleDrain(void);
+int ConsolePollTimeout(void);
+unsigned int ConsoleBlockLines(void);
+unsigned int ConsoleBlockLength(void);
+int ConsoleBlockLine(unsigned int Line, char *Buf, unsigned short Size);
+void ConsoleSetCompleter(ConsoleCompleter Fn);
+void ConsoleAddCompletion(ConsoleCompletions *Out, const char *Str);
+void ConsoleSetCompletionStart(ConsoleCompletions *Out, unsigned short Start);
+void ConsoleSetMatchMode(int Mode);
+int ConsoleGetMatchMode(void);
+void ConsoleHistoryAdd(const char *Line);
+int ConsoleHistoryShare(const char *Name);
+int ConsoleSetTerminal(const char *Name);
+int ConsoleSetSlowLink(int Mode);
+int ConsoleSetKeymap(const char *Name);
+int ConsoleBindKey(const char *Key, const char *Action);
+int ConsoleLoadKeymap(const char *Path);
+void ConsoleSetHighlight(int Mode, ConsoleCommandCheck Check);
+void ConsoleSetSuggest(int Mode);
+#ifdef REX_SELF_CHECK
+unsigned long ConsoleSelfCheckFailures(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+/*******************************************************************************
+* Module Name : keyboard_fuzzy.c
+* Description : Fuzzy (subsequence) matching and ranking of completion and
+*               history candidates, e.g. "shintbr" for "show interface brief"
+********************************************************************************/
+#include <ctype.h>
+#include <string.h>
+#include "keyboard_fuzzy.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Score weights */
+#define FUZZY_MATCH		16	/* every matched query char */
+#define FUZZY_WORD_START	10	/* match at the start of a word */
+#define FUZZY_CONSECUTIVE	6	/* match right after the previous one */
+#define FUZZY_GAP		1	/* every skipped char between matches */
+#define FUZZY_MAX_GAP		8	/* skipped chars counted per gap */
+
+/* ASCII only case folding, cheaper than the locale aware tolower() */
+#define FUZZY_LOWER(c)		((((c) >= 'A') && ((c) <= 'Z')) ? (c) + 32 : (c))
+
+/******************************************************************************
+* Function Name : FuzzyCharBit
+* Parameters    : [in] ch - character
+* Description   : Maps a character to its bit in a candidate mask. Letters
+*                 are case folded; other characters share the upper bits.
+* Return Value  : the bit
+******************************************************************************/
+
+static inline uint64_t FuzzyCharBit(unsigned char ch)
+{
+	ch = FUZZY_LOWER(ch);
+	if ((ch >= 'a') && (ch <= 'z'))
+		return (uint64_t)1 << (ch - 'a');
+	if ((ch >= '0') && (ch <= '9'))
+		return (uint64_t)1 << (26 + ch - '0');
+	return (uint64_t)1 << (36 + ch % 28);
+}
+
+/******************************************************************************
+* Function Name : FuzzyMask
+* Parameters    : [in] Str - string
+*                 [in] Len - length of the string
+* Description   : Gives the set of character classes present in Str. A
+*                 candidate can only match a query whose mask is a subset.
+* Return Value  : the mask
+******************************************************************************/
+
+uint64_t FuzzyMask(const char *Str, unsigned int Len)
+{
+	uint64_t Mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < Len; i++)
+		Mask |= FuzzyCharBit((unsigned char)Str[i]);
+	return Mask;
+}
+
+/******************************************************************************
+* Function Name : FuzzySetPrepare
+* Parameters    : [in] Set - candidates with Str, Len and Count filled in
+* Description   : Computes the mask of every candidate, once per set
+* Return Value  : NULL
+******************************************************************************/
+
+void FuzzySetPrepare(FuzzySet *Set)
+{
+	unsigned int i;
+
+	for (i = 0; i < Set->Count; i++)
+		Set->Mask[i] = FuzzyMask(Set->Str[i], Set->Len[i]);
+}
+
+/******************************************************************************
+* Function Name : FuzzyFilterAll
+* Parameters    : [in] Mask - candidate masks
+*                 [in] Count - number of candidates
+*                 [in] Query - mask of the query
+*                 [out] Out - indexes of the candidates passing the filter
+* Description   : Keeps the candidates holding every character class of the
+*                 query. Two masks are tested per SSE2 instruction.
+* Return Value  : number of indexes written to Out
+******************************************************************************/
+
+static unsigned int FuzzyFilterAll(const uint64_t *Mask, unsigned int Count,
+								   uint64_t Query, unsigned int *Out)
+{
+	unsigned int i = 0, n = 0;
+
+#if defined(__SSE2__)
+	__m128i q = _mm_set1_epi64x((long long)Query);
+	__m128i m, eq;
+	int bits;
+
+	for (; i + 2 <= Count; i += 2)
+	{
+		m = _mm_loadu_si128((const __m128i *)&Mask[i]);
+		eq = _mm_cmpeq_epi32(_mm_and_si128(m, q), q);
+		bits = _mm_movemask_epi8(eq);
+		// a 64 bit lane passes when both of its 32 bit halves compare equal
+		Out[n] = i;
+		n += ((bits & 0x00FF) == 0x00FF);
+		Out[n] = i + 1;
+		n += ((bits & 0xFF00) == 0xFF00);
+	}
+#endif
+	for (; i < Count; i++)
+	{
+		Out[n] = i;
+		n += ((Mask[i] & Query) == Query);
+	}
+	return n;
+}
+
+/******************************************************************************
+* Function Name : FuzzyScore
+* Parameters    : [in] Query - characters to find, in order
+*                 [in] QueryLen - length of the query
+*                 [in] Str - candidate
+*                 [in] Len - length of the candidate
+* Description   : Matches the query as a case insensitive subsequence of the
+*                 candidate and scores the alignment: matches at word starts
+*                 and runs of consecutive matches score up, gaps score down
+* Return Value  : the score, -1 if the query is not a subsequence
+******************************************************************************/
+
+int FuzzyScore(const char *Query, unsigned int QueryLen,
+			   const char *Str, unsigned int Len)
+{
+	unsigned int q = 0, i, Last = 0, Gap;
+	int Score = 0;
+	unsigned char qc, sc, prev;
+
+	if (QueryLen == 0)
+		return 0;
+	qc = FUZZY_LOWER((unsigned char)Query[0]);
+	for (i = 0; i < Len; i++)
+	{
+		sc = FUZZY_LOWER((unsigned char)Str[i]);
+		if (qc != sc)
+			continue;
+
+		Score += FUZZY_MATCH;
+		prev = i ? (unsigned char)Str[i - 1] : ' ';
+		if (!isalnum(prev))
+			Score += FUZZY_WORD_START;
+		if (q && (i == Last + 1))
+		{
+			Score += FUZZY_CONSECUTIVE;
+		}
+		else if (q)
+		{
+			Gap = i - Last - 1;
+			Score -= FUZZY_GAP * (Gap < FUZZY_MAX_GAP ? Gap : FUZZY_MAX_GAP);
+		}
+		Last = i;
+		if (++q == QueryLen)
+			break;
+		qc = FUZZY_LOWER((unsigned char)Query[q]);
+	}
+	if (q < QueryLen)
+		return -1;
+
+	// prefer the shorter of two otherwise equal candidates
+	return Score - (int)(Len >> 3);
+}
+
+/******************************************************************************
+* Function Name : FuzzyTopInsert
+* Parameters    : [in] St - ranking state
+*                 [in] Idx - candidate index
+*                 [in] Score - its score
+* Description   : Keeps the FUZZY_TOP_K best candidates sorted, best first.
+*                 On equal scores the earlier candidate stays ahead.
+* Return Value  : NULL
+******************************************************************************/
+
+static void FuzzyTopInsert(FuzzyState *St, unsigned int Idx, int Score)
+{
+	unsigned int Pos = St->TopCount;
+
+	if ((Pos == FUZZY_TOP_K) && (Score <= St->TopScore[FUZZY_TOP_K - 1]))
+		return;
+	if (Pos == FUZZY_TOP_K)
+		Pos--;
+	while (Pos && (St->TopScore[Pos - 1] < Score))
+	{
+		St->Top[Pos] = St->Top[Pos - 1];
+		St->TopScore[Pos] = St->TopScore[Pos - 1];
+		Pos--;
+	}
+	St->Top[Pos] = Idx;
+	St->TopScore[Pos] = Score;
+	if (St->TopCount < FUZZY_TOP_K)
+		St->TopCount++;
+}
+
+/******************************************************************************
+* Function Name : FuzzyRank
+* Parameters    : [in] Set - prepared candidates
+*                 [in] St - state from the previous call on the same set
+*                 [in] Query - query text
+*                 [in] QueryLen - length of the query
+* Description   : Ranks the candidates matching Query into St->Top. If the
+*                 query extends the previous one only the previous matches
+*                 are scored again, otherwise the whole set is prefiltered.
+* Return Value  : number of matching candidates
+******************************************************************************/
+
+unsigned int FuzzyRank(const FuzzySet *Set, FuzzyState *St,
+					   const char *Query, unsigned int QueryLen)
+{
+	unsigned int i, n = 0;
+	int Score;
+
+	if (QueryLen > FUZZY_MAX_QUERY)
+		QueryLen = FUZZY_MAX_QUERY;
+
+	if (!St->Valid || (QueryLen < St->QueryLen) ||
+		memcmp(Query, St->Query, St->QueryLen))
+	{
+		St->AliveCount = FuzzyFilterAll(Set->Mask, Set->Count,
+										FuzzyMask(Query, QueryLen), St->Alive);
+	}
+
+	St->TopCount = 0;
+	for (i = 0; i < St->AliveCount; i++)
+	{
+		Score = FuzzyScore(Query, QueryLen,
+						   Set->Str[St->Alive[i]], Set->Len[St->Alive[i]]);
+		if (Score < 0)
+			continue;
+		// compact in place, the survivors are the next call's input
+		St->Alive[n++] = St->Alive[i];
+		FuzzyTopInsert(St, St->Alive[i], Score);
+	}
+	St->AliveCount = n;
+
+	memcpy(St->Query, Query, QueryLen);
+	St->QueryLen = QueryLen;
+	St->Valid = 1;
+	return n;
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+* Module Name : keyboard_fuzzy.h
+* Description : Contains function declarations for keyboard_fuzzy.c
+*******************************************************************************/
+#ifndef _KEYBOARD_FUZZY_
+#define _KEYBOARD_FUZZY_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of ranked results kept by FuzzyRank
+#define FUZZY_TOP_K		64
+#define FUZZY_MAX_QUERY		64
+
+/*
+ Candidates to be matched, kept as parallel arrays so the mask prefilter
+ streams through contiguous memory. Mask is filled by FuzzySetPrepare.
+*/
+typedef struct FuzzySet
+{
+	const char **Str;
+	unsigned short *Len;
+	uint64_t *Mask;
+	unsigned int Count;
+} FuzzySet;
+
+/*
+ Matching state carried from one key stroke to the next. Alive holds the
+ indexes of every candidate matching Query; when the query is extended
+ only those are looked at again.
+*/
+typedef struct FuzzyState
+{
+	char Query[FUZZY_MAX_QUERY];
+	unsigned int QueryLen;
+	unsigned int *Alive;		// room for FuzzySet.Count entries
+	unsigned int AliveCount;
+	int Valid;			// Alive matches Query
+	unsigned int Top[FUZZY_TOP_K];	// best first
+	int TopScore[FUZZY_TOP_K];
+	unsigned int TopCount;
+} FuzzyState;
+
+uint64_t FuzzyMask(const char *Str, unsigned int Len);
+void FuzzySetPrepare(FuzzySet *Set);
+int FuzzyScore(const char *Query, unsigned int QueryLen,
+			   const char *Str, unsigned int Len);
+unsigned int FuzzyRank(const FuzzySet *Set, FuzzyState *St,
+					   const char *Query, unsigned int QueryLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
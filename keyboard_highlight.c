@@ -0,0 +1,186 @@
+/*******************************************************************************
+* Module Name : keyboard_highlight.c
+* Description : Syntax highlighting of the command line. A small shell-like
+*               lexer styles each word as a command, an argument, an option
+*               or a quoted string and keeps its state before every char,
+*               so an edit is only lexed again around where it happened.
+********************************************************************************/
+#include <string.h>
+#include "keyboard_highlight.h"
+
+/* Lexer state bits */
+#define HS_WORD		0x01	/* inside a word */
+#define HS_SQUOTE	0x02	/* inside '...' */
+#define HS_DQUOTE	0x04	/* inside "..." */
+#define HS_ESCAPE	0x08	/* right after a backslash */
+#define HS_ARGS		0x10	/* the command word was seen */
+
+#define HS_QUOTE	(HS_SQUOTE | HS_DQUOTE)
+
+/******************************************************************************
+* Function Name : HighlightReset
+* Parameters    : [in] H - line styles
+* Description   : Starts styling an empty line
+* Return Value  : NULL
+******************************************************************************/
+
+void HighlightReset(HighlightLine *H)
+{
+	H->Len = 0;
+	H->State[0] = 0;
+}
+
+/******************************************************************************
+* Function Name : HighlightWord
+* Parameters    : [in] H - line styles
+*                 [in] Text - the line
+*                 [in] Start - index of the first char of the word
+*                 [in] End - index just past its last char
+*                 [in] Check - command check, NULL to take any word
+* Description   : Styles a word once its end is known. Quoted parts are
+*                 strings whatever the word is, the rest follows from the
+*                 word's place in the command.
+* Return Value  : NULL
+******************************************************************************/
+
+static void HighlightWord(HighlightLine *H, const char *Text,
+						  unsigned short Start, unsigned short End,
+						  HighlightCheck Check)
+{
+	unsigned char Style;
+	unsigned short i;
+
+	if (!(H->State[Start] & HS_ARGS))
+		Style = ((Check == NULL) || Check(&Text[Start], End - Start)) ? HL_COMMAND
+																	  : HL_ERROR;
+	else
+		Style = (Text[Start] == '-') ? HL_OPTION : HL_ARGUMENT;
+
+	for (i = Start; i < End; i++)
+	{
+		// a quote char has the quoted text on one side of it
+		H->Style[i] = ((H->State[i] | H->State[i + 1]) & HS_QUOTE) ? HL_STRING
+																   : Style;
+	}
+}
+
+/******************************************************************************
+* Function Name : HighlightEdit
+* Parameters    : [in] H - line styles, as they were before the edit
+*                 [in] Text - the line, already edited
+*                 [in] Pos - index where the edit happened
+*                 [in] Removed - chars taken out at Pos
+*                 [in] Added - chars put in at Pos instead
+*                 [in] Check - command check, NULL to take any first word
+*                 [out] To - index just past the last style that may differ
+* Description   : Brings the styles up to date after an edit. The styles
+*                 after the edit move along with their chars; the line is
+*                 lexed again from the start of the word the edit is in up
+*                 to the first word boundary past the edit where the lexer
+*                 is in the same state it was in before.
+* Return Value  : index of the first style that may differ
+******************************************************************************/
+
+unsigned short HighlightEdit(HighlightLine *H, const char *Text,
+							 unsigned short Pos, unsigned short Removed,
+							 unsigned short Added, HighlightCheck Check,
+							 unsigned short *To)
+{
+	unsigned short Len = H->Len - Removed + Added;
+	unsigned short From = Pos, Word = 0, Quote = 0, i;
+	unsigned char St;
+
+	while ((From > 0) && (H->State[From] & HS_WORD))
+		From--;
+	St = H->State[From];
+
+	memmove(&H->Style[Pos + Added], &H->Style[Pos + Removed],
+			H->Len - Pos - Removed);
+	memmove(&H->State[Pos + Added], &H->State[Pos + Removed],
+			H->Len - Pos - Removed + 1);
+	H->Len = Len;
+
+	for (i = From; i < Len; i++)
+	{
+		// the old state was before the same chars, the rest is unchanged
+		if ((i >= Pos + Added) && !(St & HS_WORD) && (St == H->State[i]))
+		{
+			*To = i;
+			return From;
+		}
+		H->State[i] = St;
+
+		if (St & HS_ESCAPE)
+		{
+			St &= ~HS_ESCAPE;
+			continue;
+		}
+		if (St & HS_SQUOTE)
+		{
+			if (Text[i] == '\'')
+				St &= ~HS_SQUOTE;
+			continue;
+		}
+		if (St & HS_DQUOTE)
+		{
+			if (Text[i] == '"')
+				St &= ~HS_DQUOTE;
+			else if (Text[i] == '\\')
+				St |= HS_ESCAPE;
+			continue;
+		}
+
+		switch (Text[i])
+		{
+		case ' ':
+		case '\t':
+		case '|':
+		case ';':
+		case '&':
+		case '<':
+		case '>':
+			if (St & HS_WORD)
+			{
+				HighlightWord(H, Text, Word, i, Check);
+				St = (St & ~HS_WORD) | HS_ARGS;
+			}
+			if ((Text[i] == ' ') || (Text[i] == '\t'))
+			{
+				H->Style[i] = HL_PLAIN;
+				break;
+			}
+			H->Style[i] = HL_OPERATOR;
+			// the next word starts a new command, except after a redirection
+			if ((Text[i] != '<') && (Text[i] != '>'))
+				St &= ~HS_ARGS;
+			break;
+
+		default:
+			if (!(St & HS_WORD))
+			{
+				St |= HS_WORD;
+				Word = i;
+			}
+			if ((Text[i] == '\'') || (Text[i] == '"'))
+			{
+				St |= (Text[i] == '\'') ? HS_SQUOTE : HS_DQUOTE;
+				Quote = i;
+			}
+			else if (Text[i] == '\\')
+			{
+				St |= HS_ESCAPE;
+			}
+			break;
+		}
+	}
+
+	H->State[Len] = St;
+	if (St & HS_WORD)
+	{
+		HighlightWord(H, Text, Word, Len, Check);
+		if (St & HS_QUOTE)
+			H->Style[Quote] = HL_ERROR;
+	}
+	*To = Len;
+	return From;
+}
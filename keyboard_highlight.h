@@ -0,0 +1,54 @@
+/*******************************************************************************
+* Module Name : keyboard_highlight.h
+* Description : Contains function declarations for keyboard_highlight.c
+*******************************************************************************/
+#ifndef _KEYBOARD_HIGHLIGHT_
+#define _KEYBOARD_HIGHLIGHT_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest line styled, at least MAX_CMD_SIZE
+#define HIGHLIGHT_MAX_LINE	256
+
+/* Styles a char of the line is shown in */
+enum
+{
+	HL_PLAIN,		/* blanks */
+	HL_COMMAND,		/* first word of a command */
+	HL_ARGUMENT,		/* any other word */
+	HL_OPTION,		/* argument starting with '-' */
+	HL_STRING,		/* quoted text, quotes included */
+	HL_OPERATOR,		/* | ; & < > */
+	HL_ERROR,		/* unknown command, unmatched quote */
+	HL_COUNT
+};
+
+/* Tells whether the Len chars at Word name a command */
+typedef int (*HighlightCheck)(const char *Word, unsigned short Len);
+
+/*
+ Styles of a line together with the lexer state before each char. After
+ an edit the line is only lexed again from the start of the word the edit
+ falls in up to the first word boundary past it where the state is the
+ same as before the edit; from there on nothing can have changed.
+*/
+typedef struct HighlightLine
+{
+	unsigned char Style[HIGHLIGHT_MAX_LINE];
+	unsigned char State[HIGHLIGHT_MAX_LINE + 1];
+	unsigned short Len;
+} HighlightLine;
+
+void HighlightReset(HighlightLine *H);
+unsigned short HighlightEdit(HighlightLine *H, const char *Text,
+							 unsigned short Pos, unsigned short Removed,
+							 unsigned short Added, HighlightCheck Check,
+							 unsigned short *To);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+/*******************************************************************************
+* Module Name : keyboard_history.c
+* Description : Command history shared by every process on the host through
+*               a POSIX shared memory segment.
+*
+*               The segment is a ring of fixed size slots. A writer takes a
+*               ticket with one atomic add; the ticket picks the slot. Each
+*               slot carries a sequence word that is odd while the slot is
+*               written and 2 * (ticket + 1) once it is complete, plus a
+*               hash of the text. Readers copy a slot and keep it only if
+*               the sequence was the expected even value before and after
+*               the copy and the hash matches, so they never wait for a
+*               writer. A writer dying half way leaves an odd sequence or a
+*               bad hash behind, which readers skip, and the next lap of the
+*               ring overwrites the slot.
+********************************************************************************/
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "keyboard_history.h"
+
+#define SHM_HISTORY_MAGIC	0x4B424831u	/* "KBH1" */
+
+typedef struct ShmHistorySlot
+{
+	_Atomic uint64_t Seq;
+	uint32_t Hash;
+	uint16_t Len;
+	char Text[SHM_HISTORY_LINE];
+} ShmHistorySlot;
+
+typedef struct ShmHistorySegment
+{
+	_Atomic uint32_t Magic;
+	uint32_t Slots;
+	uint32_t SlotSize;
+	_Atomic uint64_t Next;		// next ticket to hand out
+	ShmHistorySlot Slot[SHM_HISTORY_SLOTS];
+} ShmHistorySegment;
+
+struct ShmHistory
+{
+	ShmHistorySegment *Seg;
+};
+
+/******************************************************************************
+* Function Name : ShmHistoryHash
+* Parameters    : [in] Text - entry text
+*                 [in] Len - length of the text
+*                 [in] Ticket - ticket of the entry
+* Description   : FNV-1a hash of an entry, seeded with its ticket so a stale
+*                 copy from an older lap never validates
+* Return Value  : the hash
+******************************************************************************/
+
+static uint32_t ShmHistoryHash(const char *Text, unsigned int Len, uint64_t Ticket)
+{
+	uint32_t Hash = 2166136261u ^ (uint32_t)Ticket;
+
+	while (Len--)
+	{
+		Hash ^= (unsigned char)*Text++;
+		Hash *= 16777619u;
+	}
+	return Hash;
+}
+
+/******************************************************************************
+* Function Name : ShmHistoryOpen
+* Parameters    : [in] Name - shared memory object name, e.g. "/rex_history"
+* Description   : Maps the shared history segment, creating it zero filled
+*                 (which is a valid empty history) if it does not exist yet
+* Return Value  : the handle, NULL on failure or layout mismatch
+******************************************************************************/
+
+ShmHistory *ShmHistoryOpen(const char *Name)
+{
+	ShmHistory *H;
+	ShmHistorySegment *Seg;
+	struct stat St;
+	uint32_t Expected = 0;
+	int fd;
+
+	fd = shm_open(Name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return NULL;
+
+	// only grows a new (empty) object, an existing one keeps its contents
+	if ((fstat(fd, &St) < 0) ||
+		((St.st_size < (off_t)sizeof(ShmHistorySegment)) &&
+		 (ftruncate(fd, sizeof(ShmHistorySegment)) < 0)))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	Seg = mmap(NULL, sizeof(ShmHistorySegment), PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+	close(fd);
+	if (Seg == MAP_FAILED)
+		return NULL;
+
+	// first one in stamps the layout, everybody else checks it
+	if (atomic_compare_exchange_strong(&Seg->Magic, &Expected, SHM_HISTORY_MAGIC))
+	{
+		Seg->Slots = SHM_HISTORY_SLOTS;
+		Seg->SlotSize = sizeof(ShmHistorySlot);
+	}
+	else if ((Expected != SHM_HISTORY_MAGIC) ||
+			 ((Seg->Slots != 0) &&
+			  ((Seg->Slots != SHM_HISTORY_SLOTS) ||
+			   (Seg->SlotSize != sizeof(ShmHistorySlot)))))
+	{
+		munmap(Seg, sizeof(ShmHistorySegment));
+		return NULL;
+	}
+
+	H = malloc(sizeof(ShmHistory));
+	if (H == NULL)
+	{
+		munmap(Seg, sizeof(ShmHistorySegment));
+		return NULL;
+	}
+	H->Seg = Seg;
+	return H;
+}
+
+/******************************************************************************
+* Function Name : ShmHistoryClose
+* Parameters    : [in] H - handle from ShmHistoryOpen
+* Description   : Unmaps the segment. The history stays for other processes.
+* Return Value  : NULL
+******************************************************************************/
+
+void ShmHistoryClose(ShmHistory *H)
+{
+	if (H == NULL)
+		return;
+	munmap(H->Seg, sizeof(ShmHistorySegment));
+	free(H);
+}
+
+/******************************************************************************
+* Function Name : ShmHistoryAppend
+* Parameters    : [in] H - shared history
+*                 [in] Line - line to append, cut at SHM_HISTORY_LINE - 1
+* Description   : Appends a line without taking any lock
+* Return Value  : 0 on success, -1 if a newer writer took the slot first
+******************************************************************************/
+
+int ShmHistoryAppend(ShmHistory *H, const char *Line)
+{
+	ShmHistorySlot *Slot;
+	uint64_t Ticket, Busy;
+	size_t Len = strlen(Line);
+
+	if (Len > SHM_HISTORY_LINE - 1)
+		Len = SHM_HISTORY_LINE - 1;
+
+	Ticket = atomic_fetch_add_explicit(&H->Seg->Next, 1, memory_order_relaxed);
+	Slot = &H->Seg->Slot[Ticket & (SHM_HISTORY_SLOTS - 1)];
+
+	// mark the slot busy before touching the text
+	Busy = 2 * Ticket + 1;
+	atomic_store_explicit(&Slot->Seq, Busy, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy(Slot->Text, Line, Len);
+	Slot->Text[Len] = 0;
+	Slot->Len = (uint16_t)Len;
+	Slot->Hash = ShmHistoryHash(Slot->Text, Len, Ticket);
+
+	// publish, unless a writer a whole lap ahead has taken over the slot
+	if (!atomic_compare_exchange_strong_explicit(&Slot->Seq, &Busy,
+												 2 * Ticket + 2,
+												 memory_order_release,
+												 memory_order_relaxed))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : ShmHistoryNext
+* Parameters    : [in] H - shared history
+* Description   : Gives the ticket the next append will get. Entries have
+*                 the tickets below it; the last SHM_HISTORY_SLOTS of them
+*                 may still be readable.
+* Return Value  : the ticket
+******************************************************************************/
+
+uint64_t ShmHistoryNext(ShmHistory *H)
+{
+	return atomic_load_explicit(&H->Seg->Next, memory_order_acquire);
+}
+
+/******************************************************************************
+* Function Name : ShmHistoryRead
+* Parameters    : [in] H - shared history
+*                 [in] Ticket - entry to read
+*                 [out] Buf - SHM_HISTORY_LINE bytes for the line
+* Description   : Copies one entry out of the ring, validating it against
+*                 concurrent and crashed writers
+* Return Value  : length of the line, SHM_HISTORY_BUSY or SHM_HISTORY_GONE
+******************************************************************************/
+
+int ShmHistoryRead(ShmHistory *H, uint64_t Ticket, char *Buf)
+{
+	ShmHistorySlot *Slot = &H->Seg->Slot[Ticket & (SHM_HISTORY_SLOTS - 1)];
+	uint64_t Seq, Done = 2 * Ticket + 2;
+	unsigned int Len;
+	uint32_t Hash;
+
+	Seq = atomic_load_explicit(&Slot->Seq, memory_order_acquire);
+	if (Seq != Done)
+		return (Seq > Done) ? SHM_HISTORY_GONE : SHM_HISTORY_BUSY;
+
+	Len = Slot->Len;
+	if (Len > SHM_HISTORY_LINE - 1)
+		return SHM_HISTORY_BUSY;
+	memcpy(Buf, Slot->Text, Len);
+	Buf[Len] = 0;
+	Hash = Slot->Hash;
+
+	atomic_thread_fence(memory_order_acquire);
+	Seq = atomic_load_explicit(&Slot->Seq, memory_order_relaxed);
+	if (Seq != Done)
+		return (Seq > Done) ? SHM_HISTORY_GONE : SHM_HISTORY_BUSY;
+	if (Hash != ShmHistoryHash(Buf, Len, Ticket))
+		return SHM_HISTORY_BUSY;
+	return (int)Len;
+}
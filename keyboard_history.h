@@ -0,0 +1,35 @@
+/*******************************************************************************
+* Module Name : keyboard_history.h
+* Description : Contains function declarations for keyboard_history.c
+*******************************************************************************/
+#ifndef _KEYBOARD_HISTORY_
+#define _KEYBOARD_HISTORY_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Entries kept in a shared history segment (power of 2)
+#define SHM_HISTORY_SLOTS	4096
+// Longest line stored, including the terminating NUL
+#define SHM_HISTORY_LINE	256
+
+/* ShmHistoryRead results besides a length */
+#define SHM_HISTORY_BUSY	-1	/* being written, or its writer died */
+#define SHM_HISTORY_GONE	-2	/* overwritten by a newer entry */
+
+typedef struct ShmHistory ShmHistory;
+
+ShmHistory *ShmHistoryOpen(const char *Name);
+void ShmHistoryClose(ShmHistory *H);
+int ShmHistoryAppend(ShmHistory *H, const char *Line);
+uint64_t ShmHistoryNext(ShmHistory *H);
+int ShmHistoryRead(ShmHistory *H, uint64_t Ticket, char *Buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,325 @@
+/*******************************************************************************
+* Module Name : keyboard_keymap.c
+* Description : Key bindings. A keymap is a list of key to action bindings,
+*               either built in or read from a file, compiled into a dense
+*               table indexed by the 16 bit key code so that dispatching a
+*               key costs the same however many keys are bound.
+********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "keyboard_driver.h"
+#include "keyboard_keymap.h"
+
+#define KEYMAP_LINE		128
+
+/* Action names, in KA_ order */
+static const char *const ActionNames[KA_COUNT] = {
+	"ding",
+	"self-insert",
+	"accept-line",
+	"complete",
+	"backward-char",
+	"forward-char",
+	"backward-word",
+	"forward-word",
+	"beginning-of-line",
+	"end-of-line",
+	"backward-delete-char",
+	"delete-char",
+	"kill-line",
+	"unix-line-discard",
+	"unix-word-rubout",
+	"discard-line",
+	"previous-history",
+	"next-history",
+	"reverse-search-history",
+	"clear-screen",
+	"undo",
+	"redo",
+};
+
+/* Key names besides C-x, M-x, single chars and numbers */
+static const struct
+{
+	const char *Name;
+	unsigned short Key;
+} KeyNames[] = {
+	{ "Up", REX_KEY_UP }, { "Down", REX_KEY_DOWN },
+	{ "Left", REX_KEY_LEFT }, { "Right", REX_KEY_RIGHT },
+	{ "Home", REX_KEY_HOME }, { "End", REX_KEY_END },
+	{ "Insert", REX_KEY_INS }, { "Delete", REX_KEY_DEL },
+	{ "PageUp", REX_KEY_PGUP }, { "PageDown", REX_KEY_PGDN },
+	{ "Tab", REX_KEY_TAB }, { "Return", REX_KEY_NEWLINE },
+	{ "Backspace", REX_KEY_BACKSPACE }, { "Rubout", REX_KEY_ASCII_DEL },
+	{ "Escape", REX_KEY_ESCAPE }, { "Space", REX_KEY_SPACE },
+	{ "F1", REX_KEY_F1 }, { "F2", REX_KEY_F2 }, { "F3", REX_KEY_F3 },
+	{ "F4", REX_KEY_F4 }, { "F5", REX_KEY_F5 }, { "F6", REX_KEY_F6 },
+	{ "F7", REX_KEY_F7 }, { "F8", REX_KEY_F8 }, { "F9", REX_KEY_F9 },
+	{ "F10", REX_KEY_F10 }, { "F11", REX_KEY_F11 }, { "F12", REX_KEY_F12 },
+};
+
+/* A range of keys bound to one action */
+typedef struct KeyBinding
+{
+	unsigned short First;
+	unsigned short Last;
+	unsigned char Action;
+} KeyBinding;
+
+/* The keys GetCmdLine has always understood */
+static const KeyBinding MinimalBindings[] = {
+	{ ' ', '~', KA_SELF_INSERT },
+	{ REX_KEY_NEWLINE, REX_KEY_NEWLINE, KA_ACCEPT_LINE },
+	{ REX_KEY_TAB, REX_KEY_TAB, KA_COMPLETE },
+	{ REX_KEY_BACKSPACE, REX_KEY_BACKSPACE, KA_BACKWARD_DELETE_CHAR },
+	{ SSH_BACKSPACE, SSH_BACKSPACE, KA_BACKWARD_DELETE_CHAR },
+	{ REX_KEY_DEL, REX_KEY_DEL, KA_DELETE_CHAR },
+	{ REX_KEY_LEFT, REX_KEY_LEFT, KA_BACKWARD_CHAR },
+	{ REX_KEY_RIGHT, REX_KEY_RIGHT, KA_FORWARD_CHAR },
+	{ REX_KEY_HOME, REX_KEY_HOME, KA_BEGINNING_OF_LINE },
+	{ REX_KEY_END, REX_KEY_END, KA_END_OF_LINE },
+	{ REX_KEY_UP, REX_KEY_UP, KA_PREVIOUS_HISTORY },
+	{ REX_KEY_DOWN, REX_KEY_DOWN, KA_NEXT_HISTORY },
+	{ REX_KEY_ESCAPE, REX_KEY_ESCAPE, KA_DISCARD_LINE },
+	{ REX_KEY_CTRL_R, REX_KEY_CTRL_R, KA_SEARCH_HISTORY },
+};
+
+/* Added on top of the minimal keymap */
+static const KeyBinding EmacsBindings[] = {
+	{ REX_KEY_RETURN, REX_KEY_RETURN, KA_ACCEPT_LINE },
+	{ REX_KEY_CTRL('a'), REX_KEY_CTRL('a'), KA_BEGINNING_OF_LINE },
+	{ REX_KEY_CTRL('e'), REX_KEY_CTRL('e'), KA_END_OF_LINE },
+	{ REX_KEY_CTRL('b'), REX_KEY_CTRL('b'), KA_BACKWARD_CHAR },
+	{ REX_KEY_CTRL('f'), REX_KEY_CTRL('f'), KA_FORWARD_CHAR },
+	{ REX_KEY_CTRL('d'), REX_KEY_CTRL('d'), KA_DELETE_CHAR },
+	{ REX_KEY_CTRL('k'), REX_KEY_CTRL('k'), KA_KILL_LINE },
+	{ REX_KEY_CTRL('u'), REX_KEY_CTRL('u'), KA_UNIX_LINE_DISCARD },
+	{ REX_KEY_CTRL('w'), REX_KEY_CTRL('w'), KA_UNIX_WORD_RUBOUT },
+	{ REX_KEY_CTRL('l'), REX_KEY_CTRL('l'), KA_CLEAR_SCREEN },
+	{ REX_KEY_CTRL('p'), REX_KEY_CTRL('p'), KA_PREVIOUS_HISTORY },
+	{ REX_KEY_CTRL('n'), REX_KEY_CTRL('n'), KA_NEXT_HISTORY },
+	{ REX_KEY_CTRL('_'), REX_KEY_CTRL('_'), KA_UNDO },
+	{ REX_KEY_META('_'), REX_KEY_META('_'), KA_REDO },
+	{ REX_KEY_META('b'), REX_KEY_META('b'), KA_BACKWARD_WORD },
+	{ REX_KEY_META('f'), REX_KEY_META('f'), KA_FORWARD_WORD },
+	{ REX_KEY_META('B'), REX_KEY_META('B'), KA_BACKWARD_WORD },
+	{ REX_KEY_META('F'), REX_KEY_META('F'), KA_FORWARD_WORD },
+};
+
+/* Built-in keymaps, each compiled the first time it is asked for */
+static struct
+{
+	const char *Name;
+	const KeyBinding *Bindings;
+	unsigned int Count;
+	int Base;			// keymap it adds to, -1 for none
+	int Ready;
+	KeyMap Map;
+} Builtins[] = {
+	{ "minimal", MinimalBindings,
+	  sizeof(MinimalBindings) / sizeof(MinimalBindings[0]), -1,
+	  0, { { 0 }, { { 0 } } } },
+	{ "emacs", EmacsBindings,
+	  sizeof(EmacsBindings) / sizeof(EmacsBindings[0]), 0,
+	  0, { { 0 }, { { 0 } } } },
+};
+
+/******************************************************************************
+* Function Name : KeyMapClear
+* Parameters    : [out] Map - keymap to set up
+* Description   : Sets up the page index and unbinds every key
+* Return Value  : NULL
+******************************************************************************/
+
+static void KeyMapClear(KeyMap *Map)
+{
+	memset(Map, 0, sizeof(KeyMap));
+	Map->Page[0x00] = 1;
+	Map->Page[0xFE] = 2;
+	Map->Page[0xFF] = 3;
+}
+
+/******************************************************************************
+* Function Name : KeyMapCompile
+* Parameters    : [in] Map - keymap to add to
+*                 [in] Bindings - key ranges to bind
+*                 [in] Count - number of ranges
+* Description   : Writes bindings into the dense table
+* Return Value  : NULL
+******************************************************************************/
+
+static void KeyMapCompile(KeyMap *Map, const KeyBinding *Bindings, unsigned int Count)
+{
+	unsigned int i, Key;
+
+	for (i = 0; i < Count; i++)
+	{
+		for (Key = Bindings[i].First; Key <= Bindings[i].Last; Key++)
+		{
+			KEYMAP_ACTION(Map, Key) = Bindings[i].Action;
+		}
+	}
+}
+
+/******************************************************************************
+* Function Name : KeyMapBuiltin
+* Parameters    : [in] Name - "emacs" or "minimal"
+* Description   : Gives a built-in keymap, compiling it on first use
+* Return Value  : the keymap, NULL if there is none of that name
+******************************************************************************/
+
+const KeyMap *KeyMapBuiltin(const char *Name)
+{
+	unsigned int i;
+	int Base;
+
+	for (i = 0; i < sizeof(Builtins) / sizeof(Builtins[0]); i++)
+	{
+		if (strcmp(Builtins[i].Name, Name))
+			continue;
+		if (!Builtins[i].Ready)
+		{
+			Base = Builtins[i].Base;
+			if (Base >= 0)
+				memcpy(&Builtins[i].Map, KeyMapBuiltin(Builtins[Base].Name),
+					   sizeof(KeyMap));
+			else
+				KeyMapClear(&Builtins[i].Map);
+			KeyMapCompile(&Builtins[i].Map, Builtins[i].Bindings,
+						  Builtins[i].Count);
+			Builtins[i].Ready = 1;
+		}
+		return &Builtins[i].Map;
+	}
+	return NULL;
+}
+
+/******************************************************************************
+* Function Name : KeyMapKey
+* Parameters    : [in] Name - key name: C-x, M-x, a single char, a name
+*                               such as Up or F1, or a number like 0xFF20
+*                 [out] Key - the key code
+* Description   : Parses a key name
+* Return Value  : 0 on success, -1 if the name is not understood
+******************************************************************************/
+
+static int KeyMapKey(const char *Name, unsigned int *Key)
+{
+	unsigned int i;
+	char *End;
+
+	if (!strncmp(Name, "M-", 2) && Name[2])
+	{
+		if (KeyMapKey(Name + 2, Key) || (*Key & 0xFF00))
+			return -1;
+		*Key = REX_KEY_META(*Key);
+		return 0;
+	}
+	if (!strncmp(Name, "C-", 2) && Name[2] && !Name[3])
+	{
+		if ((Name[2] < '@') || (tolower((unsigned char)Name[2]) > 'z'))
+			return -1;
+		*Key = REX_KEY_CTRL(Name[2]);
+		return 0;
+	}
+	if (Name[0] && !Name[1])
+	{
+		*Key = (unsigned char)Name[0];
+		return 0;
+	}
+	for (i = 0; i < sizeof(KeyNames) / sizeof(KeyNames[0]); i++)
+	{
+		if (!strcmp(KeyNames[i].Name, Name))
+		{
+			*Key = KeyNames[i].Key;
+			return 0;
+		}
+	}
+	if (isdigit((unsigned char)Name[0]))
+	{
+		*Key = (unsigned int)strtoul(Name, &End, 0);
+		if (!*End && (*Key <= 0xFFFF))
+			return 0;
+	}
+	return -1;
+}
+
+/******************************************************************************
+* Function Name : KeyMapBind
+* Parameters    : [in] Map - keymap to change
+*                 [in] Key - key name, see KeyMapKey
+*                 [in] Action - action name, e.g. "kill-line"
+* Description   : Binds one key. Binding "ding" unbinds it.
+* Return Value  : 0 on success, -1 if the key or action is not known
+******************************************************************************/
+
+int KeyMapBind(KeyMap *Map, const char *Key, const char *Action)
+{
+	unsigned int Code, i;
+
+	if (KeyMapKey(Key, &Code) || (Map->Page[Code >> 8] == 0))
+		return -1;
+	for (i = 0; i < KA_COUNT; i++)
+	{
+		if (!strcmp(ActionNames[i], Action))
+		{
+			KEYMAP_ACTION(Map, Code) = (unsigned char)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/******************************************************************************
+* Function Name : KeyMapRead
+* Parameters    : [in] Map - keymap to change
+*                 [in] Path - keymap file
+* Description   : Applies a keymap file. Each line holds a key name and an
+*                 action name, or "keymap emacs" / "keymap minimal" to start
+*                 over from a built-in keymap. Empty lines and lines
+*                 starting with # are skipped.
+* Return Value  : number of lines not understood, -1 if the file cannot be
+*                 read
+******************************************************************************/
+
+int KeyMapRead(KeyMap *Map, const char *Path)
+{
+	char Line[KEYMAP_LINE], Key[KEYMAP_LINE], Action[KEYMAP_LINE];
+	const KeyMap *Base;
+	FILE *f;
+	int Bad = 0;
+
+	f = fopen(Path, "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(Line, sizeof(Line), f))
+	{
+		switch (sscanf(Line, "%127s %127s", Key, Action))
+		{
+			case EOF:
+				continue;
+			case 2:
+				if (Key[0] == '#')
+					continue;
+				if (!strcmp(Key, "keymap"))
+				{
+					Base = KeyMapBuiltin(Action);
+					if (Base)
+						memcpy(Map, Base, sizeof(KeyMap));
+					else
+						Bad++;
+					continue;
+				}
+				if (KeyMapBind(Map, Key, Action))
+					Bad++;
+				continue;
+			default:
+				if (Key[0] != '#')
+					Bad++;
+		}
+	}
+	fclose(f);
+	return Bad;
+}
@@ -0,0 +1,66 @@
+/*******************************************************************************
+* Module Name : keyboard_keymap.h
+* Description : Contains function declarations for keyboard_keymap.c
+*******************************************************************************/
+#ifndef _KEYBOARD_KEYMAP_
+#define _KEYBOARD_KEYMAP_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Key pages with bindings: plain 0x00xx, meta 0xFExx and special 0xFFxx.
+// Page 0 of the table is never bound and catches every other key.
+#define KEYMAP_PAGES		4
+
+/* Bindable actions, named as in readline where it has them */
+enum
+{
+	KA_BELL,			/* ding, for unbound keys */
+	KA_SELF_INSERT,			/* self-insert */
+	KA_ACCEPT_LINE,			/* accept-line */
+	KA_COMPLETE,			/* complete */
+	KA_BACKWARD_CHAR,		/* backward-char */
+	KA_FORWARD_CHAR,		/* forward-char */
+	KA_BACKWARD_WORD,		/* backward-word */
+	KA_FORWARD_WORD,		/* forward-word */
+	KA_BEGINNING_OF_LINE,		/* beginning-of-line */
+	KA_END_OF_LINE,			/* end-of-line */
+	KA_BACKWARD_DELETE_CHAR,	/* backward-delete-char */
+	KA_DELETE_CHAR,			/* delete-char */
+	KA_KILL_LINE,			/* kill-line */
+	KA_UNIX_LINE_DISCARD,		/* unix-line-discard */
+	KA_UNIX_WORD_RUBOUT,		/* unix-word-rubout */
+	KA_DISCARD_LINE,		/* discard-line */
+	KA_PREVIOUS_HISTORY,		/* previous-history */
+	KA_NEXT_HISTORY,		/* next-history */
+	KA_SEARCH_HISTORY,		/* reverse-search-history */
+	KA_CLEAR_SCREEN,		/* clear-screen */
+	KA_UNDO,			/* undo */
+	KA_REDO,			/* redo */
+	KA_COUNT
+};
+
+/*
+ Compiled key bindings. The high byte of a key code selects one of the
+ pages through Page, the low byte the action within it, so a lookup is two
+ loads however many keys are bound.
+*/
+typedef struct KeyMap
+{
+	unsigned char Page[256];
+	unsigned char Action[KEYMAP_PAGES][256];
+} KeyMap;
+
+#define KEYMAP_ACTION(Map, Key) \
+	((Map)->Action[(Map)->Page[((Key) >> 8) & 0xFF]][(Key) & 0xFF])
+
+const KeyMap *KeyMapBuiltin(const char *Name);
+int KeyMapBind(KeyMap *Map, const char *Key, const char *Action);
+int KeyMapRead(KeyMap *Map, const char *Path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,515 @@
+/*******************************************************************************
+* Module Name : keyboard_path.c
+* Description : File system path completion for the Tab key.
+*
+*               Sorted listings of the directories completed in are cached
+*               for the whole process, keyed on the device and inode of the
+*               directory. An inotify watch on each cached directory keeps
+*               its listing valid: the events queued since the last Tab are
+*               read before a listing is used, and a directory whose names
+*               changed is scanned again instead of on every Tab. Where no
+*               watch can be set, the modification time is compared.
+*
+*               Directories are scanned on a thread of their own and Tab
+*               waits for a scan at most PATH_SCAN_WAIT_MS, so a directory
+*               of tens of thousands of entries does not hold the prompt
+*               up; a later Tab finds its listing ready.
+********************************************************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "keyboard_path.h"
+
+/* States of a cached directory */
+#define PD_EMPTY	0	/* no listing */
+#define PD_SCANNING	1	/* being read by a scan thread */
+#define PD_READY	2	/* listing valid up to the events read last */
+
+// Events telling the names in a directory changed or it went away
+#define PATH_WATCH_MASK	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+						 IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/*
+ Sorted names of a directory, kept in one pool. The name of a directory
+ ends in '/' so completing it leads straight into it.
+*/
+typedef struct PathListing
+{
+	char *Pool;
+	char **Name;
+	unsigned int Count;
+} PathListing;
+
+typedef struct PathDir
+{
+	dev_t Dev;			// identity of the directory
+	ino_t Ino;
+	char *Path;			// name it is scanned under
+	int Wd;				// inotify watch, -1 if none
+	struct timespec Mtime;		// checked instead when there is no watch
+	int State;			// PD_ state
+	int Dirty;			// changed while being scanned
+	unsigned int Used;		// Tab count when last used, for eviction
+	PathListing List;
+} PathDir;
+
+static struct
+{
+	pthread_mutex_t Lock;		// guards everything below
+	pthread_cond_t Scanned;		// a scan has finished
+	int Inotify;			// -1 until the first Tab, -2 if unavailable
+	unsigned int Clock;		// Tab count
+	PathDir Dir[PATH_CACHE_DIRS];
+} PathCache = {
+	.Lock = PTHREAD_MUTEX_INITIALIZER,
+	.Scanned = PTHREAD_COND_INITIALIZER,
+	.Inotify = -1,
+};
+
+/******************************************************************************
+* Function Name : PathCompare
+* Parameters    : [in] A, B - pointers to two names
+* Description   : qsort order of the names of a listing
+* Return Value  : <0, 0 or >0 like strcmp
+******************************************************************************/
+
+static int PathCompare(const void *A, const void *B)
+{
+	return strcmp(*(char *const *)A, *(char *const *)B);
+}
+
+/******************************************************************************
+* Function Name : PathListingFree
+* Parameters    : [in] List - listing to free
+* Description   : Frees a listing and leaves it empty
+* Return Value  : NULL
+******************************************************************************/
+
+static void PathListingFree(PathListing *List)
+{
+	free(List->Pool);
+	free(List->Name);
+	memset(List, 0, sizeof(*List));
+}
+
+/******************************************************************************
+* Function Name : PathRead
+* Parameters    : [in] Path - directory to read
+*                 [out] List - its sorted names
+* Description   : Reads a directory. Only entries of unknown type and
+*                 symbolic links need a stat to tell directories apart.
+* Return Value  : 0 on success, -1 on failure
+******************************************************************************/
+
+static int PathRead(const char *Path, PathListing *List)
+{
+	DIR *Dir = opendir(Path);
+	struct dirent *Ent;
+	struct stat St;
+	size_t Used = 0, Size = 0, Len, *Offset = NULL, *MoreOffset;
+	unsigned int Count = 0, Slots = 0, i;
+	char *Pool = NULL, *MorePool;
+	int IsDir, rc = 0;
+
+	memset(List, 0, sizeof(*List));
+	if (Dir == NULL)
+		return -1;
+
+	while ((rc == 0) && ((Ent = readdir(Dir)) != NULL))
+	{
+		if (!strcmp(Ent->d_name, ".") || !strcmp(Ent->d_name, ".."))
+			continue;
+		IsDir = (Ent->d_type == DT_DIR);
+		if ((Ent->d_type == DT_LNK) || (Ent->d_type == DT_UNKNOWN))
+			IsDir = !fstatat(dirfd(Dir), Ent->d_name, &St, 0) && S_ISDIR(St.st_mode);
+
+		Len = strlen(Ent->d_name);
+		if (Used + Len + 2 > Size)
+		{
+			Size = (Size + Len + 2) * 2;
+			MorePool = realloc(Pool, Size);
+			if (MorePool == NULL)
+			{
+				rc = -1;
+				break;
+			}
+			Pool = MorePool;
+		}
+		if (Count == Slots)
+		{
+			Slots = Slots ? Slots * 2 : 256;
+			MoreOffset = realloc(Offset, Slots * sizeof(*Offset));
+			if (MoreOffset == NULL)
+			{
+				rc = -1;
+				break;
+			}
+			Offset = MoreOffset;
+		}
+
+		Offset[Count++] = Used;
+		memcpy(&Pool[Used], Ent->d_name, Len);
+		Used += Len;
+		if (IsDir)
+			Pool[Used++] = '/';
+		Pool[Used++] = 0;
+	}
+	closedir(Dir);
+
+	if (rc == 0)
+	{
+		// the pool has stopped moving, the names can be pointed at now
+		List->Name = malloc((Count ? Count : 1) * sizeof(*List->Name));
+		if (List->Name == NULL)
+			rc = -1;
+	}
+	if (rc < 0)
+	{
+		free(Pool);
+		free(Offset);
+		return -1;
+	}
+
+	for (i = 0; i < Count; i++)
+		List->Name[i] = &Pool[Offset[i]];
+	free(Offset);
+	qsort(List->Name, Count, sizeof(*List->Name), PathCompare);
+	List->Pool = Pool;
+	List->Count = Count;
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : PathScan
+* Parameters    : [in] Arg - the cached directory to scan
+* Description   : Scan thread. A listing that changed while it was read is
+*                 thrown away, the next Tab scans the directory again.
+* Return Value  : NULL
+******************************************************************************/
+
+static void *PathScan(void *Arg)
+{
+	PathDir *D = Arg;
+	PathListing List;
+	int rc;
+
+	// Path does not change while the directory is being scanned
+	rc = PathRead(D->Path, &List);
+
+	pthread_mutex_lock(&PathCache.Lock);
+	if ((rc < 0) || D->Dirty)
+	{
+		PathListingFree(&List);
+		D->State = PD_EMPTY;
+	}
+	else
+	{
+		D->List = List;
+		D->State = PD_READY;
+	}
+	D->Dirty = 0;
+	pthread_cond_broadcast(&PathCache.Scanned);
+	pthread_mutex_unlock(&PathCache.Lock);
+	return NULL;
+}
+
+/******************************************************************************
+* Function Name : PathEvents
+* Parameters    : NULL
+* Description   : Reads the inotify events queued since the last Tab and
+*                 drops the listings of the directories they are about.
+*                 Called with the lock held.
+* Return Value  : NULL
+******************************************************************************/
+
+static void PathEvents(void)
+{
+	char Buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *Ev;
+	ssize_t Len, Off;
+	PathDir *D;
+	int i;
+
+	if (PathCache.Inotify < 0)
+		return;
+
+	while ((Len = read(PathCache.Inotify, Buf, sizeof(Buf))) > 0)
+	{
+		for (Off = 0; Off < Len; Off += sizeof(*Ev) + Ev->len)
+		{
+			Ev = (const struct inotify_event *)&Buf[Off];
+			for (i = 0; i < PATH_CACHE_DIRS; i++)
+			{
+				D = &PathCache.Dir[i];
+				// a lost event may have been about any directory
+				if ((D->Wd != Ev->wd) && !(Ev->mask & IN_Q_OVERFLOW))
+					continue;
+				if (Ev->mask & IN_IGNORED)
+					D->Wd = -1;
+				if (D->State == PD_SCANNING)
+				{
+					D->Dirty = 1;
+				}
+				else if (D->State == PD_READY)
+				{
+					PathListingFree(&D->List);
+					D->State = PD_EMPTY;
+				}
+			}
+		}
+	}
+}
+
+/******************************************************************************
+* Function Name : PathFind
+* Parameters    : [in] St - stat of the directory
+*                 [in] Path - name of the directory
+* Description   : Finds the cache entry of a directory, taking over the
+*                 least recently used entry not being scanned for it if it
+*                 has none. An entry found is scanned under Path from now
+*                 on, as a relative name it had may lead elsewhere once the
+*                 working directory changed. Called with the lock held.
+* Return Value  : the entry, NULL if every entry is being scanned
+******************************************************************************/
+
+static PathDir *PathFind(const struct stat *St, const char *Path)
+{
+	PathDir *D, *Oldest = NULL;
+	char *Copy;
+	int i;
+
+	for (i = 0; i < PATH_CACHE_DIRS; i++)
+	{
+		D = &PathCache.Dir[i];
+		if ((D->Path != NULL) && (D->Dev == St->st_dev) && (D->Ino == St->st_ino))
+		{
+			// a scan running reads D->Path without the lock
+			if ((D->State != PD_SCANNING) && strcmp(D->Path, Path))
+			{
+				Copy = strdup(Path);
+				if (Copy == NULL)
+					return NULL;
+				free(D->Path);
+				D->Path = Copy;
+			}
+			return D;
+		}
+		if (D->State == PD_SCANNING)
+			continue;
+		// an unused entry first, then the least recently used one
+		if ((Oldest == NULL) || (D->Path == NULL) ||
+			((Oldest->Path != NULL) && (D->Used < Oldest->Used)))
+		{
+			Oldest = D;
+		}
+	}
+
+	Copy = strdup(Path);
+	if ((Oldest == NULL) || (Copy == NULL))
+	{
+		free(Copy);
+		return NULL;
+	}
+	D = Oldest;
+	if ((D->Path != NULL) && (D->Wd >= 0))
+		inotify_rm_watch(PathCache.Inotify, D->Wd);
+	PathListingFree(&D->List);
+	free(D->Path);
+	D->Path = Copy;
+	D->Dev = St->st_dev;
+	D->Ino = St->st_ino;
+	D->Wd = -1;
+	D->State = PD_EMPTY;
+	D->Dirty = 0;
+	return D;
+}
+
+/******************************************************************************
+* Function Name : PathStartScan
+* Parameters    : [in] D - cache entry of the directory
+*                 [in] St - stat of the directory
+* Description   : Watches a directory and starts reading it on a thread of
+*                 its own, or right here if no thread can be started. The
+*                 watch is set first so no change made during the scan is
+*                 missed. Called with the lock held.
+* Return Value  : NULL
+******************************************************************************/
+
+static void PathStartScan(PathDir *D, const struct stat *St)
+{
+	pthread_attr_t Attr;
+	pthread_t Thread;
+	int rc;
+
+	if (PathCache.Inotify == -1)
+	{
+		PathCache.Inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (PathCache.Inotify < 0)
+			PathCache.Inotify = -2;
+	}
+	if ((D->Wd < 0) && (PathCache.Inotify >= 0))
+		D->Wd = inotify_add_watch(PathCache.Inotify, D->Path, PATH_WATCH_MASK);
+	D->Mtime = St->st_mtim;
+	D->State = PD_SCANNING;
+	D->Dirty = 0;
+
+	pthread_attr_init(&Attr);
+	pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&Thread, &Attr, PathScan, D);
+	pthread_attr_destroy(&Attr);
+	if (rc != 0)
+	{
+		pthread_mutex_unlock(&PathCache.Lock);
+		PathScan(D);
+		pthread_mutex_lock(&PathCache.Lock);
+	}
+}
+
+/******************************************************************************
+* Function Name : ConsolePathComplete
+* Parameters    : [in] CmdLine - NUL terminated line
+*                 [in] Cursor - index of the cursor in the line
+*                 [out] Out - candidates
+* Description   : Completer for file system paths, for ConsoleSetCompleter
+*                 or to be called from a completer for the words that take
+*                 a path. The candidates are the names in the directory
+*                 part of the word, directories ending in '/'; names
+*                 starting with '.' only come up once a '.' is typed. A
+*                 leading "~/" stands for $HOME. Names with blanks are left
+*                 out as the line has no quoting to keep them one word.
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsolePathComplete(const char *CmdLine, unsigned short Cursor,
+						 ConsoleCompletions *Out)
+{
+	char Path[PATH_MAX];
+	unsigned short Start = Cursor, Base;
+	unsigned int Lo, Hi, Mid, Typed;
+	const char *Home, *Name;
+	struct timespec Deadline;
+	struct stat St;
+	PathDir *D;
+	int Fuzzy = (ConsoleGetMatchMode() == REX_MATCH_FUZZY);
+
+	while ((Start > 0) && (CmdLine[Start - 1] != ' '))
+		Start--;
+	for (Base = Cursor; (Base > Start) && (CmdLine[Base - 1] != '/'); Base--)
+		;
+
+	if (Base == Start)
+	{
+		strcpy(Path, ".");
+	}
+	else if ((CmdLine[Start] == '~') && (Base > Start + 1) && (CmdLine[Start + 1] == '/'))
+	{
+		Home = getenv("HOME");
+		if ((Home == NULL) ||
+			(snprintf(Path, sizeof(Path), "%s%.*s", Home, Base - Start - 1,
+					  &CmdLine[Start + 1]) >= (int)sizeof(Path)))
+		{
+			return;
+		}
+	}
+	else
+	{
+		snprintf(Path, sizeof(Path), "%.*s", Base - Start, &CmdLine[Start]);
+	}
+	if ((stat(Path, &St) < 0) || !S_ISDIR(St.st_mode))
+		return;
+	ConsoleSetCompletionStart(Out, Base);
+	Typed = Cursor - Base;
+
+	pthread_mutex_lock(&PathCache.Lock);
+	PathEvents();
+	D = PathFind(&St, Path);
+	if (D == NULL)
+	{
+		pthread_mutex_unlock(&PathCache.Lock);
+		return;
+	}
+	D->Used = ++PathCache.Clock;
+	if ((D->State == PD_READY) && (D->Wd < 0) &&
+		((D->Mtime.tv_sec != St.st_mtim.tv_sec) || (D->Mtime.tv_nsec != St.st_mtim.tv_nsec)))
+	{
+		PathListingFree(&D->List);
+		D->State = PD_EMPTY;
+	}
+	if (D->State == PD_EMPTY)
+		PathStartScan(D, &St);
+
+	clock_gettime(CLOCK_REALTIME, &Deadline);
+	Deadline.tv_nsec += PATH_SCAN_WAIT_MS * 1000000L;
+	if (Deadline.tv_nsec >= 1000000000L)
+	{
+		Deadline.tv_sec++;
+		Deadline.tv_nsec -= 1000000000L;
+	}
+	while ((D->State == PD_SCANNING) &&
+		   (pthread_cond_timedwait(&PathCache.Scanned, &PathCache.Lock, &Deadline) != ETIMEDOUT))
+		;
+
+	// while waiting, another Tab may have taken the entry over
+	if ((D->State == PD_READY) && (D->Dev == St.st_dev) && (D->Ino == St.st_ino))
+	{
+		// in prefix mode only the names extending what was typed are of use
+		Lo = 0;
+		Hi = D->List.Count;
+		while (!Fuzzy && (Lo < Hi))
+		{
+			Mid = (Lo + Hi) / 2;
+			if (strncmp(D->List.Name[Mid], &CmdLine[Base], Typed) < 0)
+				Lo = Mid + 1;
+			else
+				Hi = Mid;
+		}
+		for (; Lo < D->List.Count; Lo++)
+		{
+			Name = D->List.Name[Lo];
+			if (!Fuzzy && strncmp(Name, &CmdLine[Base], Typed))
+				break;
+			if (((Name[0] != '.') || ((Typed > 0) && (CmdLine[Base] == '.'))) &&
+				!strchr(Name, ' '))
+				ConsoleAddCompletion(Out, Name);
+		}
+	}
+	pthread_mutex_unlock(&PathCache.Lock);
+}
+
+/******************************************************************************
+* Function Name : ConsolePathCacheFree
+* Parameters    : NULL
+* Description   : Waits for the scans still running and frees every cached
+*                 listing and watch
+* Return Value  : NULL
+******************************************************************************/
+
+void ConsolePathCacheFree(void)
+{
+	PathDir *D;
+	int i;
+
+	pthread_mutex_lock(&PathCache.Lock);
+	for (i = 0; i < PATH_CACHE_DIRS; i++)
+	{
+		D = &PathCache.Dir[i];
+		while (D->State == PD_SCANNING)
+			pthread_cond_wait(&PathCache.Scanned, &PathCache.Lock);
+		PathListingFree(&D->List);
+		free(D->Path);
+		memset(D, 0, sizeof(*D));
+		D->Wd = -1;
+	}
+	if (PathCache.Inotify >= 0)
+		close(PathCache.Inotify);
+	PathCache.Inotify = -1;
+	pthread_mutex_unlock(&PathCache.Lock);
+}
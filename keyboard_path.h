@@ -0,0 +1,27 @@
+/*******************************************************************************
+* Module Name : keyboard_path.h
+* Description : Contains function declarations for keyboard_path.c
+*******************************************************************************/
+#ifndef _KEYBOARD_PATH_
+#define _KEYBOARD_PATH_
+
+#include "keyboard_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Directory listings cached per process
+#define PATH_CACHE_DIRS		64
+// Time Tab waits for a directory scan before returning without candidates
+#define PATH_SCAN_WAIT_MS	30
+
+void ConsolePathComplete(const char *CmdLine, unsigned short Cursor,
+						 ConsoleCompletions *Out);
+void ConsolePathCacheFree(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,407 @@
+/*******************************************************************************
+* Module Name : keyboard_session.hpp
+* Description : Header only C++20 coroutine front-end for keyboard_driver.
+*               A prompt suspends on input readiness instead of blocking a
+*               thread in GetCmdLine:
+*
+*                   rex::session<Exec> s(exec, fd, fd);
+*                   auto user = co_await s.read_line({.prompt = "Username: "});
+*                   auto pass = co_await s.read_password("Password: ");
+*
+*               Executor requirements: exec.readable(fd, timeout_ms) and
+*               exec.writable(fd) return awaitables that resume the awaiting
+*               coroutine once fd is readable (or timeout_ms passed, -1 for
+*               none) or writable (epoll_wait, io_uring POLL_ADD, ...);
+*               exec.forget(fd) drops whatever the executor keeps for fd
+*               before it is closed. rex::epoll_executor below is a minimal
+*               one. All sessions of one driver instance must be driven from
+*               the same thread, as the driver keeps the selected session in
+*               a global.
+*
+*               Memory: one coroutine frame per read_line call; key strokes
+*               are processed in the session's fixed buffers and allocate
+*               nothing.
+*******************************************************************************/
+#ifndef _KEYBOARD_SESSION_HPP_
+#define _KEYBOARD_SESSION_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "keyboard_driver.h"
+
+namespace rex {
+
+/******************************************************************************
+* Class Name    : task
+* Description   : Lazily started coroutine returning a T. Awaiting it starts
+*                 it; completion resumes the awaiter by symmetric transfer.
+******************************************************************************/
+
+template <class T>
+class task
+{
+public:
+	struct promise_type
+	{
+		T value{};
+		std::exception_ptr error;
+		std::coroutine_handle<> continuation = std::noop_coroutine();
+
+		task get_return_object()
+		{
+			return task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept
+		{
+			struct final_awaiter
+			{
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(
+					std::coroutine_handle<promise_type> h) noexcept
+				{
+					return h.promise().continuation;
+				}
+				void await_resume() noexcept {}
+			};
+			return final_awaiter{};
+		}
+		void return_value(T v) { value = std::move(v); }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	task(task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+	~task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+	{
+		h_.promise().continuation = awaiter;
+		return h_;
+	}
+	T await_resume()
+	{
+		if (h_.promise().error)
+			std::rethrow_exception(h_.promise().error);
+		return std::move(h_.promise().value);
+	}
+
+private:
+	explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+	std::coroutine_handle<promise_type> h_;
+};
+
+/*
+ Result of a prompt. status is 0 when the user pressed enter,
+ REX_KEY_TOOLONG when the line was continued past LINE_LEN chars and cut
+ short, REX_KEY_EOF if the input was closed. line stays valid until the
+ next read on the same session.
+*/
+struct line_result
+{
+	unsigned short status;
+	std::string_view line;
+
+	bool ok() const { return status == 0; }
+};
+
+struct line_options
+{
+	bool password = false;
+	std::string_view initial;	// text already in the buffer, echoed only
+					// after a prompt
+	const char *prompt = nullptr;	// shown by the driver, see CmdLineBegin
+};
+
+/******************************************************************************
+* Class Name    : session
+* Description   : One console session (pty, socket, ...) read through
+*                 coroutines. The caller owns the descriptors and sets the
+*                 terminal mode; in_fd must be non-blocking, and so should
+*                 out_fd, or a terminal that stops reading stalls the thread.
+******************************************************************************/
+
+template <class Executor>
+class session
+{
+public:
+	session(Executor &exec, int in_fd, int out_fd)
+		: exec_(exec), cs_(ConsoleSessionCreate(in_fd, out_fd)), in_fd_(in_fd),
+		  out_fd_(out_fd)
+	{
+		if (cs_ == nullptr)
+			throw std::bad_alloc();
+	}
+	~session()
+	{
+		exec_.forget(in_fd_);
+		if (out_fd_ != in_fd_)
+			exec_.forget(out_fd_);
+		ConsoleSessionDestroy(cs_);
+	}
+	session(const session &) = delete;
+	session &operator=(const session &) = delete;
+
+	// Sets the terminal width used for line wrapping
+	void set_columns(int columns)
+	{
+		ConsoleSession *prev = ConsoleSelectSession(cs_);
+		g_ColumnLen = columns;
+		ConsoleSelectSession(prev);
+	}
+
+	task<line_result> read_line(line_options opts = {})
+	{
+		std::size_t n = std::min<std::size_t>(opts.initial.size(), LINE_LEN);
+		unsigned short rc;
+
+		std::memcpy(buf_, opts.initial.data(), n);
+		buf_[n] = 0;
+
+		ConsoleSession *prev = ConsoleSelectSession(cs_);
+		CmdLineBegin(opts.prompt, buf_, static_cast<unsigned short>(n),
+					 opts.password);
+		ConsoleSelectSession(prev);
+
+		// keys already buffered are handled without suspending
+		rc = step(CmdLinePoll);
+		while (rc == REX_KEY_AGAIN)
+		{
+			if (pending_)
+				co_await exec_.writable(out_fd_);
+			else
+				co_await exec_.readable(in_fd_, timeout_ms_);
+			rc = step(CmdLinePoll);
+		}
+		// the echo of the last keys may still be queued
+		while (pending_)
+		{
+			co_await exec_.writable(out_fd_);
+			step(ConsoleDrain);
+		}
+		co_return line_result{rc, std::string_view(buf_)};
+	}
+
+	task<line_result> read_password(const char *prompt = nullptr)
+	{
+		return read_line(line_options{true, {}, prompt});
+	}
+
+private:
+	// Runs fn on this session and notes what to wait for next
+	unsigned short step(unsigned short (*fn)(void))
+	{
+		ConsoleSession *prev = ConsoleSelectSession(cs_);
+		unsigned short rc = fn();
+
+		pending_ = ConsoleOutputPending();
+		timeout_ms_ = ConsolePollTimeout();
+		ConsoleSelectSession(prev);
+		return rc;
+	}
+
+	Executor &exec_;
+	ConsoleSession *cs_;
+	int in_fd_;
+	int out_fd_;
+	unsigned int pending_ = 0;
+	int timeout_ms_ = -1;
+	char buf_[MAX_CMD_SIZE];
+};
+
+/******************************************************************************
+* Class Name    : epoll_executor
+* Description   : Minimal single threaded epoll executor satisfying the
+*                 session requirements. spawn() starts a task<int> and keeps
+*                 it until it finishes; run() returns when all have finished.
+*                 A wait lives in the awaiting coroutine frame, so waiting
+*                 allocates nothing, with or without a timeout.
+******************************************************************************/
+
+class epoll_executor
+{
+	using clock = std::chrono::steady_clock;
+
+	// One suspended coroutine, linked in timed_ while it has a timeout
+	struct waiter
+	{
+		std::coroutine_handle<> h;
+		int fd;
+		clock::time_point deadline;
+		waiter *prev = nullptr;
+		waiter *next = nullptr;
+		bool timed = false;
+	};
+
+	struct awaiter
+	{
+		epoll_executor &exec;
+		int fd;
+		std::uint32_t events;
+		int timeout_ms;
+		waiter w{};
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			w.h = h;
+			w.fd = fd;
+			exec.arm(w, events, timeout_ms);
+		}
+		void await_resume() const noexcept {}
+	};
+
+public:
+	epoll_executor() : epfd_(epoll_create1(EPOLL_CLOEXEC)) {}
+	~epoll_executor() { close(epfd_); }
+	epoll_executor(const epoll_executor &) = delete;
+	epoll_executor &operator=(const epoll_executor &) = delete;
+
+	awaiter readable(int fd, int timeout_ms = -1)
+	{
+		return awaiter{*this, fd, EPOLLIN, timeout_ms};
+	}
+
+	awaiter writable(int fd) { return awaiter{*this, fd, EPOLLOUT, -1}; }
+
+	void forget(int fd) { epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr); }
+
+	void spawn(task<int> t)
+	{
+		root r = start(std::move(t));
+		live_++;
+		r.h.resume();
+	}
+
+	void run()
+	{
+		struct epoll_event ev[64];
+		waiter *w;
+		int n, i;
+
+		while (live_ > 0)
+		{
+			n = epoll_wait(epfd_, ev, 64, next_timeout());
+			for (i = 0; i < n; i++)
+			{
+				w = static_cast<waiter *>(ev[i].data.ptr);
+				unlink(*w);
+				w->h.resume();
+			}
+			// a timed out wait is taken off epoll and resumed as if ready
+			while ((w = expired()) != nullptr)
+			{
+				unlink(*w);
+				forget(w->fd);
+				w->h.resume();
+			}
+		}
+	}
+
+private:
+	// Detached wrapper owning a spawned task, destroys itself when done
+	struct root
+	{
+		struct promise_type
+		{
+			root get_return_object()
+			{
+				return root{std::coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+		std::coroutine_handle<promise_type> h;
+	};
+
+	root start(task<int> t)
+	{
+		co_await t;
+		live_--;
+	}
+
+	void arm(waiter &w, std::uint32_t events, int timeout_ms)
+	{
+		struct epoll_event ev;
+
+		ev.events = events | EPOLLONESHOT;
+		ev.data.ptr = &w;
+		if (epoll_ctl(epfd_, EPOLL_CTL_MOD, w.fd, &ev) < 0)
+			epoll_ctl(epfd_, EPOLL_CTL_ADD, w.fd, &ev);
+		if (timeout_ms >= 0)
+		{
+			w.deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+			w.timed = true;
+			w.next = timed_;
+			if (timed_ != nullptr)
+				timed_->prev = &w;
+			timed_ = &w;
+		}
+	}
+
+	void unlink(waiter &w)
+	{
+		if (!w.timed)
+			return;
+		if (w.prev != nullptr)
+			w.prev->next = w.next;
+		else
+			timed_ = w.next;
+		if (w.next != nullptr)
+			w.next->prev = w.prev;
+		w.timed = false;
+	}
+
+	// Milliseconds until the nearest deadline, rounded up, -1 if none
+	int next_timeout() const
+	{
+		clock::time_point now = clock::now(), first;
+		const waiter *w;
+
+		if (timed_ == nullptr)
+			return -1;
+		first = timed_->deadline;
+		for (w = timed_->next; w != nullptr; w = w->next)
+			first = std::min(first, w->deadline);
+		if (first <= now)
+			return 0;
+		return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(
+			first - now).count());
+	}
+
+	waiter *expired() const
+	{
+		clock::time_point now = clock::now();
+		waiter *w;
+
+		for (w = timed_; w != nullptr; w = w->next)
+			if (w->deadline <= now)
+				return w;
+		return nullptr;
+	}
+
+	int epfd_;
+	int live_ = 0;
+	waiter *timed_ = nullptr;
+};
+
+} // namespace rex
+
+#endif
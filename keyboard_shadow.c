@@ -0,0 +1,269 @@
+/*******************************************************************************
+* Module Name : keyboard_shadow.c
+* Description : Headless VT100 screen the console output can be played on,
+*               so the driver can check in REX_SELF_CHECK builds that what
+*               the terminal shows is the line it holds, with the cursor
+*               where it thinks it is. It knows the sequences of the ANSI
+*               and VT52 profiles in keyboard_term.c and the wrap rule of
+*               xterm: writing the last column leaves the cursor on it
+*               until the next char is written.
+********************************************************************************/
+#include <string.h>
+#include "keyboard_shadow.h"
+
+/******************************************************************************
+* Function Name : ShadowReset
+* Parameters    : [in] S - screen
+*                 [in] Cols - width of the terminal
+* Description   : Starts a blank screen with the cursor top left. A width
+*                 the screen cannot hold leaves it lost.
+* Return Value  : NULL
+******************************************************************************/
+
+void ShadowReset(ShadowScreen *S, int Cols)
+{
+	memset(S->Cell, ' ', sizeof(S->Cell));
+	S->Cols = Cols;
+	S->X = S->Y = 0;
+	S->Pending = 0;
+	S->Lost = (Cols <= 0) || (Cols > SHADOW_COLS);
+	S->SeqLen = 0;
+}
+
+/******************************************************************************
+* Function Name : ShadowLineFeed
+* Parameters    : [in] S - screen
+* Description   : Moves the cursor a row down, scrolling at the bottom
+* Return Value  : NULL
+******************************************************************************/
+
+static void ShadowLineFeed(ShadowScreen *S)
+{
+	S->Pending = 0;
+	if (S->Y < SHADOW_ROWS - 1)
+	{
+		S->Y++;
+		return;
+	}
+	memmove(S->Cell[0], S->Cell[1], (SHADOW_ROWS - 1) * SHADOW_COLS);
+	memset(S->Cell[SHADOW_ROWS - 1], ' ', SHADOW_COLS);
+}
+
+/******************************************************************************
+* Function Name : ShadowPut
+* Parameters    : [in] S - screen
+*                 [in] ch - char to show
+* Description   : Writes a char at the cursor
+* Return Value  : NULL
+******************************************************************************/
+
+static void ShadowPut(ShadowScreen *S, char ch)
+{
+	if (S->Pending)
+	{
+		S->X = 0;
+		ShadowLineFeed(S);
+	}
+	S->Cell[S->Y][S->X] = ch;
+	if (S->X == S->Cols - 1)
+		S->Pending = 1;
+	else
+		S->X++;
+}
+
+/******************************************************************************
+* Function Name : ShadowErase
+* Parameters    : [in] S - screen
+*                 [in] Screen - 1 to erase to the end of the screen, 0 to
+*                               the end of the row
+* Description   : Blanks from the cursor on
+* Return Value  : NULL
+******************************************************************************/
+
+static void ShadowErase(ShadowScreen *S, int Screen)
+{
+	int y;
+
+	memset(&S->Cell[S->Y][S->X], ' ', SHADOW_COLS - S->X);
+	for (y = S->Y + 1; Screen && (y < SHADOW_ROWS); y++)
+		memset(S->Cell[y], ' ', SHADOW_COLS);
+}
+
+/******************************************************************************
+* Function Name : ShadowCsi
+* Parameters    : [in] S - screen
+*                 [in] Final - final byte of the sequence
+*                 [in] P1, P2 - first two parameters, -1 when missing
+* Description   : Carries out an ANSI control sequence
+* Return Value  : 0 if known, -1 otherwise
+******************************************************************************/
+
+static int ShadowCsi(ShadowScreen *S, char Final, int P1, int P2)
+{
+	int n = (P1 > 0) ? P1 : 1;
+	char *Row = S->Cell[S->Y];
+
+	switch (Final)
+	{
+	case 'A':
+		S->Y = (S->Y > n) ? S->Y - n : 0;
+		break;
+	case 'B':
+		S->Y = (S->Y + n < SHADOW_ROWS) ? S->Y + n : SHADOW_ROWS - 1;
+		break;
+	case 'C':
+		S->X = (S->X + n < S->Cols) ? S->X + n : S->Cols - 1;
+		break;
+	case 'D':
+		S->X = (S->X > n) ? S->X - n : 0;
+		break;
+	case 'G':
+		S->X = (n <= S->Cols) ? n - 1 : S->Cols - 1;
+		break;
+	case 'H':
+		S->Y = (n <= SHADOW_ROWS) ? n - 1 : SHADOW_ROWS - 1;
+		n = (P2 > 0) ? P2 : 1;
+		S->X = (n <= S->Cols) ? n - 1 : S->Cols - 1;
+		break;
+	case 'J':
+		if (P1 == 2)
+			memset(S->Cell, ' ', sizeof(S->Cell));
+		else
+			ShadowErase(S, 1);
+		return 0;
+	case 'K':
+		ShadowErase(S, 0);
+		return 0;
+	case '@':
+		if (n > S->Cols - S->X)
+			n = S->Cols - S->X;
+		memmove(&Row[S->X + n], &Row[S->X], S->Cols - S->X - n);
+		memset(&Row[S->X], ' ', n);
+		break;
+	case 'P':
+		if (n > S->Cols - S->X)
+			n = S->Cols - S->X;
+		memmove(&Row[S->X], &Row[S->X + n], S->Cols - S->X - n);
+		memset(&Row[S->Cols - n], ' ', n);
+		break;
+	case 'm':
+		return 0;
+	default:
+		return -1;
+	}
+	// a cursor motion or shift ends the wait to wrap
+	S->Pending = 0;
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : ShadowEscape
+* Parameters    : [in] S - screen
+* Description   : Carries out the escape sequence collected in S->Seq once
+*                 it is complete
+* Return Value  : 1 when the sequence is done with, 0 if more bytes are
+*                 needed
+******************************************************************************/
+
+static int ShadowEscape(ShadowScreen *S)
+{
+	char Last = S->Seq[S->SeqLen - 1];
+	int P[2] = { -1, -1 }, n = 0, i;
+
+	if (S->SeqLen < 2)
+		return 0;
+	if (S->Seq[1] != '[')
+	{
+		// VT52: ESC and one letter
+		switch (Last)
+		{
+		case 'A':
+		case 'B':
+		case 'C':
+		case 'H':
+		case 'J':
+		case 'K':
+			S->Lost |= ShadowCsi(S, Last, (Last == 'J') ? 0 : -1, -1) < 0;
+			break;
+		default:
+			S->Lost = 1;
+			break;
+		}
+		return 1;
+	}
+
+	if ((Last < 0x40) || (Last > 0x7E) || (S->SeqLen == 2))
+	{
+		if (S->SeqLen == SHADOW_SEQ_MAX)
+			S->Lost = 1;
+		return S->Lost;
+	}
+	for (i = 2; i < S->SeqLen - 1; i++)
+	{
+		if ((S->Seq[i] >= '0') && (S->Seq[i] <= '9') && (n < 2))
+			P[n] = ((P[n] < 0) ? 0 : P[n] * 10) + S->Seq[i] - '0';
+		else if (S->Seq[i] == ';')
+			n++;
+	}
+	if (ShadowCsi(S, Last, P[0], P[1]) < 0)
+		S->Lost = 1;
+	return 1;
+}
+
+/******************************************************************************
+* Function Name : ShadowFeed
+* Parameters    : [in] S - screen
+*                 [in] Buf - bytes written to the terminal
+*                 [in] Len - number of bytes
+* Description   : Plays output on the screen. A newline also returns the
+*                 carriage, as the tty does on output.
+* Return Value  : NULL
+******************************************************************************/
+
+void ShadowFeed(ShadowScreen *S, const char *Buf, unsigned int Len)
+{
+	unsigned int i;
+	char ch;
+
+	for (i = 0; (i < Len) && !S->Lost; i++)
+	{
+		ch = Buf[i];
+		if (S->SeqLen)
+		{
+			S->Seq[S->SeqLen++] = ch;
+			if (ShadowEscape(S))
+				S->SeqLen = 0;
+			continue;
+		}
+
+		switch (ch)
+		{
+		case 27:
+			S->Seq[S->SeqLen++] = ch;
+			break;
+		case '\b':
+			S->Pending = 0;
+			if (S->X > 0)
+				S->X--;
+			break;
+		case '\r':
+			S->Pending = 0;
+			S->X = 0;
+			break;
+		case '\n':
+			S->X = 0;
+			ShadowLineFeed(S);
+			break;
+		case '\a':
+		case 0:
+			break;
+		default:
+			if ((unsigned char)ch < ' ')
+				S->Lost = 1;
+			// UTF-8 continuation bytes share the cell of their lead byte
+			else if (((unsigned char)ch & 0xC0) != 0x80)
+				ShadowPut(S, ch);
+			break;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/*******************************************************************************
+* Module Name : keyboard_shadow.h
+* Description : Contains function declarations for keyboard_shadow.c
+*******************************************************************************/
+#ifndef _KEYBOARD_SHADOW_
+#define _KEYBOARD_SHADOW_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of the screen kept; more rows than the longest line takes at the
+// narrowest width, so the line being edited never scrolls off it
+#define SHADOW_COLS		256
+#define SHADOW_ROWS		64
+// Longest escape sequence understood
+#define SHADOW_SEQ_MAX		16
+
+/*
+ Headless VT100 screen: chars only, no attributes. Lost is set once it
+ meets a sequence it does not know, after which the screen means nothing
+ until the next ShadowReset.
+*/
+typedef struct ShadowScreen
+{
+	char Cell[SHADOW_ROWS][SHADOW_COLS];
+	int Cols;
+	int X;
+	int Y;
+	int Pending;			// last column written, wrap waits for a char
+	int Lost;
+	char Seq[SHADOW_SEQ_MAX];	// escape sequence split across feeds
+	int SeqLen;
+} ShadowScreen;
+
+void ShadowReset(ShadowScreen *S, int Cols);
+void ShadowFeed(ShadowScreen *S, const char *Buf, unsigned int Len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
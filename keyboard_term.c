@@ -0,0 +1,417 @@
+/*******************************************************************************
+* Module Name : keyboard_term.c
+* Description : Terminal capability tables. A terminal type is resolved once,
+*               from terminfo when built with REX_USE_TERMINFO or else from
+*               the built-in profiles, into pre-encoded sequences whose
+*               lengths double as their cost, so the cursor code can pick
+*               the cheapest motion without formatting anything.
+********************************************************************************/
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "keyboard_term.h"
+
+#ifdef REX_USE_TERMINFO
+#include <curses.h>
+#include <term.h>
+#endif
+
+/* Built-in profiles */
+enum
+{
+	PROFILE_ANSI,		/* xterm and most emulators */
+	PROFILE_VT220,		/* no absolute column */
+	PROFILE_VT102,		/* no insert character either */
+	PROFILE_VT100,		/* no insert/delete character */
+	PROFILE_VT52,
+	PROFILE_COUNT
+};
+
+typedef struct TermProfile
+{
+	const char *Str[TC_STR_COUNT];
+	const char *Parm[TP_COUNT][2];	// Pre, Post
+	unsigned char ColumnBase;
+} TermProfile;
+
+#define ANSI_MOTION \
+	"\033[A", "\033[B", "\b", "\033[C", "\r", "\033[K", "\033[J", "\033[H\033[2J"
+#define ANSI_PARM \
+	{ "\033[", "A" }, { "\033[", "B" }, { "\033[", "D" }, { "\033[", "C" }
+
+static const TermProfile Profiles[PROFILE_COUNT] = {
+	[PROFILE_ANSI] = {
+		{ ANSI_MOTION, "\033[@", "\033[P" },
+		{ ANSI_PARM, { "\033[", "G" } }, 1
+	},
+	[PROFILE_VT220] = {
+		{ ANSI_MOTION, "\033[@", "\033[P" },
+		{ ANSI_PARM }, 0
+	},
+	[PROFILE_VT102] = {
+		{ ANSI_MOTION, NULL, "\033[P" },
+		{ ANSI_PARM }, 0
+	},
+	[PROFILE_VT100] = {
+		{ ANSI_MOTION },
+		{ ANSI_PARM }, 0
+	},
+	[PROFILE_VT52] = {
+		{ "\033A", "\033B", "\b", "\033C", "\r", "\033K", "\033J", "\033H\033J" },
+		{ { NULL } }, 0
+	},
+};
+
+/* $TERM prefixes of each profile, the first match wins */
+static const struct
+{
+	const char *Prefix;
+	int Profile;
+} TermNames[] = {
+	{ "vt52", PROFILE_VT52 },
+	{ "vt100", PROFILE_VT100 },
+	{ "vt102", PROFILE_VT102 },
+	{ "vt2", PROFILE_VT220 },
+	{ "vt3", PROFILE_VT220 },
+	{ "vt4", PROFILE_VT220 },
+	{ "vt5", PROFILE_VT220 },
+	{ "xterm", PROFILE_ANSI },
+	{ "screen", PROFILE_ANSI },
+	{ "tmux", PROFILE_ANSI },
+	{ "linux", PROFILE_ANSI },
+	{ "rxvt", PROFILE_ANSI },
+	{ "putty", PROFILE_ANSI },
+	{ "konsole", PROFILE_ANSI },
+	{ "gnome", PROFILE_ANSI },
+	{ "alacritty", PROFILE_ANSI },
+	{ "kitty", PROFILE_ANSI },
+	{ "foot", PROFILE_ANSI },
+	{ "st-", PROFILE_ANSI },
+	{ "wezterm", PROFILE_ANSI },
+	{ "iterm", PROFILE_ANSI },
+	{ "ansi", PROFILE_ANSI },
+	{ "cygwin", PROFILE_ANSI },
+};
+
+/* Resolved tables, kept for the life of the process */
+typedef struct TermCacheEntry
+{
+	struct TermCacheEntry *Next;
+	int Known;
+	TermCaps Caps;
+} TermCacheEntry;
+
+static TermCacheEntry *TermCache;
+static TermCaps TermFallback;
+
+/******************************************************************************
+* Function Name : TermSetStr
+* Parameters    : [out] Out - buffer of TERM_SEQ_MAX bytes
+*                 [out] Len - length stored, 0 if Str is missing or too long
+*                 [in] Str - sequence, NULL if missing
+* Description   : Copies a sequence into a capability table
+* Return Value  : NULL
+******************************************************************************/
+
+static void TermSetStr(char *Out, unsigned char *Len, const char *Str)
+{
+	size_t n = Str ? strlen(Str) : 0;
+
+	*Len = 0;
+	if ((n == 0) || (n > TERM_SEQ_MAX))
+		return;
+	memcpy(Out, Str, n);
+	*Len = (unsigned char)n;
+}
+
+/******************************************************************************
+* Function Name : TermProfileLoad
+* Parameters    : [in] Caps - table to fill, Name already set
+*                 [in] Profile - built-in profile
+* Description   : Fills a capability table from a built-in profile
+* Return Value  : NULL
+******************************************************************************/
+
+static void TermProfileLoad(TermCaps *Caps, int Profile)
+{
+	const TermProfile *P = &Profiles[Profile];
+	int i;
+
+	for (i = 0; i < TC_STR_COUNT; i++)
+		TermSetStr(Caps->Str[i], &Caps->Len[i], P->Str[i]);
+	for (i = 0; i < TP_COUNT; i++)
+	{
+		if (P->Parm[i][0] == NULL)
+			continue;
+		TermSetStr(Caps->Parm[i].Pre, &Caps->Parm[i].PreLen, P->Parm[i][0]);
+		TermSetStr(Caps->Parm[i].Post, &Caps->Parm[i].PostLen, P->Parm[i][1]);
+	}
+	Caps->Parm[TP_COLUMN].Base = P->ColumnBase;
+}
+
+#ifdef REX_USE_TERMINFO
+/******************************************************************************
+* Function Name : TermInfoStr
+* Parameters    : [in] Cap - terminfo string, NULL or (char *)-1 if missing
+*                 [out] Out - buffer of TERM_SEQ_MAX bytes
+*                 [out] Len - length stored, 0 if unusable
+* Description   : Copies a terminfo string without its $<..> padding
+* Return Value  : NULL
+******************************************************************************/
+
+static void TermInfoStr(const char *Cap, char *Out, unsigned char *Len)
+{
+	unsigned int n = 0;
+
+	*Len = 0;
+	if ((Cap == NULL) || (Cap == (const char *)-1))
+		return;
+	while (*Cap)
+	{
+		if ((Cap[0] == '$') && (Cap[1] == '<') && strchr(Cap, '>'))
+		{
+			Cap = strchr(Cap, '>') + 1;
+			continue;
+		}
+		if (n == TERM_SEQ_MAX)
+			return;
+		Out[n++] = *Cap++;
+	}
+	*Len = (unsigned char)n;
+}
+
+/******************************************************************************
+* Function Name : TermInfoParm
+* Parameters    : [in] Cap - terminfo string taking one number
+*                 [out] P - split sequence
+* Description   : Splits a sequence of the form Pre[%i]%p1%dPost, which
+*                 covers the motions of practically every terminal. Any other
+*                 form is left missing.
+* Return Value  : NULL
+******************************************************************************/
+
+static void TermInfoParm(const char *Cap, TermParm *P)
+{
+	char Buf[3 * TERM_SEQ_MAX];
+	unsigned char Len;
+	char *Arg, *Post;
+
+	P->PreLen = 0;
+	TermInfoStr(Cap, Buf, &Len);
+	if (Len == 0)
+		return;
+	Buf[Len] = 0;
+
+	Arg = strchr(Buf, '%');
+	if (Arg == NULL)
+		return;
+	P->Base = 0;
+	Post = Arg;
+	if (!strncmp(Post, "%i", 2))
+	{
+		P->Base = 1;
+		Post += 2;
+	}
+	if (strncmp(Post, "%p1%d", 5))
+		return;
+	Post += 5;
+	if (strchr(Post, '%') || (Arg == Buf))
+		return;
+
+	*Arg = 0;
+	TermSetStr(P->Pre, &P->PreLen, Buf);
+	TermSetStr(P->Post, &P->PostLen, Post);
+	if (P->PostLen == 0)
+		P->PreLen = 0;
+}
+
+/******************************************************************************
+* Function Name : TermInfoCountOne
+* Parameters    : [in] P - split sequence
+*                 [out] Out - buffer of TERM_SEQ_MAX bytes
+*                 [out] Len - length stored, 0 if P is missing
+* Description   : Stores P with a count of 1 as a plain sequence
+* Return Value  : NULL
+******************************************************************************/
+
+static void TermInfoCountOne(const TermParm *P, char *Out, unsigned char *Len)
+{
+	*Len = 0;
+	if ((P->PreLen == 0) || (P->PreLen + P->PostLen + 1 > TERM_SEQ_MAX))
+		return;
+	memcpy(Out, P->Pre, P->PreLen);
+	Out[P->PreLen] = (char)('1' + P->Base);
+	memcpy(&Out[P->PreLen + 1], P->Post, P->PostLen);
+	*Len = P->PreLen + 1 + P->PostLen;
+}
+
+/******************************************************************************
+* Function Name : TermInfoLoad
+* Parameters    : [in] Caps - table to fill, Name already set
+* Description   : Fills a capability table from the terminfo entry of
+*                 Caps->Name. Entries missing a basic motion are not used.
+* Return Value  : 1 on success, 0 if there is no usable entry
+******************************************************************************/
+
+static int TermInfoLoad(TermCaps *Caps)
+{
+	static const char *StrName[TC_STR_COUNT] = {
+		"cuu1", "cud1", "cub1", "cuf1", "cr", "el", "ed", "clear", "ich1", "dch1"
+	};
+	static const char *ParmName[TP_COUNT] = { "cuu", "cud", "cub", "cuf", "hpa" };
+	TERMINAL *Prev = cur_term;
+	TermParm Ich, Dch;
+	int Err, i, Ok = 1;
+
+	if (setupterm(Caps->Name, STDOUT_FILENO, &Err) != OK)
+	{
+		set_curterm(Prev);
+		return 0;
+	}
+	for (i = 0; i < TC_STR_COUNT; i++)
+		TermInfoStr(tigetstr((char *)StrName[i]), Caps->Str[i], &Caps->Len[i]);
+	for (i = 0; i < TP_COUNT; i++)
+		TermInfoParm(tigetstr((char *)ParmName[i]), &Caps->Parm[i]);
+	TermInfoParm(tigetstr("ich"), &Ich);
+	TermInfoParm(tigetstr("dch"), &Dch);
+	del_curterm(cur_term);
+	set_curterm(Prev);
+
+	// cud1 is usually a line feed, which scrolls and, through the tty's
+	// output processing, also returns the carriage
+	if ((Caps->Len[TC_DOWN] == 1) && (Caps->Str[TC_DOWN][0] == '\n'))
+		Caps->Len[TC_DOWN] = 0;
+
+	// many entries only have the counted forms of ICH and DCH
+	if (Caps->Len[TC_ICH] == 0)
+		TermInfoCountOne(&Ich, Caps->Str[TC_ICH], &Caps->Len[TC_ICH]);
+	if (Caps->Len[TC_DCH] == 0)
+		TermInfoCountOne(&Dch, Caps->Str[TC_DCH], &Caps->Len[TC_DCH]);
+
+	for (i = TC_UP; i <= TC_RIGHT; i++)
+	{
+		if ((Caps->Len[i] == 0) && (Caps->Parm[i - TC_UP + TP_UP].PreLen == 0))
+			Ok = 0;
+	}
+	if ((Caps->Len[TC_CR] == 0) || (Caps->Len[TC_CLR_EOL] == 0))
+		Ok = 0;
+	return Ok;
+}
+#endif
+
+/******************************************************************************
+* Function Name : TermCapsLoad
+* Parameters    : [in] Name - terminal type, e.g. getenv("TERM")
+*                 [out] Known - set to 0 if Name was not recognised and the
+*                               vt100 profile is used instead, 1 otherwise
+* Description   : Gives the capability table of a terminal type. Each type
+*                 is resolved only once per process.
+* Return Value  : the table, never NULL
+******************************************************************************/
+
+const TermCaps *TermCapsLoad(const char *Name, int *Known)
+{
+	TermCacheEntry *E;
+	unsigned int i;
+	int Profile = PROFILE_VT100;
+
+	if (Name == NULL)
+		Name = "";
+	for (E = TermCache; E; E = E->Next)
+	{
+		if (!strncmp(E->Caps.Name, Name, sizeof(E->Caps.Name) - 1))
+		{
+			*Known = E->Known;
+			return &E->Caps;
+		}
+	}
+
+	E = calloc(1, sizeof(TermCacheEntry));
+	if (E == NULL)
+	{
+		if (TermFallback.Len[TC_CR] == 0)
+			TermProfileLoad(&TermFallback, PROFILE_VT100);
+		*Known = 0;
+		return &TermFallback;
+	}
+	strncpy(E->Caps.Name, Name, sizeof(E->Caps.Name) - 1);
+
+#ifdef REX_USE_TERMINFO
+	if (Name[0] && TermInfoLoad(&E->Caps))
+	{
+		E->Known = 1;
+	}
+	else
+	{
+		memset(E->Caps.Str, 0, sizeof(E->Caps.Str));
+		memset(E->Caps.Len, 0, sizeof(E->Caps.Len));
+		memset(E->Caps.Parm, 0, sizeof(E->Caps.Parm));
+	}
+#endif
+	if (!E->Known)
+	{
+		for (i = 0; i < sizeof(TermNames) / sizeof(TermNames[0]); i++)
+		{
+			if (!strncmp(Name, TermNames[i].Prefix, strlen(TermNames[i].Prefix)))
+			{
+				Profile = TermNames[i].Profile;
+				E->Known = 1;
+				break;
+			}
+		}
+		TermProfileLoad(&E->Caps, Profile);
+	}
+
+	E->Next = TermCache;
+	TermCache = E;
+	*Known = E->Known;
+	return &E->Caps;
+}
+
+/******************************************************************************
+* Function Name : TermParmCost
+* Parameters    : [in] Caps - capability table
+*                 [in] Parm - TP_ sequence
+*                 [in] Count - its argument
+* Description   : Gives the length of a parameterized sequence
+* Return Value  : the length, UINT_MAX if it cannot be used
+******************************************************************************/
+
+unsigned int TermParmCost(const TermCaps *Caps, int Parm, unsigned int Count)
+{
+	const TermParm *P = &Caps->Parm[Parm];
+
+	Count += P->Base;
+	if ((P->PreLen == 0) || (Count > TERM_MAX_PARM))
+		return UINT_MAX;
+	return P->PreLen + P->PostLen + 1 + (Count >= 10) + (Count >= 100);
+}
+
+/******************************************************************************
+* Function Name : TermParmEncode
+* Parameters    : [in] Caps - capability table
+*                 [in] Parm - TP_ sequence
+*                 [in] Count - its argument, TermParmCost must allow it
+*                 [out] Out - room for the sequence
+* Description   : Puts together a parameterized sequence
+* Return Value  : its length
+******************************************************************************/
+
+unsigned int TermParmEncode(const TermCaps *Caps, int Parm, unsigned int Count,
+							char *Out)
+{
+	const TermParm *P = &Caps->Parm[Parm];
+	char *p = Out;
+
+	Count += P->Base;
+	memcpy(p, P->Pre, P->PreLen);
+	p += P->PreLen;
+	if (Count >= 100)
+		*p++ = (char)('0' + Count / 100);
+	if (Count >= 10)
+		*p++ = (char)('0' + Count / 10 % 10);
+	*p++ = (char)('0' + Count % 10);
+	memcpy(p, P->Post, P->PostLen);
+	return (unsigned int)(p - Out) + P->PostLen;
+}
@@ -0,0 +1,78 @@
+/*******************************************************************************
+* Module Name : keyboard_term.h
+* Description : Contains function declarations for keyboard_term.c
+*******************************************************************************/
+#ifndef _KEYBOARD_TERM_
+#define _KEYBOARD_TERM_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest sequence kept, longer terminfo strings count as missing
+#define TERM_SEQ_MAX		12
+// Largest count put in a parameterized sequence
+#define TERM_MAX_PARM		999
+
+/* Plain sequences */
+enum
+{
+	TC_UP,			/* cursor up one row, no scrolling */
+	TC_DOWN,		/* cursor down one row, no scrolling */
+	TC_LEFT,		/* cursor left one column */
+	TC_RIGHT,		/* cursor right one column */
+	TC_CR,			/* cursor to column 0 */
+	TC_CLR_EOL,		/* clear to end of line */
+	TC_CLR_EOS,		/* clear to end of screen */
+	TC_CLEAR,		/* clear screen, cursor home */
+	TC_ICH,			/* insert a blank, shifting the row right */
+	TC_DCH,			/* delete a char, shifting the row left */
+	TC_STR_COUNT
+};
+
+/* Sequences taking a count */
+enum
+{
+	TP_UP,
+	TP_DOWN,
+	TP_LEFT,
+	TP_RIGHT,
+	TP_COLUMN,		/* absolute column, 0 based */
+	TP_COUNT
+};
+
+/*
+ A parameterized sequence, split around its single number so it is put
+ out without formatting: Pre, the count plus Base, Post.
+*/
+typedef struct TermParm
+{
+	char Pre[TERM_SEQ_MAX];
+	char Post[TERM_SEQ_MAX];
+	unsigned char PreLen;		// 0 if the terminal lacks it
+	unsigned char PostLen;
+	unsigned char Base;		// 1 for 1 based counts (terminfo %i)
+} TermParm;
+
+/*
+ Pre-encoded sequences of one terminal type. The length of a sequence is
+ also its cost in bytes; a length of 0 marks it missing.
+*/
+typedef struct TermCaps
+{
+	char Name[32];
+	char Str[TC_STR_COUNT][TERM_SEQ_MAX];
+	unsigned char Len[TC_STR_COUNT];
+	TermParm Parm[TP_COUNT];
+} TermCaps;
+
+const TermCaps *TermCapsLoad(const char *Name, int *Known);
+unsigned int TermParmCost(const TermCaps *Caps, int Parm, unsigned int Count);
+unsigned int TermParmEncode(const TermCaps *Caps, int Parm, unsigned int Count,
+							char *Out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/*******************************************************************************
+* Module Name : bench_latency.c
+* Description : Measures the time to process one key stroke, with syntax
+*               highlighting off and on. Keys are fed one at a time to a
+*               headless session (the echo is built but not written) and
+*               each CmdLinePoll call is timed; the median, 99th percentile
+*               and worst times are reported. The same keys are typed once
+*               more on a session writing to a pipe to count the bytes of
+*               echo a line takes in each mode.
+*
+*                   gcc -O2 -c -Dmain=rex_demo_main ../keyboard_*.c
+*                   gcc -O2 -I.. bench_latency.c keyboard_*.o -o bench_latency
+*                   ./bench_latency [lines]
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "keyboard_driver.h"
+
+// Typed into every line: commands, options, quotes and operators
+static const char Text[] =
+	"find /var/log -name '*.log' -mtime +7 | xargs grep -l \"error code\" "
+	"&& echo \"done: $(date)\" > /tmp/report.txt; ls -la --color=auto /tmp "
+	"| sort -k5 -n | tail -20 && unknowncmd --flag 'unterminated";
+
+// Edits in the middle of the line afterwards
+static const char Edits[] =
+	"\x01\x1b" "f\x1b" "f\x1b" "fXYZ \x7f\x7f\x7f\x7f\x1b[3~\x1b[3~\x05\x1b" "b"
+	"\x1b" "b\"\x1b[D\x1b[D\x1b[D'\x17\x01\x1b[C\x1b[C\x7f\x7f\x05";
+
+static int Ns[2][1 << 20];
+
+/******************************************************************************
+* Function Name : IsCommand
+* Parameters    : [in] Word - command word
+*                 [in] Len - its length
+* Description   : Knows a handful of commands, like a shell's hash table
+* Return Value  : 1 if known
+******************************************************************************/
+
+static int IsCommand(const char *Word, unsigned short Len)
+{
+	static const char *Known[] = { "find", "xargs", "grep", "echo", "date",
+								   "ls", "sort", "tail" };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(Known) / sizeof(Known[0]); i++)
+		if ((strlen(Known[i]) == Len) && (memcmp(Known[i], Word, Len) == 0))
+			return 1;
+	return 0;
+}
+
+/******************************************************************************
+* Function Name : Compare
+* Parameters    : [in] a, b - times to compare
+* Description   : qsort order for times
+* Return Value  : <0, 0 or >0
+******************************************************************************/
+
+static int Compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/******************************************************************************
+* Function Name : Key
+* Parameters    : [in] InFd - write end of the session input
+*                 [in] ch - key byte
+* Description   : Feeds one byte and times the processing of it
+* Return Value  : nanoseconds
+******************************************************************************/
+
+static int Key(int InFd, char ch)
+{
+	struct timespec t0, t1;
+
+	if (write(InFd, &ch, 1) != 1)
+		exit(2);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	CmdLinePoll();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (int)((t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec));
+}
+
+/******************************************************************************
+* Function Name : Echo
+* Parameters    : [in] InFd - write end of the session input
+*                 [in] OutFd - read end of the session output
+*                 [in] Keys - key bytes
+*                 [in] Len - number of them
+* Description   : Feeds the keys one at a time and reads back their echo
+* Return Value  : number of bytes of echo
+******************************************************************************/
+
+static unsigned long Echo(int InFd, int OutFd, const char *Keys, unsigned int Len)
+{
+	char Buf[4096];
+	unsigned long Bytes = 0;
+	unsigned int i;
+	ssize_t n;
+
+	for (i = 0; i < Len; i++)
+	{
+		if (write(InFd, &Keys[i], 1) != 1)
+			exit(2);
+		CmdLinePoll();
+		while ((n = read(OutFd, Buf, sizeof(Buf))) > 0)
+			Bytes += n;
+	}
+	return Bytes;
+}
+
+int main(int argc, char **argv)
+{
+	int Lines = (argc > 1) ? atoi(argv[1]) : 2000;
+	char Buf[MAX_CMD_SIZE];
+	ConsoleSession *Cs, *Cw;
+	int In[2], Out[2], Hl, Line, Count[2] = { 0, 0 };
+	unsigned long Bytes[2];
+	unsigned int i;
+
+	if ((pipe(In) < 0) || (pipe(Out) < 0))
+		return 2;
+	fcntl(In[0], F_SETFL, O_NONBLOCK);
+	fcntl(Out[0], F_SETFL, O_NONBLOCK);
+	fcntl(Out[1], F_SETFL, O_NONBLOCK);
+	// the timed session is headless, the other one counts the echo
+	Cw = ConsoleSessionCreate(In[0], Out[1]);
+	ConsoleSelectSession(Cw);
+	ConsoleSetSuggest(REX_SUGGEST_OFF);
+	Cs = ConsoleSessionCreate(In[0], -1);
+	ConsoleSelectSession(Cs);
+	ConsoleSetSuggest(REX_SUGGEST_OFF);
+	g_ColumnLen = 80;
+
+	for (Hl = 0; Hl < 2; Hl++)
+	{
+		ConsoleSetHighlight(Hl ? REX_HIGHLIGHT_ON : REX_HIGHLIGHT_OFF, IsCommand);
+		for (Line = 0; Line < Lines; Line++)
+		{
+			Buf[0] = 0;
+			CmdLineBegin("$ ", Buf, 0, 0);
+			for (i = 0; i < sizeof(Text) - 1; i++)
+				Ns[Hl][Count[Hl]++ % (1 << 20)] = Key(In[1], Text[i]);
+			for (i = 0; i < sizeof(Edits) - 1; i++)
+				Ns[Hl][Count[Hl]++ % (1 << 20)] = Key(In[1], Edits[i]);
+			// ends the line; not timed, it adds to the history
+			Key(In[1], '\r');
+		}
+
+		ConsoleSelectSession(Cw);
+		ConsoleSetHighlight(Hl ? REX_HIGHLIGHT_ON : REX_HIGHLIGHT_OFF, IsCommand);
+		Buf[0] = 0;
+		CmdLineBegin("$ ", Buf, 0, 0);
+		Bytes[Hl] = Echo(In[1], Out[0], Text, sizeof(Text) - 1) +
+					Echo(In[1], Out[0], Edits, sizeof(Edits) - 1);
+		Echo(In[1], Out[0], "\r", 1);
+		ConsoleSelectSession(Cs);
+	}
+
+	printf("%-10s %10s %10s %10s %10s\n", "highlight", "echo/line",
+		   "median ns", "p99 ns", "max ns");
+	for (Hl = 0; Hl < 2; Hl++)
+	{
+		if (Count[Hl] > (1 << 20))
+			Count[Hl] = 1 << 20;
+		qsort(Ns[Hl], Count[Hl], sizeof(int), Compare);
+		printf("%-10s %10lu %10d %10d %10d\n", Hl ? "on" : "off", Bytes[Hl],
+			   Ns[Hl][Count[Hl] / 2], Ns[Hl][Count[Hl] * 99 / 100],
+			   Ns[Hl][Count[Hl] - 1]);
+	}
+	ConsoleSelectSession(NULL);
+	ConsoleSessionDestroy(Cs);
+	ConsoleSessionDestroy(Cw);
+	return 0;
+}
@@ -0,0 +1,214 @@
+/*******************************************************************************
+* Module Name : bench_sessions.cpp
+* Description : Scaling benchmark for many concurrent console sessions, one
+*               thread driving all of them through rex::session coroutines
+*               on rex::epoll_executor against one thread per session.
+*               Each session reads LINES lines typed one key per write()
+*               over a socketpair; the time until all are read and the
+*               peak RSS of the process are reported.
+*
+*                   gcc -O2 -c -Dmain=rex_demo_main ../keyboard_*.c
+*                   g++ -std=c++20 -O2 -I.. bench_sessions.cpp keyboard_*.o \
+*                       -lpthread -o bench_sessions
+*                   ./bench_sessions coro 1000
+*                   ./bench_sessions thread 1000
+*
+*               The driver keeps the selected session in a global, so the
+*               threads take turns under a mutex to process their keys, as a
+*               server built on GetCmdLine threads would have to.
+*******************************************************************************/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "keyboard_session.hpp"
+
+#define LINES		20
+#define LINE_KEYS	24
+
+using Exec = rex::epoll_executor;
+
+static std::mutex DriverLock;
+static int Failed;
+
+/******************************************************************************
+* Function Name : Expected
+* Parameters    : [in] Id - session number
+* Description   : Gives the line typed into a session
+* Return Value  : the line, LINE_KEYS characters
+******************************************************************************/
+
+static std::string Expected(int Id)
+{
+	char Line[LINE_KEYS + 1];
+
+	std::snprintf(Line, sizeof(Line), "session %06d %-9s", Id, "line");
+	return std::string(Line, LINE_KEYS);
+}
+
+/******************************************************************************
+* Function Name : CoroSession
+* Parameters    : [in] Ex - executor
+*                 [in] Fd - server end of the session socket
+*                 [in] Id - session number
+* Description   : Reads the lines of one session through a coroutine
+* Return Value  : 0
+******************************************************************************/
+
+static rex::task<int> CoroSession(Exec &Ex, int Fd, int Id)
+{
+	rex::session<Exec> S(Ex, Fd, Fd);
+	std::string Want = Expected(Id);
+
+	for (int i = 0; i < LINES; i++)
+	{
+		auto R = co_await S.read_line();
+		if (!R.ok() || (R.line != Want))
+			Failed++;
+	}
+	co_return 0;
+}
+
+/******************************************************************************
+* Function Name : ThreadSession
+* Parameters    : [in] Fd - server end of the session socket
+*                 [in] Id - session number
+* Description   : Reads the lines of one session on its own thread
+* Return Value  : NULL
+******************************************************************************/
+
+static void ThreadSession(int Fd, int Id)
+{
+	char Buf[MAX_CMD_SIZE];
+	std::string Want = Expected(Id);
+	struct pollfd pfd = {Fd, POLLIN, 0};
+	ConsoleSession *Cs, *Prev;
+	unsigned short rc;
+	int Timeout = -1;
+
+	{
+		std::lock_guard<std::mutex> Guard(DriverLock);
+		Cs = ConsoleSessionCreate(Fd, Fd);
+	}
+	for (int i = 0; i < LINES; i++)
+	{
+		Buf[0] = 0;
+		{
+			std::lock_guard<std::mutex> Guard(DriverLock);
+			Prev = ConsoleSelectSession(Cs);
+			CmdLineBegin(nullptr, Buf, 0, 0);
+			rc = CmdLinePoll();
+			Timeout = ConsolePollTimeout();
+			ConsoleSelectSession(Prev);
+		}
+		while (rc == REX_KEY_AGAIN)
+		{
+			poll(&pfd, 1, Timeout);
+			std::lock_guard<std::mutex> Guard(DriverLock);
+			Prev = ConsoleSelectSession(Cs);
+			rc = CmdLinePoll();
+			Timeout = ConsolePollTimeout();
+			ConsoleSelectSession(Prev);
+		}
+		if ((rc != 0) || (Want != Buf))
+		{
+			std::lock_guard<std::mutex> Guard(DriverLock);
+			Failed++;
+		}
+	}
+	std::lock_guard<std::mutex> Guard(DriverLock);
+	ConsoleSessionDestroy(Cs);
+}
+
+/******************************************************************************
+* Function Name : Type
+* Parameters    : [in] Fds - client ends of the session sockets
+* Description   : Types the lines into all sessions, one key per write() in
+*                 turn, and reads back the echo after each line
+* Return Value  : NULL
+******************************************************************************/
+
+static void Type(const std::vector<int> &Fds)
+{
+	std::vector<std::string> Lines;
+	char Echo[4096];
+	std::size_t Id;
+
+	for (Id = 0; Id < Fds.size(); Id++)
+		Lines.push_back(Expected(Id) + '\r');
+	for (int i = 0; i < LINES; i++)
+	{
+		for (int k = 0; k <= LINE_KEYS; k++)
+			for (Id = 0; Id < Fds.size(); Id++)
+				if (write(Fds[Id], &Lines[Id][k], 1) != 1)
+					std::abort();
+		for (Id = 0; Id < Fds.size(); Id++)
+			while (read(Fds[Id], Echo, sizeof(Echo)) > 0)
+				;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool Coro = (argc > 1) && (std::strcmp(argv[1], "coro") == 0);
+	int Count = (argc > 2) ? std::atoi(argv[2]) : 1000;
+	std::vector<int> Server, Client;
+	std::vector<std::thread> Threads;
+	struct rlimit Lim;
+	struct rusage Usage;
+	int Pair[2];
+	Exec Ex;
+
+	getrlimit(RLIMIT_NOFILE, &Lim);
+	Lim.rlim_cur = Lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &Lim);
+
+	for (int Id = 0; Id < Count; Id++)
+	{
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, Pair) < 0)
+		{
+			std::perror("socketpair");
+			return 1;
+		}
+		fcntl(Pair[0], F_SETFL, O_NONBLOCK);
+		fcntl(Pair[1], F_SETFL, O_NONBLOCK);
+		Server.push_back(Pair[0]);
+		Client.push_back(Pair[1]);
+	}
+
+	auto Start = std::chrono::steady_clock::now();
+	std::thread Typist(Type, std::cref(Client));
+	if (Coro)
+	{
+		for (int Id = 0; Id < Count; Id++)
+			Ex.spawn(CoroSession(Ex, Server[Id], Id));
+		Ex.run();
+	}
+	else
+	{
+		for (int Id = 0; Id < Count; Id++)
+			Threads.emplace_back(ThreadSession, Server[Id], Id);
+		for (auto &T : Threads)
+			T.join();
+	}
+	Typist.join();
+	auto Took = std::chrono::steady_clock::now() - Start;
+
+	getrusage(RUSAGE_SELF, &Usage);
+	std::printf("%s: %d sessions, %d lines each, %.1f ms, %.0f keys/s, "
+				"max RSS %ld KB, %d bad lines\n",
+				Coro ? "coroutines" : "threads", Count, LINES,
+				std::chrono::duration<double, std::milli>(Took).count(),
+				(double)Count * LINES * (LINE_KEYS + 1) /
+					std::chrono::duration<double>(Took).count(),
+				Usage.ru_maxrss, Failed);
+	return Failed != 0;
+}
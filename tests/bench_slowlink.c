@@ -0,0 +1,217 @@
+/*******************************************************************************
+* Module Name : bench_slowlink.c
+* Description : Counts the bytes sent to the terminal for mid-line edits
+*               with the slow-link mode off and on, and for cursor moves
+*               alone, for several terminal types and widths. Every run is
+*               played on a ShadowScreen and must leave the same screen as
+*               the plain vt100 run, so the bytes saved are never paid for
+*               with a wrong echo.
+*
+*                   gcc -O1 -c -Dmain=rex_demo_main ../keyboard_*.c
+*                   gcc -O1 -I.. bench_slowlink.c keyboard_*.o \
+*                       -o bench_slowlink
+*                   ./bench_slowlink [traces]
+*******************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "keyboard_driver.h"
+#include "keyboard_shadow.h"
+
+#define KEYS_MAX	8192
+
+static const char *Terminals[] = { "vt100", "vt52", "vt220", "xterm" };
+static const int Widths[] = { 40, 80, 132 };
+
+static unsigned int Rand = 1;
+static ShadowScreen Shadow;
+static int In[2], Out[2];
+
+/******************************************************************************
+* Function Name : Next
+* Parameters    : [in] Range - number of values
+* Description   : Small LCG so that every run types the same traces
+* Return Value  : a value below Range
+******************************************************************************/
+
+static unsigned int Next(unsigned int Range)
+{
+	Rand = Rand * 1103515245u + 12345u;
+	return (Rand >> 16) % Range;
+}
+
+/******************************************************************************
+* Function Name : MakeTrace
+* Parameters    : [out] Base - line typed first
+*                 [out] Edits - edits made in it afterwards, ended by enter
+*                 [in] MovesOnly - 1 to only move the cursor around
+* Description   : Builds one trace: a long line, then moves, inserts and
+*                 deletes in the middle of it
+* Return Value  : NULL
+******************************************************************************/
+
+static void MakeTrace(char *Base, char *Edits, int MovesOnly)
+{
+	static const char *Moves[] = { "\x1b[D", "\x1b[C", "\x1b" "b", "\x1b" "f",
+								   "\x01", "\x05" };
+	int Len = 60 + Next(160), i, n, Step;
+
+	for (i = 0; i < Len; i++)
+		Base[i] = (Next(6) == 0) ? ' ' : 'a' + Next(26);
+	Base[Len] = 0;
+
+	Edits[0] = 0;
+	for (Step = 0; Step < 40; Step++)
+	{
+		switch (MovesOnly ? 0 : Next(4))
+		{
+		case 0:
+			for (n = 1 + Next(8); n > 0; n--)
+				strcat(Edits, Moves[Next(6)]);
+			break;
+		case 1:
+			for (n = 1 + Next(5), i = strlen(Edits); n > 0; n--)
+				Edits[i++] = 'A' + Next(26);
+			Edits[i] = 0;
+			break;
+		case 2:
+			for (n = 1 + Next(3); n > 0; n--)
+				strcat(Edits, "\x7f");
+			break;
+		default:
+			for (n = 1 + Next(3); n > 0; n--)
+				strcat(Edits, "\x1b[3~");
+			break;
+		}
+	}
+	strcat(Edits, "\r");
+}
+
+/******************************************************************************
+* Function Name : Type
+* Parameters    : [in] Keys - keys to type
+* Description   : Types Keys into the current session and plays the echo
+*                 on the shadow screen
+* Return Value  : number of bytes echoed
+******************************************************************************/
+
+static unsigned long Type(const char *Keys)
+{
+	char Echo[65536];
+	unsigned long Bytes = 0;
+	int n;
+
+	if (write(In[1], Keys, strlen(Keys)) != (ssize_t)strlen(Keys))
+		exit(2);
+	CmdLinePoll();
+	while ((n = read(Out[0], Echo, sizeof(Echo))) > 0)
+	{
+		ShadowFeed(&Shadow, Echo, n);
+		Bytes += n;
+	}
+	return Bytes;
+}
+
+/******************************************************************************
+* Function Name : Run
+* Parameters    : [in] Term - terminal type
+*                 [in] Cols - terminal width
+*                 [in] SlowLink - REX_SLOWLINK_OFF or REX_SLOWLINK_AUTO
+*                 [in] MovesOnly - 1 for traces of cursor moves alone
+*                 [in] Traces - number of traces
+*                 [in,out] Reference - final screen of each trace; filled in
+*                                      when Fill is set, else compared to
+*                 [in] Fill - 1 for the reference run
+* Description   : Types the traces into the current session
+* Return Value  : bytes echoed for the edits, 0 if a screen went wrong
+******************************************************************************/
+
+static unsigned long Run(const char *Term, int Cols, int SlowLink, int MovesOnly,
+						 int Traces, ShadowScreen *Reference, int Fill)
+{
+	static char Base[KEYS_MAX], Edits[KEYS_MAX];
+	char Buf[MAX_CMD_SIZE];
+	unsigned long Bytes = 0;
+	int Tr, Bad = 0;
+
+	ConsoleSetTerminal(Term);
+	ConsoleSetSlowLink(SlowLink);
+	g_ColumnLen = Cols;
+	Rand = 1;
+	for (Tr = 0; Tr < Traces; Tr++)
+	{
+		MakeTrace(Base, Edits, MovesOnly);
+		ShadowReset(&Shadow, Cols);
+		Buf[0] = 0;
+		CmdLineBegin("> ", Buf, 0, 0);
+		Type(Base);
+		Bytes += Type(Edits);
+		if (Fill)
+			Reference[Tr] = Shadow;
+		if (Shadow.Lost ||
+			memcmp(Shadow.Cell, Reference[Tr].Cell, sizeof(Shadow.Cell)) ||
+			(Shadow.X != Reference[Tr].X) || (Shadow.Y != Reference[Tr].Y))
+		{
+			fprintf(stderr, "%s/%d slow-link %d trace %d: screen differs\n",
+					Term, Cols, SlowLink, Tr);
+			Bad = 1;
+		}
+	}
+	return Bad ? 0 : Bytes;
+}
+
+int main(int argc, char **argv)
+{
+	int Traces = (argc > 1) ? atoi(argv[1]) : 200;
+	ShadowScreen *Reference = calloc(Traces, sizeof(ShadowScreen));
+	unsigned long Bytes[2];
+	ConsoleSession *Cs;
+	int w, t, Moves, Bad = 0;
+
+	if ((Reference == NULL) || (pipe(In) < 0) || (pipe(Out) < 0))
+		return 2;
+	fcntl(In[0], F_SETFL, O_NONBLOCK);
+	fcntl(Out[0], F_SETFL, O_NONBLOCK);
+	fcntl(Out[1], F_SETPIPE_SZ, 1 << 20);
+	Cs = ConsoleSessionCreate(In[0], Out[1]);
+	ConsoleSelectSession(Cs);
+	ConsoleSetSuggest(REX_SUGGEST_OFF);
+
+	for (Moves = 0; Moves < 2; Moves++)
+	{
+		if (Moves)
+			printf("\ncursor moves only\n%-6s %5s %12s\n", "term", "cols", "bytes");
+		else
+			printf("edits\n%-6s %5s %12s %12s %7s\n", "term", "cols", "reprint",
+				   "slow-link", "saved");
+		for (w = 0; w < (int)(sizeof(Widths) / sizeof(Widths[0])); w++)
+		{
+			for (t = 0; t < (int)(sizeof(Terminals) / sizeof(Terminals[0])); t++)
+			{
+				// the first run of each width is the reference
+				Bytes[0] = Run(Terminals[t], Widths[w], REX_SLOWLINK_OFF, Moves,
+							   Traces, Reference, t == 0);
+				Bad |= (Bytes[0] == 0);
+				if (Moves)
+				{
+					printf("%-6s %5d %12lu\n", Terminals[t], Widths[w], Bytes[0]);
+					continue;
+				}
+				Bytes[1] = Run(Terminals[t], Widths[w], REX_SLOWLINK_AUTO, Moves,
+							   Traces, Reference, 0);
+				Bad |= (Bytes[1] == 0);
+				printf("%-6s %5d %12lu %12lu %6.1f%%\n", Terminals[t], Widths[w],
+					   Bytes[0], Bytes[1],
+					   Bytes[0] ? 100.0 * ((double)Bytes[0] - (double)Bytes[1]) /
+								  (double)Bytes[0] : 0.0);
+			}
+		}
+	}
+	ConsoleSelectSession(NULL);
+	ConsoleSessionDestroy(Cs);
+	free(Reference);
+	return Bad;
+}
@@ -0,0 +1,190 @@
+/*******************************************************************************
+* Module Name : fuzz_editor.c
+* Description : Fuzz target for the key decoder and the renderer. Each input
+*               is typed into a fresh headless session of a REX_SELF_CHECK
+*               build, which plays the echo on a shadow screen and checks it
+*               against the line after every key; a mismatch aborts here.
+*               The first two bytes pick the width and the session options,
+*               the rest are the keys.
+*
+*               With libFuzzer:
+*                   clang -g -O1 -fsanitize=fuzzer,address -DREX_SELF_CHECK \
+*                       -DREX_LIBFUZZER -Dmain=rex_demo_main -I.. \
+*                       fuzz_editor.c ../keyboard_*.c -o fuzz_editor
+*                   ./fuzz_editor
+*
+*               Standalone, typing random inputs and reporting throughput,
+*               or replaying the inputs named on the command line:
+*                   gcc -O2 -c -DREX_SELF_CHECK -Dmain=rex_demo_main \
+*                       ../keyboard_*.c
+*                   gcc -O2 -DREX_SELF_CHECK -I.. fuzz_editor.c keyboard_*.o \
+*                       -o fuzz_editor
+*                   ./fuzz_editor [-n inputs] [file...]
+*******************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "keyboard_driver.h"
+
+#ifndef REX_SELF_CHECK
+#error fuzz_editor needs a REX_SELF_CHECK build
+#endif
+
+// Longest input typed, well below the pipe capacity
+#define FUZZ_INPUT_MAX		16384
+
+static const char *Terminals[] = { "xterm", "vt100", "vt220", "vt52" };
+static const char *Prompts[] = { "", "> ", "router(config)# " };
+
+/******************************************************************************
+* Function Name : Complete
+* Parameters    : [in] CmdLine - line being edited
+*                 [in] Cursor - cursor position
+*                 [out] Out - candidates
+* Description   : Offers a few fixed candidates
+* Return Value  : NULL
+******************************************************************************/
+
+static void Complete(const char *CmdLine, unsigned short Cursor,
+					 ConsoleCompletions *Out)
+{
+	static const char *Words[] = { "show", "shutdown", "interface", "ip",
+								   "ipv6", "dir/", "a b" };
+	unsigned int i;
+
+	(void)CmdLine;
+	(void)Cursor;
+	for (i = 0; i < sizeof(Words) / sizeof(Words[0]); i++)
+		ConsoleAddCompletion(Out, Words[i]);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
+{
+	char Buf[MAX_CMD_SIZE];
+	ConsoleSession *Cs;
+	unsigned short rc;
+	unsigned long Failed;
+	int In[2], Opt;
+
+	if ((Size < 2) || (Size > FUZZ_INPUT_MAX) || (pipe(In) < 0))
+		return 0;
+	fcntl(In[0], F_SETFL, O_NONBLOCK);
+	if (write(In[1], Data + 2, Size - 2) != (ssize_t)(Size - 2))
+		abort();
+	close(In[1]);
+
+	// headless, the echo is only played on the shadow screen
+	Cs = ConsoleSessionCreate(In[0], -1);
+	ConsoleSelectSession(Cs);
+	g_ColumnLen = 8 + Data[0] % 120;
+	Opt = Data[1];
+	ConsoleSetTerminal(Terminals[Opt & 3]);
+	ConsoleSetSlowLink((Opt & 4) ? REX_SLOWLINK_ON : REX_SLOWLINK_OFF);
+	ConsoleSetHighlight((Opt & 8) ? REX_HIGHLIGHT_ON : REX_HIGHLIGHT_OFF, NULL);
+	ConsoleSetSuggest((Opt & 16) ? REX_SUGGEST_ON : REX_SUGGEST_OFF);
+	ConsoleSetMatchMode((Opt & 32) ? REX_MATCH_FUZZY : REX_MATCH_PREFIX);
+	ConsoleSetCompleter(Complete);
+	ConsoleHistoryAdd("show interface brief");
+	ConsoleHistoryAdd("ip route 10.0.0.0 255.0.0.0");
+
+	// every line read in turn, until the end of the input
+	do
+	{
+		Buf[0] = 0;
+		CmdLineBegin(Prompts[(Opt >> 6) % 3], Buf, 0, (Opt >> 6) == 3);
+		while ((rc = CmdLinePoll()) == REX_KEY_AGAIN)
+			;
+	} while ((rc == 0) || (rc == REX_KEY_TOOLONG));
+
+	Failed = ConsoleSelfCheckFailures();
+	ConsoleSelectSession(NULL);
+	ConsoleSessionDestroy(Cs);
+	close(In[0]);
+	if (Failed)
+		abort();
+	return 0;
+}
+
+#ifndef REX_LIBFUZZER
+/******************************************************************************
+* Function Name : Replay
+* Parameters    : [in] Path - file holding one input
+* Description   : Types one saved input, e.g. a crash found by libFuzzer
+* Return Value  : NULL
+******************************************************************************/
+
+static void Replay(const char *Path)
+{
+	static uint8_t Data[FUZZ_INPUT_MAX];
+	FILE *f = fopen(Path, "rb");
+	size_t Size;
+
+	if (f == NULL)
+	{
+		perror(Path);
+		exit(2);
+	}
+	Size = fread(Data, 1, sizeof(Data), f);
+	fclose(f);
+	LLVMFuzzerTestOneInput(Data, Size);
+	printf("%s: ok\n", Path);
+}
+
+int main(int argc, char **argv)
+{
+	// keys likely to matter, mixed with random bytes
+	static const char *Keys[] = { "\x1b[D", "\x1b[C", "\x1b[A", "\x1b[B",
+		"\x1b[H", "\x1b[F", "\x1b[3~", "\x7f", "\x01", "\x05", "\x0b", "\x15",
+		"\x17", "\x1b" "b", "\x1b" "f", "\x1b" "d", "\x1f", "\x1b_", "\x12",
+		"\x07", "\t", "\x0c", "\x14", "\x19", "\x1b", "\\\r", "\r", " ", "ab",
+		"show ", "\"x y\" ", "'q", "|", "-v ", "$(" };
+	static uint8_t Data[FUZZ_INPUT_MAX];
+	unsigned long Inputs = 20000, n, Bytes = 0;
+	struct timespec t0, t1;
+	size_t Size, Len;
+	const char *Key;
+	double Took;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc))
+			Inputs = strtoul(argv[++i], NULL, 0);
+		else
+			Replay(argv[i]);
+	}
+	if (argc > 1 && strcmp(argv[1], "-n") != 0)
+		return 0;
+
+	srand(1);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (n = 0; n < Inputs; n++)
+	{
+		Data[0] = rand();
+		Data[1] = rand();
+		for (Size = 2; Size < 600; Size += Len)
+		{
+			if (rand() % 8 == 0)
+			{
+				Data[Size] = rand();
+				Len = 1;
+				continue;
+			}
+			Key = Keys[rand() % (sizeof(Keys) / sizeof(Keys[0]))];
+			Len = strlen(Key);
+			memcpy(&Data[Size], Key, Len);
+		}
+		LLVMFuzzerTestOneInput(Data, Size);
+		Bytes += Size;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	Took = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%lu inputs, %lu bytes in %.2f s: %.0f inputs/s, %.2f MB/s\n",
+		   Inputs, Bytes, Took, Inputs / Took, Bytes / Took / 1e6);
+	return 0;
+}
+#endif
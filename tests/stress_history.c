@@ -0,0 +1,179 @@
+/*******************************************************************************
+* Module Name : stress_history.c
+* Description : Stress test for the shared history ring. Forked writers
+*               append self-describing entries as fast as they can while
+*               forked readers scan the ring and check every entry they get
+*               byte for byte, so a torn or mixed up entry is caught even
+*               if it slipped past the ring's own checks. One writer is
+*               killed half way to leave a slot mid-write behind.
+*
+*                   gcc -O2 -I.. stress_history.c ../keyboard_history.c \
+*                       -o stress_history
+*                   ./stress_history [writers] [readers] [entries]
+*******************************************************************************/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "keyboard_history.h"
+
+/******************************************************************************
+* Function Name : MakeEntry
+* Parameters    : [in] Writer - writer number
+*                 [in] Seq - entry number of that writer
+*                 [out] Buf - entry, SHM_HISTORY_LINE bytes
+* Description   : Builds the entry a writer appends. The length and the
+*                 filler both depend on Writer and Seq.
+* Return Value  : length of the entry
+******************************************************************************/
+
+static int MakeEntry(int Writer, unsigned int Seq, char *Buf)
+{
+	int Len = 24 + (int)((Seq * 7u + Writer * 13u) % (SHM_HISTORY_LINE - 25));
+	int n, i;
+
+	n = snprintf(Buf, SHM_HISTORY_LINE, "w%02d %010u ", Writer, Seq);
+	for (i = n; i < Len; i++)
+		Buf[i] = 'a' + (char)((Writer + Seq + i) % 26);
+	Buf[Len] = 0;
+	return Len;
+}
+
+/******************************************************************************
+* Function Name : Writer
+* Parameters    : [in] Name - segment name
+*                 [in] Id - writer number
+*                 [in] Count - entries to append
+* Description   : Appends Count entries, then exits
+* Return Value  : NULL
+******************************************************************************/
+
+static void Writer(const char *Name, int Id, unsigned int Count)
+{
+	ShmHistory *H = ShmHistoryOpen(Name);
+	char Buf[SHM_HISTORY_LINE];
+	unsigned int Seq;
+
+	if (H == NULL)
+		_exit(2);
+	for (Seq = 0; Seq < Count; Seq++)
+	{
+		MakeEntry(Id, Seq, Buf);
+		ShmHistoryAppend(H, Buf);
+	}
+	_exit(0);
+}
+
+/******************************************************************************
+* Function Name : Reader
+* Parameters    : [in] Name - segment name
+*                 [in] Stop - set by the parent once the writers are done
+* Description   : Scans the newest lap of the ring until told to stop and
+*                 checks every entry read. Within a scan, the entries of one
+*                 writer must come in the order it appended them.
+* Return Value  : NULL, exits with the number of bad entries (capped)
+******************************************************************************/
+
+static void Reader(const char *Name, volatile int *Stop, int Writers)
+{
+	ShmHistory *H = ShmHistoryOpen(Name);
+	char Buf[SHM_HISTORY_LINE], Want[SHM_HISTORY_LINE];
+	unsigned long Good = 0, Busy = 0, Gone = 0, Bad = 0;
+	long Last[100];
+	uint64_t Next, Ticket;
+	unsigned int Seq;
+	int Len, Id, w;
+
+	if (H == NULL)
+		_exit(2);
+	while (!*Stop)
+	{
+		for (w = 0; w < Writers; w++)
+			Last[w] = -1;
+		Next = ShmHistoryNext(H);
+		Ticket = (Next > SHM_HISTORY_SLOTS) ? Next - SHM_HISTORY_SLOTS : 0;
+		for (; Ticket < Next; Ticket++)
+		{
+			Len = ShmHistoryRead(H, Ticket, Buf);
+			if (Len == SHM_HISTORY_BUSY)
+			{
+				Busy++;
+				continue;
+			}
+			if (Len == SHM_HISTORY_GONE)
+			{
+				Gone++;
+				continue;
+			}
+			if ((sscanf(Buf, "w%d %u ", &Id, &Seq) != 2) ||
+				(Id < 0) || (Id >= Writers) ||
+				(MakeEntry(Id, Seq, Want) != Len) ||
+				(memcmp(Buf, Want, Len + 1) != 0) ||
+				((long)Seq <= Last[Id]))
+			{
+				if (Bad++ < 5)
+					fprintf(stderr, "ticket %llu: torn entry \"%s\"\n",
+							(unsigned long long)Ticket, Buf);
+				continue;
+			}
+			Last[Id] = Seq;
+			Good++;
+		}
+	}
+	printf("reader %d: %lu good, %lu busy, %lu overwritten, %lu bad\n",
+		   (int)getpid(), Good, Busy, Gone, Bad);
+	fflush(stdout);
+	_exit(Bad > 100 ? 100 : (int)Bad);
+}
+
+int main(int argc, char **argv)
+{
+	int Writers = (argc > 1) ? atoi(argv[1]) : 8;
+	int Readers = (argc > 2) ? atoi(argv[2]) : 4;
+	unsigned int Count = (argc > 3) ? (unsigned int)atoi(argv[3]) : 200000;
+	pid_t Pid[200];
+	volatile int *Stop;
+	char Name[64];
+	int i, Status, Failed = 0;
+
+	if ((Writers < 2) || (Writers > 100) || (Readers < 1) || (Readers > 100))
+		return 2;
+	snprintf(Name, sizeof(Name), "/rex_stress_history_%d", (int)getpid());
+	shm_unlink(Name);
+	Stop = mmap(NULL, sizeof(*Stop), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (Stop == MAP_FAILED)
+		return 2;
+	*Stop = 0;
+
+	for (i = 0; i < Readers; i++)
+		if ((Pid[i] = fork()) == 0)
+			Reader(Name, Stop, Writers);
+	for (i = 0; i < Writers; i++)
+		if ((Pid[Readers + i] = fork()) == 0)
+			Writer(Name, i, Count);
+
+	// the last writer dies half way, likely in the middle of an entry
+	usleep(20000);
+	kill(Pid[Readers + Writers - 1], SIGKILL);
+
+	for (i = 0; i < Writers; i++)
+	{
+		waitpid(Pid[Readers + i], &Status, 0);
+		if ((i < Writers - 1) && !(WIFEXITED(Status) && (WEXITSTATUS(Status) == 0)))
+			Failed = 1;
+	}
+	*Stop = 1;
+	for (i = 0; i < Readers; i++)
+	{
+		waitpid(Pid[i], &Status, 0);
+		if (!WIFEXITED(Status) || WEXITSTATUS(Status))
+			Failed = 1;
+	}
+	shm_unlink(Name);
+	printf("%s\n", Failed ? "FAIL" : "PASS");
+	return Failed;
+}
@@ -0,0 +1,130 @@
+/*******************************************************************************
+* Module Name : test_arena_alloc.c
+* Description : Checks that key strokes and completion do not call malloc
+*               once a session has seen its largest prompt, by counting the
+*               calls made through malloc/calloc/realloc while keys are
+*               processed. The counters wrap the glibc allocator.
+*
+*                   gcc -O1 -c -Dmain=rex_demo_main ../keyboard_*.c
+*                   gcc -O1 -I.. test_arena_alloc.c keyboard_*.o \
+*                       -o test_arena_alloc
+*                   ./test_arena_alloc
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "keyboard_driver.h"
+
+extern void *__libc_malloc(size_t Size);
+extern void *__libc_calloc(size_t Count, size_t Size);
+extern void *__libc_realloc(void *Ptr, size_t Size);
+
+static int Counting;
+static unsigned long Allocs;
+
+void *malloc(size_t Size)
+{
+	Allocs += Counting;
+	return __libc_malloc(Size);
+}
+
+void *calloc(size_t Count, size_t Size)
+{
+	Allocs += Counting;
+	return __libc_calloc(Count, Size);
+}
+
+void *realloc(void *Ptr, size_t Size)
+{
+	Allocs += Counting;
+	return __libc_realloc(Ptr, Size);
+}
+
+/******************************************************************************
+* Function Name : Complete
+* Parameters    : [in] CmdLine - line being edited
+*                 [in] Cursor - cursor position
+*                 [out] Out - candidates
+* Description   : Offers enough candidates to grow the arena past one block
+* Return Value  : NULL
+******************************************************************************/
+
+static void Complete(const char *CmdLine, unsigned short Cursor,
+					 ConsoleCompletions *Out)
+{
+	char Cand[64];
+	int i;
+
+	(void)CmdLine;
+	(void)Cursor;
+	for (i = 0; i < 2000; i++)
+	{
+		snprintf(Cand, sizeof(Cand), "interface-%04d-with-a-long-name", i);
+		ConsoleAddCompletion(Out, Cand);
+	}
+}
+
+/******************************************************************************
+* Function Name : Prompt
+* Parameters    : [in] InFd - write end of the session input
+*                 [in] Keys - keys typed before enter
+* Description   : Runs one prompt, counting the allocations made for Keys
+* Return Value  : number of allocations
+******************************************************************************/
+
+static unsigned long Prompt(int InFd, const char *Keys)
+{
+	char Buf[MAX_CMD_SIZE] = {0};
+	unsigned long Count;
+
+	if (write(InFd, Keys, strlen(Keys)) != (ssize_t)strlen(Keys))
+		exit(2);
+	Allocs = 0;
+	Counting = 1;
+	CmdLineBegin("> ", Buf, 0, 0);
+	if (CmdLinePoll() != REX_KEY_AGAIN)
+		exit(2);
+	Counting = 0;
+	Count = Allocs;
+
+	// ending the line adds it to the history, which may allocate
+	if ((write(InFd, "\r", 1) != 1) || (CmdLinePoll() != 0))
+		exit(2);
+	return Count;
+}
+
+int main(void)
+{
+	// completion with listing, edits, history recall and search
+	static const char Keys[] = "show int\t\t\t5\t\x7f\x7f\x01\x05\x1b" "b"
+		"\x17\x15" "abc def\x1b[D\x1b[D\x0b\x1b[A\x1b[B\x12sh\x07";
+	ConsoleSession *Cs, *Prev;
+	int In[2], Bad = 0;
+	unsigned long n;
+
+	if (pipe(In) < 0)
+		return 2;
+	fcntl(In[0], F_SETFL, O_NONBLOCK);
+	// headless, the echo is dropped
+	Cs = ConsoleSessionCreate(In[0], -1);
+	Prev = ConsoleSelectSession(Cs);
+	g_ColumnLen = 80;
+	g_RowLen = 1000;
+	ConsoleSetCompleter(Complete);
+
+	n = Prompt(In[1], Keys);
+	printf("first prompt: %lu allocations\n", n);
+	n = Prompt(In[1], Keys);
+	printf("same prompt again: %lu allocations\n", n);
+	Bad |= (n != 0);
+	n = Prompt(In[1], "plain typing without completion \x01\x05\x7f\x7f");
+	printf("plain key strokes: %lu allocations\n", n);
+	Bad |= (n != 0);
+
+	ConsoleSelectSession(Prev);
+	ConsoleSessionDestroy(Cs);
+	printf("%s\n", Bad ? "FAIL" : "PASS");
+	return Bad;
+}
@@ -0,0 +1,195 @@
+/*******************************************************************************
+* Module Name : test_fuzzy.c
+* Description : Checks the fuzzy ranking on a small set of commands, checks
+*               that narrowing a query step by step ranks the same as
+*               ranking every query afresh, and times FuzzyRank over 1M
+*               synthetic candidates, once from scratch and per key typed.
+*
+*                   gcc -O2 -I.. test_fuzzy.c ../keyboard_fuzzy.c -o test_fuzzy
+*                   ./test_fuzzy [candidates]
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "keyboard_fuzzy.h"
+
+static const char *Commands[] = {
+	"show interface brief", "show interfaces", "show ip interface brief",
+	"show running-config", "show startup-config", "shutdown",
+	"show ip route", "show history", "interface brief", "ship interactive",
+	"no shutdown", "show int", "configure terminal", "show version"
+};
+
+static const char *Words[] = {
+	"show", "interface", "brief", "ip", "route", "config", "running",
+	"vlan", "ethernet", "statistics", "counters", "detail", "bgp", "ospf",
+	"neighbor", "access-list", "policy", "queue", "summary", "clear"
+};
+
+// Queries typed one key at a time
+static const char *Queries[] = { "shintbr", "sipro", "vlandet", "xyz", "s" };
+
+static uint32_t Seed = 2463534242u;
+
+/******************************************************************************
+* Function Name : Random
+* Parameters    : NULL
+* Description   : xorshift32, so every run sees the same candidates
+* Return Value  : the next number
+******************************************************************************/
+
+static uint32_t Random(void)
+{
+	Seed ^= Seed << 13;
+	Seed ^= Seed >> 17;
+	Seed ^= Seed << 5;
+	return Seed;
+}
+
+/******************************************************************************
+* Function Name : SetMake
+* Parameters    : [out] Set - candidates
+*                 [out] St - state with room for them
+*                 [in] Str - the strings
+*                 [in] Count - how many
+* Description   : Builds and prepares a candidate set
+* Return Value  : NULL
+******************************************************************************/
+
+static void SetMake(FuzzySet *Set, FuzzyState *St, const char **Str,
+					unsigned int Count)
+{
+	unsigned int i;
+
+	Set->Str = Str;
+	Set->Len = malloc(Count * sizeof(*Set->Len));
+	Set->Mask = malloc(Count * sizeof(*Set->Mask));
+	Set->Count = Count;
+	memset(St, 0, sizeof(*St));
+	St->Alive = malloc(Count * sizeof(*St->Alive));
+	if ((Set->Len == NULL) || (Set->Mask == NULL) || (St->Alive == NULL))
+		exit(2);
+	for (i = 0; i < Count; i++)
+		Set->Len[i] = (unsigned short)strlen(Str[i]);
+	FuzzySetPrepare(Set);
+}
+
+/******************************************************************************
+* Function Name : Same
+* Parameters    : [in] A - state of a narrowed query
+*                 [in] B - state of the same query ranked afresh
+* Description   : Compares the matches and the ranking of two states
+* Return Value  : 1 if they agree
+******************************************************************************/
+
+static int Same(const FuzzyState *A, const FuzzyState *B)
+{
+	return (A->AliveCount == B->AliveCount) && (A->TopCount == B->TopCount) &&
+		   !memcmp(A->Alive, B->Alive, A->AliveCount * sizeof(*A->Alive)) &&
+		   !memcmp(A->Top, B->Top, A->TopCount * sizeof(*A->Top)) &&
+		   !memcmp(A->TopScore, B->TopScore, A->TopCount * sizeof(*A->TopScore));
+}
+
+/******************************************************************************
+* Function Name : Now
+* Parameters    : NULL
+* Description   : Reads the monotonic clock
+* Return Value  : seconds
+******************************************************************************/
+
+static double Now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int Count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+	unsigned int i, q, Len, WordCount = sizeof(Words) / sizeof(Words[0]);
+	FuzzySet Set;
+	FuzzyState St, Fresh;
+	const char **Str;
+	char *Text, *p;
+	double t0, Full, Key, KeyMax;
+	int Bad = 0;
+
+	// the scores alone
+	Bad |= (FuzzyScore("shb", 3, "show", 4) != -1);
+	Bad |= (FuzzyScore("SIB", 3, "show interface brief", 20) < 0);
+	Bad |= (FuzzyScore("sib", 3, "show interface brief", 20) <=
+			FuzzyScore("sib", 3, "xsxixbx", 7));
+	Bad |= (FuzzyScore("", 0, "anything", 8) != 0);
+	printf("scores: %s\n", Bad ? "FAIL" : "ok");
+
+	// the ranking of a few commands
+	SetMake(&Set, &St, Commands, sizeof(Commands) / sizeof(Commands[0]));
+	FuzzyRank(&Set, &St, "shintbr", 7);
+	printf("\"shintbr\" ranks \"%s\" first\n",
+		   St.TopCount ? Commands[St.Top[0]] : "(nothing)");
+	Bad |= !St.TopCount || strcmp(Commands[St.Top[0]], "show interface brief");
+	FuzzyRank(&Set, &St, "noshut", 6);
+	Bad |= !St.TopCount || strcmp(Commands[St.Top[0]], "no shutdown");
+	FuzzyRank(&Set, &St, "qqq", 3);
+	Bad |= (St.TopCount != 0);
+
+	// synthetic candidates of two to five words
+	Str = malloc(Count * sizeof(*Str));
+	Text = p = malloc((size_t)Count * 64);
+	if ((Str == NULL) || (Text == NULL))
+		return 2;
+	for (i = 0; i < Count; i++)
+	{
+		Str[i] = p;
+		Len = 2 + Random() % 4;
+		while (Len--)
+			p += sprintf(p, "%s ", Words[Random() % WordCount]);
+		// the last space ends the string
+		p[-1] = 0;
+	}
+	SetMake(&Set, &St, Str, Count);
+	Fresh = St;
+	Fresh.Alive = malloc(Count * sizeof(*Fresh.Alive));
+	if (Fresh.Alive == NULL)
+		return 2;
+
+	// narrowing one key at a time against ranking each query afresh
+	KeyMax = Key = Full = 0;
+	for (q = 0; q < sizeof(Queries) / sizeof(Queries[0]); q++)
+	{
+		St.Valid = 0;
+		for (Len = 1; Len <= strlen(Queries[q]); Len++)
+		{
+			t0 = Now();
+			FuzzyRank(&Set, &St, Queries[q], Len);
+			t0 = Now() - t0;
+			Key += t0;
+			if (t0 > KeyMax)
+				KeyMax = t0;
+
+			Fresh.Valid = 0;
+			t0 = Now();
+			FuzzyRank(&Set, &Fresh, Queries[q], Len);
+			Full += Now() - t0;
+			if (!Same(&St, &Fresh))
+			{
+				printf("\"%.*s\": narrowed and fresh ranking differ\n",
+					   (int)Len, Queries[q]);
+				Bad = 1;
+			}
+		}
+		printf("\"%s\": %u of %u match, best \"%s\"\n", Queries[q],
+			   St.AliveCount, Count, St.TopCount ? Str[St.Top[0]] : "(none)");
+	}
+	for (Len = q = 0; q < sizeof(Queries) / sizeof(Queries[0]); q++)
+		Len += strlen(Queries[q]);
+	printf("%u candidates, %u keys: %.2f ms per key narrowed (worst %.2f), "
+		   "%.2f ms ranked afresh\n", Count, Len, Key / Len * 1e3,
+		   KeyMax * 1e3, Full / Len * 1e3);
+
+	printf("%s\n", Bad ? "FAIL" : "PASS");
+	return Bad;
+}